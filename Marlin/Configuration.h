@@ -93,12 +93,12 @@
 // Comment the following line to disable PID and enable bang-bang.
 #define PIDTEMP
 #define PID_MAX 255 // limits current to nozzle; 255=full current
+#define K1 0.95 //smoothing factor withing the PID
+#define PID_dT ((TEMP_SAMPLE_TICKS)/(F_CPU / 64.0 / 256.0)) //sampling period of the PID, TEMP_SAMPLE_TICKS is in Configuration_adv.h
 #ifdef PIDTEMP
   //#define PID_DEBUG // Sends debug data to the serial port. 
   //#define PID_OPENLOOP 1 // Puts PID in open loop. M104 sets the output power in %
   #define PID_INTEGRAL_DRIVE_MAX 255  //limit for the integral term
-  #define K1 0.95 //smoothing factor withing the PID
-  #define PID_dT ((16.0 * 8.0)/(F_CPU / 64.0 / 256.0)) //sampling period of the
 
 // If you are using a preconfigured hotend then you can use one of the value sets by uncommenting it
 //Tuned Values: 
@@ -121,6 +121,21 @@
 //    #define  DEFAULT_Kd 440
 #endif // PIDTEMP
 
+// Bed PID settings:
+// With PIDTEMPBED the bed is driven with soft PWM from the same timer as the hotends and a PID loop
+// at the hotend sample rate, instead of being switched on or off every BED_CHECK_INTERVAL.
+// It is off because the gains below are the MendelMax ones, not tuned for this bed: turn it on, run
+// M303 E-1 S<temperature> before printing and put the result below, or set it with M304 and M500.
+// Don't use it if the bed is switched through a relay.
+//#define PIDTEMPBED
+#define MAX_BED_POWER 255 // limits duty cycle to bed; 255=full current
+#ifdef PIDTEMPBED
+// 12v 250W silicone heater into 4mm borosilicate (MendelMax 1.5+)
+    #define  DEFAULT_bedKp 10.00
+    #define  DEFAULT_bedKi .023
+    #define  DEFAULT_bedKd 305.4
+#endif // PIDTEMPBED
+
 //this prevents dangerous Extruder moves, i.e. if the temperature is under the limit
 //can be software-disabled for whatever purposes by
 //#define PREVENT_DANGEROUS_EXTRUDE
@@ -15,6 +15,22 @@
 #endif
 #define BED_CHECK_INTERVAL 5000 //ms
 
+// Temperature sampling. The timer 0 tick (1.024ms) starts one ADC conversion per tick. Every TEMP_SAMPLE_TICKS
+// each temperature input gets 17 conversions, one to settle after the mux change and 16 that are summed,
+// and the new readings of all heaters and the bed go to the heater control together.
+// This is the PID sampling period, PID_dT. It used to be 128. The first input takes one tick more, so
+// with 4 inputs (3 extruders and a bed) it has to be at least 69.
+#define TEMP_SAMPLE_TICKS 64
+
+// Temperature telemetry: every reading (raw ADC value, temperature, PID terms, heater power of each heater)
+// goes into a ring in RAM, which M305 writes out in one go. Recording pauses while the printer is stopped
+// after a thermal error. Each record takes 2+11*(EXTRUDERS+1) bytes, at most 255 records, so 32 records
+// are 768 bytes of RAM with one extruder. Turn it on for tuning, the SD features below need the RAM.
+//#define TEMP_TELEMETRY
+#ifdef TEMP_TELEMETRY
+  #define TEMP_TELEMETRY_SIZE 32  // records, 32 cover ~2 seconds with TEMP_SAMPLE_TICKS 64
+#endif
+
 //// Heating sanity check:
 // This waits for the watchperiod in milliseconds whenever an M104 or M109 increases the target temperature
 // If the temperature has not increased at the end of that period, the target temperature is set to zero. 
@@ -27,12 +43,27 @@
 // if CooldownNoWait is defined M109 will not wait for the cooldown to finish
 #define CooldownNoWait true
 
+// Heat-up without stopping the queue. M109 and M190 set the target and return (the host gets its ok),
+// then the wait runs from the main loop. Only queued commands that move or wait by themselves
+// (G0-G28, T, M0/M1, M109/M190, M303, M400) are held until the temperature is reached; fan, LCD,
+// other heater and settings commands keep running, and the queue keeps filling from serial or SD.
+#define NONBLOCKING_HEATUP
+
 #ifdef PIDTEMP
   // this adds an experimental additional term to the heatingpower, proportional to the extrusion speed.
   // if Kc is choosen well, the additional required power due to increased melting should be compensated.
+  // Kc used to be stored but never applied, now it is: with DEFAULT_Kc 1 the heater gets one more PWM step
+  // (of 255) per mm/s of filament. Set M301 C0 or DEFAULT_Kc 0 for the old behaviour. The integral of the
+  // PID is limited to the drive that this and the fan term leave over. The EEPROM layout is V08 with Kc
+  // and Kf, an older layout loads the defaults; M502 doesn't reset Kc or Kf, like Kp, Ki and Kd.
   #define PID_ADD_EXTRUSION_RATE  
   #ifdef PID_ADD_EXTRUSION_RATE
-    #define  DEFAULT_Kc (1) //heatingpower=Kc*(e_speed)
+    #define  DEFAULT_Kc (1) //heatingpower=Kc*(e_speed), e_speed in mm/s of filament, highest of the queued moves
+  #endif
+  // the same for the part cooling fan: extra heatingpower for the active hotend while the fan runs.
+  #define PID_ADD_FAN_LOAD
+  #ifdef PID_ADD_FAN_LOAD
+    #define  DEFAULT_Kf (0) //heatingpower=Kf*(FanSpeed/255), tune with M301 F
   #endif
 #endif
 
@@ -120,6 +151,54 @@
 #define SD_FINISHED_STEPPERRELEASE true  //if sd support and the file is finished: disable steppers?
 #define SD_FINISHED_RELEASECOMMAND "M84 X Y Z E" // no z because of layer shift.
 
+// SD printing reads the file ahead a whole 512 byte block at a time, into two buffers of its own (1kB of RAM).
+// The lines are taken from memory and the next block is loaded while the command queue is full.
+#define SD_READAHEAD
+
+// M28 uploads go to the card as one multiple block write into clusters reserved ahead, SD_UPLOAD_RESERVE
+// bytes at a time, with the FAT written when the file is closed. The lines are collected in the first
+// read-ahead buffer, so this needs SD_READAHEAD. Without contiguous free space the upload carries on
+// through the normal, block by block, write path.
+#define SD_FAST_UPLOAD
+#define SD_UPLOAD_RESERVE 1048576
+
+#define SD_DIR_CACHE 32 // entries of the current directory the SD menu and M20 take from RAM (12 bytes each)
+
+// M560 <file> turns the port it came on into a binary link to that file, for uploads much faster than
+// M28 with an ok for every line. The host sends frames of 0xA5, a sequence number, the data length
+// (16 bit, little endian, up to BINARY_FRAME_SIZE; 0 ends the transfer), the data and a CRC-16/XMODEM
+// of everything behind the 0xA5. Each good frame is answered with "ack:<seq>", a bad or missing one with
+// "resend:<seq>", after which the host goes back to that frame. There is no flow control, so the host
+// only sends as many frames ahead of the acks as fit into the receive ring (RX_BUFFER_SIZE, 128):
+// with 57 byte frames that is 2. M29 closes the file. After an error the file is closed and the frames
+// still coming are dropped, until a frame with the length 0xFFFF (abort, no data) or BINARY_TIMEOUT
+// without data. binarySend.py is the host side, it takes the frame size and the window from the printer.
+// Needs SD_FAST_UPLOAD.
+#define SD_BINARY_TRANSFER
+#define BINARY_FRAME_SIZE 57
+#define BINARY_TIMEOUT 1000 // ms without data before the missing frame is asked for again, the tenth time gives up
+
+// SD files that start with "GCB\1" are pre-parsed G-code, made by gcodeToGcb.py: G0/G1 moves come as
+// an opcode and the change of each axis word in fixed point, so they go into the command queue without
+// any text parsing. Everything else is kept as a G-code line. M26 in such a file has to point at the
+// start of a layer, where the converter puts the absolute values the changes continue from.
+#define SD_GCB
+
+// M561 reads the selected SD file in the background, while nothing is printed, and writes the byte offset
+// of every layer start and of every SD_INDEX_LINES-th line next to it, as <name>.IDX. M562 then moves the
+// print position through that index: L<layer> (the first is 1), Z<height> or P<line>, so a failed print
+// can be picked up again where it stopped. A layer starts where Z changes to a new height and something
+// extrudes before the next change, so Z hops don't count. Only G0/G1 at the start of a line are moves.
+// A G92 Z sets the height without a layer start; when it goes down, the layers after it count again from
+// there, and M562 Z takes the first layer at a height. In a .gcb file only the layer starts are used.
+#define SD_INDEX
+#define SD_INDEX_LINES 1000
+
+// M563 S<kB> reads the selected SD file from the start, up to S kB (default 1024), as fast as the card goes
+// and reports the bytes per second, to measure changes to the SPI and SD code on the printer itself.
+// Turn it on for that, it isn't needed for printing.
+//#define SD_READ_BENCHMARK
+
 // The hardware watchdog should halt the Microcontroller, in case the firmware gets stuck somewhere. However:
 // the Watchdog is not working well, so please only enable this for testing
 // this enables the watchdog interrupt.
@@ -181,6 +260,35 @@ const int dropsegments=5; //everything with less than this number of steps will
 #define MAX_CMD_SIZE 96
 #define BUFSIZE 4
 
+// Real-time commands: single bytes that are picked out of the serial stream by the RX interrupt.
+// They never enter the receive buffer, so they are answered even when the command queue is full of moves.
+// '?', '!' and '~' only count as the first byte after a line end (or after another real-time byte), so
+// inside a line they stay text: M23 FILE~1.GCO, M117 messages and M28 uploads are not touched. Ctrl-x
+// counts anywhere. The RX interrupt only sets flags, the main loop does the rest, also in M109/M190 waits.
+#define REALTIME_COMMANDS
+#ifdef REALTIME_COMMANDS
+  #define RT_CMD_STATUS     '?'   // report temperatures, stepper position and hold state right away
+  #define RT_CMD_FEED_HOLD  '!'   // finish the running move, then don't start the next one
+  #define RT_CMD_RESUME     '~'   // release a feed hold
+  #define RT_CMD_KILL       0x18  // ctrl-x, emergency stop. Same as kill(), needs a reset afterwards.
+#endif
+
+// Second command channel on USART1 (ATmega2560: RX1 = PD2 = pin 19, TX1 = PD3 = pin 18). It has its own
+// line numbering, lines from both ports are queued in turn and every reply goes back to the port that sent
+// the command.
+// On the Elefu RA board pin 18 is E1_STEP and pin 19 E1_DIR, so it can only be used with a single extruder.
+//#define SERIAL_PORT_2
+#ifdef SERIAL_PORT_2
+  #define SERIAL_PORT_2_BAUDRATE 115200
+#endif
+
+// Periodic status line (temperatures, heater power, SD progress, position), written from the main loop
+// without taking a command slot. Set the interval with M155 S<seconds>, S0 turns it off.
+#define AUTO_REPORT
+#ifdef AUTO_REPORT
+  #define AUTO_REPORT_INTERVAL 0  // seconds after power up, 0 = off until the host sends M155
+#endif
+
 
 // Firmware based and LCD controled retract
 // M207 and M208 can be used to define parameters for the retraction. 
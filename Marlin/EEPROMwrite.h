@@ -38,7 +38,7 @@ template <class T> int EEPROM_readAnything(int &ee, T& value)
 // the default values are used whenever there is a change to the data, to prevent
 // wrong data being written to the variables.
 // ALSO:  always make sure the variables in the Store and retrieve sections are in the same order.
-#define EEPROM_VERSION "V05"  
+#define EEPROM_VERSION "V08"  
 
 inline void EEPROM_StoreSettings() 
 {
@@ -66,6 +66,24 @@ inline void EEPROM_StoreSettings()
     EEPROM_writeAnything(i,0);
     EEPROM_writeAnything(i,0);
   #endif
+  #ifndef PID_ADD_EXTRUSION_RATE
+    float Kc=0;
+  #endif
+  #ifndef PID_ADD_FAN_LOAD
+    float Kf=0;
+  #endif
+  EEPROM_writeAnything(i,Kc);
+  EEPROM_writeAnything(i,Kf);
+  #ifdef PIDTEMPBED
+    EEPROM_writeAnything(i,bedKp);
+    EEPROM_writeAnything(i,bedKi);
+    EEPROM_writeAnything(i,bedKd);
+  #else
+    float dummy=0;
+    EEPROM_writeAnything(i,dummy);
+    EEPROM_writeAnything(i,dummy);
+    EEPROM_writeAnything(i,dummy);
+  #endif
   char ver2[4]=EEPROM_VERSION;
   i=EEPROM_OFFSET;
   EEPROM_writeAnything(i,ver2); // validate data
@@ -126,6 +144,21 @@ inline void EEPROM_printSettings()
       SERIAL_ECHOPAIR("   M301 P",Kp); 
       SERIAL_ECHOPAIR(" I" ,Ki/PID_dT); 
       SERIAL_ECHOPAIR(" D" ,Kd*PID_dT);
+      #ifdef PID_ADD_EXTRUSION_RATE
+        SERIAL_ECHOPAIR(" C" ,Kc);
+      #endif
+      #ifdef PID_ADD_FAN_LOAD
+        SERIAL_ECHOPAIR(" F" ,Kf);
+      #endif
+      SERIAL_ECHOLN(""); 
+    #endif
+    #ifdef PIDTEMPBED
+      SERIAL_ECHO_START;
+      SERIAL_ECHOLNPGM("Bed PID settings:");
+      SERIAL_ECHO_START;
+      SERIAL_ECHOPAIR("   M304 P",bedKp); 
+      SERIAL_ECHOPAIR(" I" ,bedKi/PID_dT); 
+      SERIAL_ECHOPAIR(" D" ,bedKd*PID_dT);
       SERIAL_ECHOLN(""); 
     #endif
   #endif
@@ -159,6 +192,20 @@ inline void EEPROM_RetrieveSettings(bool def=false)
       EEPROM_readAnything(i,Kp);
       EEPROM_readAnything(i,Ki);
       EEPROM_readAnything(i,Kd);
+      #ifndef PID_ADD_EXTRUSION_RATE
+        float Kc;
+      #endif
+      #ifndef PID_ADD_FAN_LOAD
+        float Kf;
+      #endif
+      EEPROM_readAnything(i,Kc);
+      EEPROM_readAnything(i,Kf);
+      #ifndef PIDTEMPBED
+        float bedKp,bedKi,bedKd;
+      #endif
+      EEPROM_readAnything(i,bedKp);
+      EEPROM_readAnything(i,bedKi);
+      EEPROM_readAnything(i,bedKd);
 
       SERIAL_ECHO_START;
       SERIAL_ECHOLNPGM("Stored settings retreived:");
@@ -186,6 +233,9 @@ inline void EEPROM_RetrieveSettings(bool def=false)
       SERIAL_ECHO_START;
       SERIAL_ECHOLN("Using Default settings:");
     }
+  #if defined(PIDTEMP) || defined(PIDTEMPBED)
+    updatePID();
+  #endif
   #ifdef EEPROM_CHITCHAT
     EEPROM_printSettings();
   #endif
@@ -45,6 +45,7 @@
 #include "EEPROMwrite.h"
 #include "language.h"
 #include "pins_arduino.h"
+#include "fixedpoint.h"
 
 #define VERSION_STRING  "1.0.0 RC2+ELEFU"
 
@@ -87,7 +88,7 @@
 // M26  - Set SD position in bytes (M26 S12345)
 // M27  - Report SD print status
 // M28  - Start SD write (M28 filename.g)
-// M29  - Stop SD write
+// M29  - Stop SD write, also ends an M560 transfer
 // M30  - Delete file from SD (M30 filename.g)
 // M31  - Output time since last M109 or SD card start to serial
 // M42  - Change pin status via gcode
@@ -104,6 +105,7 @@
 // M117 - display message
 // M119 - Output Endstop status to serial port
 // M140 - Set bed target temp
+// M155 - Auto-report status every S<seconds>, S0 turns it off (AUTO_REPORT)
 // M190 - Wait for bed current temp to reach target temp.
 // M200 - Set filament diameter
 // M201 - Set max acceleration in units/s^2 for print moves (M201 X1000 Y1000)
@@ -118,9 +120,16 @@
 // M220 S<factor in percent>- set speed factor override percentage
 // M221 S<factor in percent>- set extrude factor override percentage
 // M240 - Trigger a camera to take a photograph
-// M301 - Set PID parameters P I and D
+// M301 - Set PID parameters P I and D, C extrusion and F fan feed-forward
 // M302 - Allow cold extrudes
-// M303 - PID relay autotune S<temperature> sets the target temperature. (default target temperature = 150C)
+// M303 - PID relay autotune S<temperature> sets the target temperature. (default target temperature = 150C) E<extruder>, E-1 tunes the bed
+//        C<cycles> (default 5), U1 uses and stores the result. Runs in the background, the command returns at once.
+// M304 - Set bed PID parameters P I and D
+// M305 - Dump the temperature telemetry ring, R empties it (TEMP_TELEMETRY)
+// M560 - Binary upload to SD (M560 filename.g), the port then takes frames until the end frame (SD_BINARY_TRANSFER)
+// M561 - Index the selected SD file in the background, for M562 (SD_INDEX)
+// M562 - Set the SD position through the index: L<layer>, Z<height> or P<line> (SD_INDEX)
+// M563 - SD read benchmark of the selected file, S<kB> to read (default 1024) (SD_READ_BENCHMARK)
 // M400 - Finish all moves
 // M500 - stores paramters in EEPROM
 // M501 - reads parameters from EEPROM (if you need reset them after you changed them temporarily).  
@@ -128,6 +137,12 @@
 // M503 - print the current settings (from memory not from eeprom)
 // M999 - Restart after being stopped by error
 
+//Real-time commands (REALTIME_COMMANDS, single bytes right after a line end, ctrl-x anywhere, see Configuration_adv.h)
+// ?      - Report temperatures, stepper position and feed hold state
+// !      - Feed hold: finish the current move and hold the rest of the queue
+// ~      - Resume after a feed hold
+// ctrl-x - Emergency stop, same as kill()
+
 //ELEFU: We're including our own TLC and animation libraries here, as well as a library file for mp3 commands
 
 	#include "animator.h" //this controls all TLC animations and includes other libraries for controlling the TLC itself
@@ -262,20 +277,64 @@ static float destination[NUM_AXIS] = {  0.0, 0.0, 0.0, 0.0};
 static float offset[3] = {0.0, 0.0, 0.0};
 static bool home_all_axis = true;
 static float feedrate = 1500.0, next_feedrate, saved_feedrate;
-static long gcode_N, gcode_LastN, Stopped_gcode_LastN = 0;
+static long Stopped_gcode_LastN = 0;
 
 static bool relative_mode = false;  //Determines Absolute or Relative Coordinates
 static bool relative_mode_e = false;  //Determines Absolute or Relative E Codes while in Absolute Coordinates mode. E is always relative in Relative Coordinates mode.
 
 static char cmdbuffer[BUFSIZE][MAX_CMD_SIZE];
-static bool fromsd[BUFSIZE];
+static uint8_t fromsd[BUFSIZE]; // true for a line from the SD card
+#ifdef SD_GCB
+  #define FROM_GCB 2            // a gcb_move_t from a .gcb file, not a line
+#endif
 static int bufindr = 0;
 static int bufindw = 0;
 static int buflen = 0;
 //static int i = 0;
-static char serial_char;
-static int serial_count = 0;
-static boolean comment_mode = false;
+#ifndef SD_READAHEAD
+static int sd_count = 0;
+static boolean sd_comment_mode = false;
+#endif
+
+// receive state of one serial channel, built up byte by byte in get_command()
+struct serial_channel_t
+{
+  int count;              // chars of the current line stored so far
+  bool comment_mode;
+  bool has_checksum;      // a '*' was seen, the digits behind it go to line_checksum
+  byte checksum;          // XOR of everything in front of the '*'
+  int line_checksum;
+  bool has_N;             // the line started with a line number, it is in N
+  bool in_N;              // still reading the digits of that line number
+  bool N_negative;        // Pronterface resets with N-1 M110
+  long N, LastN;
+};
+
+#ifdef SERIAL_PORT_2
+  #define SERIAL_CHANNELS 2
+  // with two sources the lines are assembled per channel and copied into cmdbuffer when complete
+  static char serial_line[SERIAL_CHANNELS][MAX_CMD_SIZE];
+  static uint8_t cmdport[BUFSIZE]; // the port each queued command came from, its replies go there
+  #define SERIAL_LINE(ch) serial_line[ch]
+  #define CURRENT_CHANNEL serial_reply_port
+  #define CHANNEL_AVAILABLE(ch) ((ch) ? MSerial1.available() : MYSERIAL.available())
+  #define CHANNEL_READ(ch) ((ch) ? MSerial1.read() : MYSERIAL.read())
+  #define CHANNEL_FLUSH(ch) {if(ch) MSerial1.flush(); else MYSERIAL.flush();}
+  // Stop() can come from the heater control while any channel is current, the line number it keeps
+  // for M999 is that of the channel the last numbered line came from
+  static uint8_t numbered_channel = 0;
+  static uint8_t Stopped_gcode_channel = 0;
+  #define NUMBERED_CHANNEL numbered_channel
+#else
+  #define SERIAL_CHANNELS 1
+  #define SERIAL_LINE(ch) cmdbuffer[bufindw] // assembled in place
+  #define CURRENT_CHANNEL 0
+  #define CHANNEL_AVAILABLE(ch) MYSERIAL.available()
+  #define CHANNEL_READ(ch) MYSERIAL.read()
+  #define CHANNEL_FLUSH(ch) MYSERIAL.flush()
+  #define NUMBERED_CHANNEL 0
+#endif
+static serial_channel_t serial_channel[SERIAL_CHANNELS];
 static char *strchr_pointer; // just a pointer to find chars in the cmd string like X, Y, Z, E, etc
 
 const int sensitive_pins[] = SENSITIVE_PINS; // Sensitive pin list for M42
@@ -291,8 +350,29 @@ static unsigned long stepper_inactive_time = DEFAULT_STEPPER_DEACTIVE_TIME*1000l
 static unsigned long starttime=0;
 static unsigned long stoptime=0;
 
+#ifdef AUTO_REPORT
+  static unsigned long autoreport_interval = AUTO_REPORT_INTERVAL*1000l;
+  static unsigned long previous_millis_autoreport = 0;
+  #ifdef SERIAL_PORT_2
+    static uint8_t autoreport_port = 0; // the port that sent the M155
+  #endif
+#endif
+
 static uint8_t tmp_extruder;
 
+// State of the running M109/M190 wait. heat_wait_check() is polled until it returns false.
+static struct {
+  bool active;
+  bool bed;
+  bool target_direction;      // true if heating, false if cooling
+  uint8_t extruder;
+  long residencyStart;
+  unsigned long report_millis;
+  #ifdef SERIAL_PORT_2
+    uint8_t port;             // the port that sent the M109/M190 gets the progress lines
+  #endif
+} heat_wait;
+
 
 bool Stopped=false;
 
@@ -301,6 +381,9 @@ bool Stopped=false;
 //===========================================================================
 
 void get_arc_coordinates();
+#ifdef SD_GCB
+void get_coordinates_gcb(const gcb_move_t *move);
+#endif
 
 extern "C"{
   extern unsigned int __bss_end;
@@ -328,6 +411,9 @@ void enquecommand(const char *cmd)
   {
     //this is dangerous if a mixing of serial and this happsens
     strcpy(&(cmdbuffer[bufindw][0]),cmd);
+    #ifdef SERIAL_PORT_2
+      cmdport[bufindw] = 0;
+    #endif
     SERIAL_ECHO_START;
     SERIAL_ECHOPGM("enqueing \"");
     SERIAL_ECHO(cmdbuffer[bufindw]);
@@ -376,6 +462,9 @@ void setup()
 { 
   setup_powerhold();
   MYSERIAL.begin(BAUDRATE);
+  #ifdef SERIAL_PORT_2
+    MSerial1.begin(SERIAL_PORT_2_BAUDRATE);
+  #endif
   SERIAL_PROTOCOLLNPGM("start");
   SERIAL_ECHO_START;
 
@@ -435,6 +524,153 @@ void setup()
   //ELEFU: This is the end of our meddling with the setup code
 }
 
+// Prints the progress of the M109/M190 wait once a second and finishes it once the
+// temperature is reached. Returns true while still waiting.
+static bool heat_wait_check()
+{
+  if(heat_wait.active == false)
+    return false;
+
+  #ifdef SERIAL_PORT_2
+    uint8_t saved_port = serial_reply_port;
+    serial_reply_port = heat_wait.port;
+  #endif
+  bool waiting;
+  if(heat_wait.bed) {
+    #if TEMP_BED_PIN > -1
+      if(( millis() - heat_wait.report_millis) > 1000 ) //Print Temp Reading every 1 second while heating up.
+      {
+        float tt=degHotend(active_extruder);
+        SERIAL_PROTOCOLPGM("T:");
+        SERIAL_PROTOCOL(tt);
+        SERIAL_PROTOCOLPGM(" E:");
+        SERIAL_PROTOCOL((int)active_extruder); 
+        SERIAL_PROTOCOLPGM(" B:");
+        SERIAL_PROTOCOL_F(degBed(),1); 
+        SERIAL_PROTOCOLLN(""); 
+        heat_wait.report_millis = millis(); 
+      }
+      waiting = isHeatingBed();
+      if(!waiting)
+        LCD_MESSAGEPGM(MSG_BED_DONE);
+    #else
+      waiting = false;
+    #endif
+  }
+  else {
+    uint8_t e = heat_wait.extruder;
+    if( (millis() - heat_wait.report_millis) > 1000UL )
+    { //Print Temp Reading and remaining time every 1 second while heating up/cooling down
+      SERIAL_PROTOCOLPGM("T:");
+      SERIAL_PROTOCOL_F(degHotend(e),1); 
+      SERIAL_PROTOCOLPGM(" E:");
+      SERIAL_PROTOCOL((int)e); 
+      #ifdef TEMP_RESIDENCY_TIME
+        SERIAL_PROTOCOLPGM(" W:");
+        if(heat_wait.residencyStart > -1)
+        {
+           SERIAL_PROTOCOLLN( ((TEMP_RESIDENCY_TIME * 1000UL) - (millis() - heat_wait.residencyStart)) / 1000UL );
+        }
+        else 
+        {
+           SERIAL_PROTOCOLLN( "?" );
+        }
+      #else
+        SERIAL_PROTOCOLLN("");
+      #endif
+      heat_wait.report_millis = millis();
+    }
+    #ifdef TEMP_RESIDENCY_TIME
+      /* start/restart the TEMP_RESIDENCY_TIME timer whenever we reach target temp for the first time
+        or when current temp falls outside the hysteresis after target temp was reached */
+      if ((heat_wait.residencyStart == -1 &&  heat_wait.target_direction && (degHotend(e) >= (degTargetHotend(e)-TEMP_WINDOW))) ||
+          (heat_wait.residencyStart == -1 && !heat_wait.target_direction && (degHotend(e) <= (degTargetHotend(e)+TEMP_WINDOW))) ||
+          (heat_wait.residencyStart > -1 && labs(degHotend(e) - degTargetHotend(e)) > TEMP_HYSTERESIS) ) 
+      {
+        heat_wait.residencyStart = millis();
+      }
+      /* continue to wait until we have reached the target temp   
+        _and_ until TEMP_RESIDENCY_TIME hasn't passed since we reached it */
+      waiting = (heat_wait.residencyStart == -1) ||
+                (((unsigned int) (millis() - heat_wait.residencyStart)) < (TEMP_RESIDENCY_TIME * 1000UL));
+    #else
+      waiting = heat_wait.target_direction ? (isHeatingHotend(e)) : (isCoolingHotend(e)&&(CooldownNoWait==false));
+    #endif //TEMP_RESIDENCY_TIME
+    if(!waiting) {
+      LCD_MESSAGEPGM(MSG_HEATING_COMPLETE);
+      starttime=millis();
+    }
+  }
+  #ifdef SERIAL_PORT_2
+    serial_reply_port = saved_port;
+  #endif
+
+  if(!waiting) {
+    heat_wait.active = false;
+    previous_millis_cmd = millis();
+  }
+  return waiting;
+}
+
+// Called by M109 (bed false) and M190 (bed true) after the new target is set.
+static void heat_wait_start(bool bed, uint8_t extruder)
+{
+  heat_wait.active = true;
+  heat_wait.bed = bed;
+  heat_wait.extruder = extruder;
+  heat_wait.target_direction = bed ? isHeatingBed() : isHeatingHotend(extruder);
+  heat_wait.residencyStart = -1;
+  heat_wait.report_millis = millis();
+  #ifdef SERIAL_PORT_2
+    heat_wait.port = serial_reply_port;
+  #endif
+  #ifndef NONBLOCKING_HEATUP
+    while(heat_wait_check()) {
+      manage_heater();
+      manage_inactivity(1);
+      LCD_STATUS;
+    }
+  #endif
+}
+
+#ifdef NONBLOCKING_HEATUP
+// True for queued commands that have to wait until a running M109/M190 is done:
+// everything that moves, dwells or waits by itself. Settings, fan, LCD and other
+// heater commands run during the heat-up, in queue order.
+static bool needs_heated(const char *cmd)
+{
+  if(cmd[0] != 'M') {
+    if(cmd[0] == 'G') {
+      long code = fixp_parse_long(cmd + 1);
+      if(code == 90 || code == 91 || code == 92)
+        return false;
+    }
+    return true;  // moves, T<n> and anything without an M or G in front
+  }
+  switch(fixp_parse_long(cmd + 1)) {
+    case 0:   // stop, wait for the LCD
+    case 1:
+    case 109: // another heat-up
+    case 190:
+    case 303: // autotune
+    case 400: // finish moves
+      return true;
+  }
+  return false;
+}
+
+// Polls the M109/M190 wait. True while the command at the head of the queue has to wait for it.
+static bool command_held()
+{
+  if(heat_wait_check() == false || buflen == 0)
+    return false;
+  #ifdef SDSUPPORT
+    if(card.saving) // M28 only writes the lines to the file
+      return false;
+  #endif
+  return needs_heated(cmdbuffer[bufindr]);
+}
+#endif
 
 void loop()
 {
@@ -443,8 +679,19 @@ void loop()
   #ifdef SDSUPPORT
   card.checkautostart(false);
   #endif
-  if(buflen)//if there are commands in the buffer
+  #ifdef SD_INDEX
+  card.indexIdle();
+  #endif
+  #ifdef NONBLOCKING_HEATUP
+    bool held = command_held();
+  #else
+    bool held = false;
+  #endif
+  if(buflen && !held)//if there are commands in the buffer
   {
+    #ifdef SERIAL_PORT_2
+      serial_reply_port = cmdport[bufindr]; // answer on the port the command came from
+    #endif
     #ifdef SDSUPPORT
       if(card.saving)
       {
@@ -466,6 +713,9 @@ void loop()
     #else
       process_commands();
     #endif //SDSUPPORT
+    #ifdef SERIAL_PORT_2
+      serial_reply_port = 0;
+    #endif
     buflen = (buflen-1);
     bufindr = (bufindr + 1)%BUFSIZE;
   }
@@ -605,161 +855,294 @@ void toggle_slp_wk(){//this will turn the PSU off if it is currently on, or it w
 
 
 
-void get_command() 
-{ 
-  while( MYSERIAL.available() > 0  && buflen < BUFSIZE) {
-    serial_char = MYSERIAL.read();
+// Reads one serial channel until a line is complete and queued, returns true if one was.
+// Line number, checksum and comments are handled byte by byte as the line comes in.
+static bool get_serial_line(uint8_t ch)
+{
+  serial_channel_t &in = serial_channel[ch];
+  while( CHANNEL_AVAILABLE(ch) > 0  && buflen < BUFSIZE) {
+    char serial_char = CHANNEL_READ(ch);
+    char *line = SERIAL_LINE(ch);
     if(serial_char == '\n' || 
        serial_char == '\r' || 
-       (serial_char == ':' && comment_mode == false) || 
-       serial_count >= (MAX_CMD_SIZE - 1) ) 
+       (serial_char == ':' && in.comment_mode == false) || 
+       in.count >= (MAX_CMD_SIZE - 1) ) 
     {
-      if(!serial_count) { //if empty line
-        comment_mode = false; //for new command
-        return;
+      // everything was checked while the line came in, take over the results and reset for the next line
+      bool has_checksum = in.has_checksum;
+      bool has_N = in.has_N;
+      in.comment_mode = false; //for new command
+      in.has_checksum = false;
+      byte checksum = in.checksum;
+      in.checksum = 0;
+      in.has_N = false;
+      in.in_N = false;
+      if(in.N_negative) {
+        in.N = -in.N;
+        in.N_negative = false;
       }
-      cmdbuffer[bufindw][serial_count] = 0; //terminate string
-      if(!comment_mode){
-        comment_mode = false; //for new command
-        fromsd[bufindw] = false;
-        if(strstr(cmdbuffer[bufindw], "N") != NULL)
-        {
-          strchr_pointer = strchr(cmdbuffer[bufindw], 'N');
-          gcode_N = (strtol(&cmdbuffer[bufindw][strchr_pointer - cmdbuffer[bufindw] + 1], NULL, 10));
-          if(gcode_N != gcode_LastN+1 && (strstr(cmdbuffer[bufindw], "M110") == NULL) ) {
-            SERIAL_ERROR_START;
-            SERIAL_ERRORPGM(MSG_ERR_LINE_NO);
-            SERIAL_ERRORLN(gcode_LastN);
-            //Serial.println(gcode_N);
-            FlushSerialRequestResend();
-            serial_count = 0;
-            return;
-          }
-
-          if(strstr(cmdbuffer[bufindw], "*") != NULL)
-          {
-            byte checksum = 0;
-            byte count = 0;
-            while(cmdbuffer[bufindw][count] != '*') checksum = checksum^cmdbuffer[bufindw][count++];
-            strchr_pointer = strchr(cmdbuffer[bufindw], '*');
-
-            if( (int)(strtod(&cmdbuffer[bufindw][strchr_pointer - cmdbuffer[bufindw] + 1], NULL)) != checksum) {
-              SERIAL_ERROR_START;
-              SERIAL_ERRORPGM(MSG_ERR_CHECKSUM_MISMATCH);
-              SERIAL_ERRORLN(gcode_LastN);
-              FlushSerialRequestResend();
-              serial_count = 0;
-              return;
-            }
-            //if no errors, continue parsing
-          }
-          else 
-          {
-            SERIAL_ERROR_START;
-            SERIAL_ERRORPGM(MSG_ERR_NO_CHECKSUM);
-            SERIAL_ERRORLN(gcode_LastN);
-            FlushSerialRequestResend();
-            serial_count = 0;
-            return;
-          }
-
-          gcode_LastN = gcode_N;
-          //if no errors, continue parsing
+      // blanks in front of a comment or the '*'
+      while(in.count > 0 && line[in.count - 1] == ' ')
+        in.count--;
+      if(!in.count && !has_N && !has_checksum) { //if empty line
+        continue;
+      }
+      line[in.count] = 0; //terminate string
+      in.count = 0; //clear buffer
+      if(has_N)
+      {
+        if(in.N != in.LastN+1 && strstr(line, "M110") == NULL) {
+          SERIAL_ERROR_START;
+          SERIAL_ERRORPGM(MSG_ERR_LINE_NO);
+          SERIAL_ERRORLN(in.LastN);
+          //Serial.println(in.N);
+          FlushSerialRequestResend();
+          return false;
         }
-        else  // if we don't receive 'N' but still see '*'
+        if(!has_checksum)
         {
-          if((strstr(cmdbuffer[bufindw], "*") != NULL))
-          {
-            SERIAL_ERROR_START;
-            SERIAL_ERRORPGM(MSG_ERR_NO_LINENUMBER_WITH_CHECKSUM);
-            SERIAL_ERRORLN(gcode_LastN);
-            serial_count = 0;
-            return;
-          }
+          SERIAL_ERROR_START;
+          SERIAL_ERRORPGM(MSG_ERR_NO_CHECKSUM);
+          SERIAL_ERRORLN(in.LastN);
+          FlushSerialRequestResend();
+          return false;
         }
-        if((strstr(cmdbuffer[bufindw], "G") != NULL)){
-          strchr_pointer = strchr(cmdbuffer[bufindw], 'G');
-          switch((int)((strtod(&cmdbuffer[bufindw][strchr_pointer - cmdbuffer[bufindw] + 1], NULL)))){
-          case 0:
-          case 1:
-          case 2:
-          case 3:
-            if(Stopped == false) { // If printer is stopped by an error the G[0-3] codes are ignored.
-	      #ifdef SDSUPPORT
-              if(card.saving)
-                break;
-	      #endif //SDSUPPORT
-              SERIAL_PROTOCOLLNPGM(MSG_OK); 
-            }
-            else {
-              SERIAL_ERRORLNPGM(MSG_ERR_STOPPED);
-              LCD_MESSAGEPGM(MSG_STOPPED);
-            }
-            break;
-          default:
-            break;
+        if(in.line_checksum != checksum) {
+          SERIAL_ERROR_START;
+          SERIAL_ERRORPGM(MSG_ERR_CHECKSUM_MISMATCH);
+          SERIAL_ERRORLN(in.LastN);
+          FlushSerialRequestResend();
+          return false;
+        }
+        in.LastN = in.N;
+        #ifdef SERIAL_PORT_2
+          numbered_channel = ch;
+        #endif
+        //if no errors, continue parsing
+      }
+      else if(has_checksum) // if we don't receive 'N' but still see '*'
+      {
+        SERIAL_ERROR_START;
+        SERIAL_ERRORPGM(MSG_ERR_NO_LINENUMBER_WITH_CHECKSUM);
+        SERIAL_ERRORLN(in.LastN);
+        return false;
+      }
+      if(!line[0]) { // a valid line number with nothing behind it, the host still waits for its ok
+        SERIAL_PROTOCOLLNPGM(MSG_OK);
+        continue;
+      }
+      #ifdef SERIAL_PORT_2
+        strcpy(cmdbuffer[bufindw], line);
+        cmdport[bufindw] = ch;
+      #endif
+      fromsd[bufindw] = false;
+      if(line[0] == 'G'){
+        switch((int)(fixp_parse_long(&line[1]))){
+        case 0:
+        case 1:
+        case 2:
+        case 3:
+          if(Stopped == false) { // If printer is stopped by an error the G[0-3] codes are ignored.
+	    #ifdef SDSUPPORT
+            if(card.saving)
+              break;
+	    #endif //SDSUPPORT
+            SERIAL_PROTOCOLLNPGM(MSG_OK); 
           }
-
+          else {
+            SERIAL_ERRORLNPGM(MSG_ERR_STOPPED);
+            LCD_MESSAGEPGM(MSG_STOPPED);
+          }
+          break;
+        default:
+          break;
         }
-        bufindw = (bufindw + 1)%BUFSIZE;
-        buflen += 1;
+
       }
-      serial_count = 0; //clear buffer
+      bufindw = (bufindw + 1)%BUFSIZE;
+      buflen += 1;
+      return true;
     }
     else
     {
-      if(serial_char == ';') comment_mode = true;
-      if(!comment_mode) cmdbuffer[bufindw][serial_count++] = serial_char;
+      if(serial_char == ';') in.comment_mode = true;
+      if(in.comment_mode) continue;
+      if(in.has_checksum) { // the digits behind the '*'
+        if(serial_char >= '0' && serial_char <= '9')
+          in.line_checksum = in.line_checksum*10 + (serial_char - '0');
+        continue;
+      }
+      if(serial_char == '*') {
+        in.has_checksum = true;
+        in.line_checksum = 0;
+        continue;
+      }
+      in.checksum ^= serial_char;
+      if(in.count == 0) {
+        // the line number and the blanks around it are not stored, only the command
+        if(serial_char == 'N' && !in.has_N) {
+          in.has_N = true;
+          in.in_N = true;
+          in.N = 0;
+          continue;
+        }
+        if(in.in_N && serial_char == '-' && in.N == 0 && !in.N_negative) {
+          in.N_negative = true;
+          continue;
+        }
+        if(in.in_N && serial_char >= '0' && serial_char <= '9') {
+          in.N = in.N*10 + (serial_char - '0');
+          continue;
+        }
+        in.in_N = false;
+        if(serial_char == ' ') continue;
+      }
+      line[in.count++] = serial_char;
     }
   }
+  return false;
+}
+
+#ifdef SDSUPPORT
+// The last command of the SD file is in the queue
+static void sd_file_printed()
+{
+  SERIAL_PROTOCOLLNPGM(MSG_FILE_PRINTED);
+  stoptime=millis();
+  char time[30];
+  unsigned long t=(stoptime-starttime)/1000;
+  int sec,min;
+  min=t/60;
+  sec=t%60;
+  sprintf(time,"%i min, %i sec",min,sec);
+  SERIAL_ECHO_START;
+  SERIAL_ECHOLN(time);
+  LCD_MESSAGE(time);
+  card.printingHasFinished();
+  card.checkautostart(true);
+}
+#endif
+
+#ifdef SD_BINARY_TRANSFER
+// During an M560 upload the bytes of its port are frames for the card, not lines, and after a failed
+// one the frames still coming are dropped there as well
+static void get_binary_frames()
+{
+  if(!card.binaryActive())
+    return;
+  uint8_t ch = card.binaryPort();
+  #ifdef SERIAL_PORT_2
+    serial_reply_port = ch; // the acks go back the same way
+  #endif
+  while(CHANNEL_AVAILABLE(ch) > 0 && card.binaryActive())
+    card.binaryByte(CHANNEL_READ(ch));
+  card.binaryIdle();
+  #ifdef SERIAL_PORT_2
+    serial_reply_port = 0;
+  #endif
+}
+  #define CHANNEL_LINES(ch) !(card.binaryActive() && card.binaryPort() == (ch))
+#else
+  #define CHANNEL_LINES(ch) true
+#endif
+
+void get_command() 
+{ 
+  #ifdef SD_BINARY_TRANSFER
+    get_binary_frames();
+  #endif
+  #ifdef SERIAL_PORT_2
+    // one line from each port in turn, so the streaming host can't crowd out the other port.
+    // Errors and the early ok of a line go back to the port it came from.
+    bool queued;
+    do {
+      serial_reply_port = 0;
+      queued = CHANNEL_LINES(0) && get_serial_line(0);
+      serial_reply_port = 1;
+      if(CHANNEL_LINES(1) && get_serial_line(1))
+        queued = true;
+    } while(queued && buflen < BUFSIZE);
+    serial_reply_port = 0;
+  #else
+    while(CHANNEL_LINES(0) && get_serial_line(0))
+      ;
+  #endif
   #ifdef SDSUPPORT
-  if(!card.sdprinting || serial_count!=0){
+  if(!card.sdprinting || serial_channel[0].count!=0){
     return;
   }
+  #ifdef SD_GCB
+  if(card.isGcb())
+  {
+    // every record is a command of its own, decoded straight into the queue
+    while(!card.eof() && buflen < BUFSIZE && card.gcbNext(cmdbuffer[bufindw]))
+    {
+      fromsd[bufindw] = cmdbuffer[bufindw][0] == GCB_MOVE ? FROM_GCB : true;
+      #ifdef SERIAL_PORT_2
+        cmdport[bufindw] = 0;
+      #endif
+      buflen += 1;
+      bufindw = (bufindw + 1)%BUFSIZE;
+    }
+    if(card.eof())
+      sd_file_printed();
+  }
+  else
+  #endif
+  #ifdef SD_READAHEAD
+  {
+    // whole commands out of the read-ahead buffer, the comments and blank lines between them skipped at once
+    while(!card.eof() && buflen < BUFSIZE && card.getCommand(cmdbuffer[bufindw]))
+    {
+      fromsd[bufindw] = true;
+      #ifdef SERIAL_PORT_2
+        cmdport[bufindw] = 0;
+      #endif
+      buflen += 1;
+      bufindw = (bufindw + 1)%BUFSIZE;
+    }
+    if(card.eof())
+      sd_file_printed();
+  }
+  #else
   while( !card.eof()  && buflen < BUFSIZE) {
     int16_t n=card.get();
-    serial_char = (char)n;
+    char serial_char = (char)n;
     if(serial_char == '\n' || 
        serial_char == '\r' || 
-       (serial_char == ':' && comment_mode == false) || 
-       serial_count >= (MAX_CMD_SIZE - 1)||n==-1) 
+       (serial_char == ':' && sd_comment_mode == false) || 
+       sd_count >= (MAX_CMD_SIZE - 1)||n==-1) 
     {
       if(card.eof()){
-        SERIAL_PROTOCOLLNPGM(MSG_FILE_PRINTED);
-        stoptime=millis();
-        char time[30];
-        unsigned long t=(stoptime-starttime)/1000;
-        int sec,min;
-        min=t/60;
-        sec=t%60;
-        sprintf(time,"%i min, %i sec",min,sec);
-        SERIAL_ECHO_START;
-        SERIAL_ECHOLN(time);
-        LCD_MESSAGE(time);
-        card.printingHasFinished();
-        card.checkautostart(true);
-        
+        sd_file_printed();
       }
-      if(!serial_count)
+      if(!sd_count)
       {
-        comment_mode = false; //for new command
+        sd_comment_mode = false; //for new command
         return; //if empty line
       }
-      cmdbuffer[bufindw][serial_count] = 0; //terminate string
-//      if(!comment_mode){
+      cmdbuffer[bufindw][sd_count] = 0; //terminate string
+//      if(!sd_comment_mode){
         fromsd[bufindw] = true;
+        #ifdef SERIAL_PORT_2
+          cmdport[bufindw] = 0;
+        #endif
         buflen += 1;
         bufindw = (bufindw + 1)%BUFSIZE;
 //      }     
-      comment_mode = false; //for new command
-      serial_count = 0; //clear buffer
+      sd_comment_mode = false; //for new command
+      sd_count = 0; //clear buffer
     }
     else
     {
-      if(serial_char == ';') comment_mode = true;
-      if(!comment_mode) cmdbuffer[bufindw][serial_count++] = serial_char;
+      if(serial_char == ';') sd_comment_mode = true;
+      if(!sd_comment_mode) cmdbuffer[bufindw][sd_count++] = serial_char;
     }
   }
+  #endif //SD_READAHEAD
+  #ifdef SD_READAHEAD
+    card.readahead(); // the queue is full, load the next block now instead of when the parser gets to it
+  #endif
   
   #endif //SDSUPPORT
 
@@ -768,12 +1151,12 @@ void get_command()
 
 float code_value() 
 { 
-  return (strtod(&cmdbuffer[bufindr][strchr_pointer - cmdbuffer[bufindr] + 1], NULL)); 
+  return fixp_parse_float(&cmdbuffer[bufindr][strchr_pointer - cmdbuffer[bufindr] + 1]); 
 }
 
 long code_value_long() 
 { 
-  return (strtol(&cmdbuffer[bufindr][strchr_pointer - cmdbuffer[bufindr] + 1], NULL, 10)); 
+  return fixp_parse_long(&cmdbuffer[bufindr][strchr_pointer - cmdbuffer[bufindr] + 1]); 
 }
 
 bool code_seen(char code_string[]) //Return True if the string was found
@@ -819,6 +1202,18 @@ void process_commands()
   unsigned long codenum; //throw away variable
   char *starpos = NULL;
 
+  #ifdef SD_GCB
+  if(fromsd[bufindr] == FROM_GCB) // G0/G1 from a .gcb file, the values are decoded already
+  {
+    if(Stopped == false) {
+      get_coordinates_gcb((gcb_move_t*)cmdbuffer[bufindr]);
+      prepare_move();
+    }
+    ClearToSend();
+    return;
+  }
+  #endif
+
   if(code_seen('G'))
   {
     switch((int)code_value())
@@ -1085,6 +1480,13 @@ void process_commands()
     case 29: //M29 - Stop SD write
       //processed in write to file routine above
       //card,saving = false;
+      #ifdef SD_BINARY_TRANSFER
+        if(card.binaryDone()) // the end frame of an M560 upload has come
+        {
+          card.closefile();
+          SERIAL_PROTOCOLLNPGM(MSG_FILE_SAVED);
+        }
+      #endif
       break;
     case 30: //M30 <filename> Delete File 
 	if (card.cardOK){
@@ -1098,6 +1500,29 @@ void process_commands()
 	 card.removeFile(strchr_pointer + 4);
 	}
 	break;
+    #ifdef SD_BINARY_TRANSFER
+    case 560: //M560 <filename> - Binary upload to SD, ends with the end frame and M29
+      card.binaryStart(strchr_pointer + 5, CURRENT_CHANNEL);
+      break;
+    #endif
+    #ifdef SD_INDEX
+    case 561: //M561 - Index the selected file
+      card.indexStart();
+      break;
+    case 562: //M562 - Set SD position by layer, height or line
+      if(code_seen('L'))
+        card.indexSeek(CardReader::IX_LAYER, code_value_long());
+      else if(code_seen('Z'))
+        card.indexSeek(CardReader::IX_Z, fixp_parse(strchr_pointer + 1, 3)); // cut like the heights in the index
+      else if(code_seen('P'))
+        card.indexSeek(CardReader::IX_LINE, code_value_long());
+      break;
+    #endif
+    #ifdef SD_READ_BENCHMARK
+    case 563: //M563 - SD read benchmark
+      card.readBenchmark((code_seen('S') ? code_value_long() : 1024) * 1024);
+      break;
+    #endif
 	
 #endif //SDSUPPORT
 
@@ -1187,6 +1612,10 @@ void process_commands()
       #ifdef PIDTEMP
         SERIAL_PROTOCOLPGM(" @:");
         SERIAL_PROTOCOL(getHeaterPower(tmp_extruder));  
+      #endif
+      #ifdef PIDTEMPBED
+        SERIAL_PROTOCOLPGM(" B@:");
+        SERIAL_PROTOCOL(getHeaterPower(-1));  
       #endif
         SERIAL_PROTOCOLLN("");
       return;
@@ -1219,87 +1648,14 @@ void process_commands()
       #endif
       
       setWatch();
-      codenum = millis(); 
-
-      /* See if we are heating up or cooling down */
-      bool target_direction = isHeatingHotend(tmp_extruder); // true if heating, false if cooling
-
-      #ifdef TEMP_RESIDENCY_TIME
-        long residencyStart;
-        residencyStart = -1;
-        /* continue to loop until we have reached the target temp   
-          _and_ until TEMP_RESIDENCY_TIME hasn't passed since we reached it */
-        while((residencyStart == -1) ||
-              (residencyStart >= 0 && (((unsigned int) (millis() - residencyStart)) < (TEMP_RESIDENCY_TIME * 1000UL))) ) {
-      #else
-        while ( target_direction ? (isHeatingHotend(tmp_extruder)) : (isCoolingHotend(tmp_extruder)&&(CooldownNoWait==false)) ) {
-      #endif //TEMP_RESIDENCY_TIME
-          if( (millis() - codenum) > 1000UL )
-          { //Print Temp Reading and remaining time every 1 second while heating up/cooling down
-            SERIAL_PROTOCOLPGM("T:");
-            SERIAL_PROTOCOL_F(degHotend(tmp_extruder),1); 
-            SERIAL_PROTOCOLPGM(" E:");
-            SERIAL_PROTOCOL((int)tmp_extruder); 
-            #ifdef TEMP_RESIDENCY_TIME
-              SERIAL_PROTOCOLPGM(" W:");
-              if(residencyStart > -1)
-              {
-                 codenum = ((TEMP_RESIDENCY_TIME * 1000UL) - (millis() - residencyStart)) / 1000UL;
-                 SERIAL_PROTOCOLLN( codenum );
-              }
-              else 
-              {
-                 SERIAL_PROTOCOLLN( "?" );
-              }
-            #else
-              SERIAL_PROTOCOLLN("");
-            #endif
-            codenum = millis();
-          }
-          manage_heater();
-          manage_inactivity(1);
-          LCD_STATUS;
-        #ifdef TEMP_RESIDENCY_TIME
-            /* start/restart the TEMP_RESIDENCY_TIME timer whenever we reach target temp for the first time
-              or when current temp falls outside the hysteresis after target temp was reached */
-          if ((residencyStart == -1 &&  target_direction && (degHotend(tmp_extruder) >= (degTargetHotend(tmp_extruder)-TEMP_WINDOW))) ||
-              (residencyStart == -1 && !target_direction && (degHotend(tmp_extruder) <= (degTargetHotend(tmp_extruder)+TEMP_WINDOW))) ||
-              (residencyStart > -1 && labs(degHotend(tmp_extruder) - degTargetHotend(tmp_extruder)) > TEMP_HYSTERESIS) ) 
-          {
-            residencyStart = millis();
-          }
-        #endif //TEMP_RESIDENCY_TIME
-        }
-        LCD_MESSAGEPGM(MSG_HEATING_COMPLETE);
-        starttime=millis();
-        previous_millis_cmd = millis();
+      heat_wait_start(false, tmp_extruder);
       }
       break;
     case 190: // M190 - Wait for bed heater to reach target.
     #if TEMP_BED_PIN > -1
         LCD_MESSAGEPGM(MSG_BED_HEATING);
         if (code_seen('S')) setTargetBed(code_value());
-        codenum = millis(); 
-        while(isHeatingBed()) 
-        {
-          if(( millis() - codenum) > 1000 ) //Print Temp Reading every 1 second while heating up.
-          {
-            float tt=degHotend(active_extruder);
-            SERIAL_PROTOCOLPGM("T:");
-            SERIAL_PROTOCOL(tt);
-            SERIAL_PROTOCOLPGM(" E:");
-            SERIAL_PROTOCOL((int)active_extruder); 
-            SERIAL_PROTOCOLPGM(" B:");
-            SERIAL_PROTOCOL_F(degBed(),1); 
-            SERIAL_PROTOCOLLN(""); 
-            codenum = millis(); 
-          }
-          manage_heater();
-          manage_inactivity(1);
-          LCD_STATUS;
-        }
-        LCD_MESSAGEPGM(MSG_BED_DONE);
-        previous_millis_cmd = millis();
+        heat_wait_start(true, active_extruder);
     #endif
         break;
 
@@ -1425,6 +1781,17 @@ void process_commands()
       
       SERIAL_PROTOCOLLN("");
       break;
+#ifdef AUTO_REPORT
+    case 155: // M155 - auto-report interval in seconds
+      if(code_seen('S')) {
+        autoreport_interval = (unsigned long)(code_value()*1000.0);
+        previous_millis_autoreport = millis();
+        #ifdef SERIAL_PORT_2
+          autoreport_port = serial_reply_port;
+        #endif
+      }
+      break;
+#endif
     case 120: // M120
       enable_endstops(false) ;
       break;
@@ -1577,6 +1944,9 @@ void process_commands()
         #ifdef PID_ADD_EXTRUSION_RATE
         if(code_seen('C')) Kc = code_value();
         #endif
+        #ifdef PID_ADD_FAN_LOAD
+        if(code_seen('F')) Kf = code_value();
+        #endif
         updatePID();
         SERIAL_PROTOCOL(MSG_OK);
 		SERIAL_PROTOCOL(" p:");
@@ -1587,12 +1957,42 @@ void process_commands()
         SERIAL_PROTOCOL(Kd*PID_dT);
         #ifdef PID_ADD_EXTRUSION_RATE
         SERIAL_PROTOCOL(" c:");
-        SERIAL_PROTOCOL(Kc*PID_dT);
+        SERIAL_PROTOCOL(Kc);
+        #endif
+        #ifdef PID_ADD_FAN_LOAD
+        SERIAL_PROTOCOL(" f:");
+        SERIAL_PROTOCOL(Kf);
         #endif
         SERIAL_PROTOCOLLN("");
       }
       break;
     #endif //PIDTEMP
+    #ifdef PIDTEMPBED
+    case 304: // M304
+      {
+        if(code_seen('P')) bedKp = code_value();
+        if(code_seen('I')) bedKi = code_value()*PID_dT;
+        if(code_seen('D')) bedKd = code_value()/PID_dT;
+        updatePID();
+        SERIAL_PROTOCOL(MSG_OK);
+        SERIAL_PROTOCOL(" p:");
+        SERIAL_PROTOCOL(bedKp);
+        SERIAL_PROTOCOL(" i:");
+        SERIAL_PROTOCOL(bedKi/PID_dT);
+        SERIAL_PROTOCOL(" d:");
+        SERIAL_PROTOCOL(bedKd*PID_dT);
+        SERIAL_PROTOCOLLN("");
+      }
+      break;
+    #endif //PIDTEMPBED
+    #ifdef TEMP_TELEMETRY
+    case 305: // M305 - temperature telemetry
+      if(code_seen('R'))
+        temp_telemetry_clear();
+      else
+        temp_telemetry_dump();
+      break;
+    #endif //TEMP_TELEMETRY
     case 240: // M240  Triggers a camera by emulating a Canon RC-1 : http://www.doc-diy.net/photo/rc-1_hacked/
      {
       #ifdef PHOTOGRAPH_PIN
@@ -1625,8 +2025,12 @@ void process_commands()
     case 303: // M303 PID autotune
     {
       float temp = 150.0;
+      int e = 0;
+      if (code_seen('E')) e=code_value_long();
+      int c = 5;
       if (code_seen('S')) temp=code_value();
-      PID_autotune(temp);
+      if (code_seen('C')) c=code_value_long();
+      PID_autotune(temp, e, c, code_seen('U') && code_value_long() == 1);
     }
     break;
     case 400: // M400 finish all moves
@@ -1656,8 +2060,19 @@ void process_commands()
     break;
     case 999: // Restart after being stopped
       Stopped = false;
-      gcode_LastN = Stopped_gcode_LastN;
+    #ifdef SERIAL_PORT_2
+    {
+      // the resend goes to the host whose numbered lines were stopped, the ok of M999 to its sender
+      uint8_t saved_port = serial_reply_port;
+      serial_reply_port = Stopped_gcode_channel;
+      serial_channel[Stopped_gcode_channel].LastN = Stopped_gcode_LastN;
       FlushSerialRequestResend();
+      serial_reply_port = saved_port;
+    }
+    #else
+      serial_channel[0].LastN = Stopped_gcode_LastN;
+      FlushSerialRequestResend();
+    #endif
     break;
     }
   }
@@ -1693,9 +2108,9 @@ void process_commands()
 void FlushSerialRequestResend()
 {
   //char cmdbuffer[bufindr][100]="Resend:";
-  MYSERIAL.flush();
+  CHANNEL_FLUSH(CURRENT_CHANNEL);
   SERIAL_PROTOCOLPGM(MSG_RESEND);
-  SERIAL_PROTOCOLLN(gcode_LastN + 1);
+  SERIAL_PROTOCOLLN(serial_channel[CURRENT_CHANNEL].LastN + 1);
   ClearToSend();
 }
 
@@ -1709,22 +2124,10 @@ void ClearToSend()
   SERIAL_PROTOCOLLNPGM(MSG_OK); 
 }
 
-void get_coordinates()
+#ifdef FWRETRACT
+// Turns an E-only move into a firmware retract or recover when autoretract is on
+static void auto_retract(const bool seen[])
 {
-  bool seen[4]={false,false,false,false};
-  for(int8_t i=0; i < NUM_AXIS; i++) {
-    if(code_seen(axis_codes[i])) 
-    {
-      destination[i] = (float)code_value() + (axis_relative_modes[i] || relative_mode)*current_position[i];
-      seen[i]=true;
-    }
-    else destination[i] = current_position[i]; //Are these else lines really needed?
-  }
-  if(code_seen('F')) {
-    next_feedrate = code_value();
-    if(next_feedrate > 0.0) feedrate = next_feedrate;
-  }
-  #ifdef FWRETRACT
   if(autoretract_enabled)
   if( !(seen[X_AXIS] || seen[Y_AXIS] || seen[Z_AXIS]) && seen[E_AXIS])
   {
@@ -1759,9 +2162,52 @@ void get_coordinates()
     }
     
   }
+}
+#endif //FWRETRACT
+
+void get_coordinates()
+{
+  bool seen[4]={false,false,false,false};
+  for(int8_t i=0; i < NUM_AXIS; i++) {
+    if(code_seen(axis_codes[i])) 
+    {
+      destination[i] = (float)code_value() + (axis_relative_modes[i] || relative_mode)*current_position[i];
+      seen[i]=true;
+    }
+    else destination[i] = current_position[i]; //Are these else lines really needed?
+  }
+  if(code_seen('F')) {
+    next_feedrate = code_value();
+    if(next_feedrate > 0.0) feedrate = next_feedrate;
+  }
+  #ifdef FWRETRACT
+  auto_retract(seen);
   #endif //FWRETRACT
 }
 
+#ifdef SD_GCB
+// get_coordinates() for a move of a .gcb file
+void get_coordinates_gcb(const gcb_move_t *move)
+{
+  bool seen[4]={false,false,false,false};
+  for(int8_t i=0; i < NUM_AXIS; i++) {
+    if(move->seen & (1<<i))
+    {
+      destination[i] = move->value[i] + (axis_relative_modes[i] || relative_mode)*current_position[i];
+      seen[i]=true;
+    }
+    else destination[i] = current_position[i];
+  }
+  if(move->seen & GCB_F) {
+    next_feedrate = move->feedrate;
+    if(next_feedrate > 0.0) feedrate = next_feedrate;
+  }
+  #ifdef FWRETRACT
+  auto_retract(seen);
+  #endif //FWRETRACT
+}
+#endif //SD_GCB
+
 void get_arc_coordinates()
 {
    get_coordinates();
@@ -1848,8 +2294,138 @@ void controllerFan()
 }
 #endif
 
+#if defined(REALTIME_COMMANDS) || defined(AUTO_REPORT)
+// One status line: temperatures and heater power like M105, SD progress, and the position
+// the steppers are at (not the end of the queue like M114).
+void status_report()
+{
+  #if (TEMP_0_PIN > -1)
+    SERIAL_PROTOCOLPGM("T:");
+    SERIAL_PROTOCOL_F(degHotend(active_extruder),1);
+    SERIAL_PROTOCOLPGM(" /");
+    SERIAL_PROTOCOL_F(degTargetHotend(active_extruder),1);
+    #if TEMP_BED_PIN > -1
+      SERIAL_PROTOCOLPGM(" B:");
+      SERIAL_PROTOCOL_F(degBed(),1);
+      SERIAL_PROTOCOLPGM(" /");
+      SERIAL_PROTOCOL_F(degTargetBed(),1);
+    #endif //TEMP_BED_PIN
+    #ifdef PIDTEMP
+      SERIAL_PROTOCOLPGM(" @:");
+      SERIAL_PROTOCOL(getHeaterPower(active_extruder));
+    #endif
+    #ifdef PIDTEMPBED
+      SERIAL_PROTOCOLPGM(" B@:");
+      SERIAL_PROTOCOL(getHeaterPower(-1));
+    #endif
+    SERIAL_PROTOCOLPGM(" ");
+  #endif
+  #ifdef SDSUPPORT
+    if(card.sdprinting) {
+      SERIAL_PROTOCOLPGM("SD:");
+      SERIAL_PROTOCOL(card.getIndex());
+      SERIAL_PROTOCOLPGM("/");
+      SERIAL_PROTOCOL(card.getFileSize());
+      SERIAL_PROTOCOLPGM(" ");
+    }
+  #endif
+  SERIAL_PROTOCOLPGM("X:");
+  SERIAL_PROTOCOL(float(st_get_position(X_AXIS))/axis_steps_per_unit[X_AXIS]);
+  SERIAL_PROTOCOLPGM(" Y:");
+  SERIAL_PROTOCOL(float(st_get_position(Y_AXIS))/axis_steps_per_unit[Y_AXIS]);
+  SERIAL_PROTOCOLPGM(" Z:");
+  SERIAL_PROTOCOL(float(st_get_position(Z_AXIS))/axis_steps_per_unit[Z_AXIS]);
+  SERIAL_PROTOCOLPGM(" E:");
+  SERIAL_PROTOCOL(float(st_get_position(E_AXIS))/axis_steps_per_unit[E_AXIS]);
+  SERIAL_PROTOCOLPGM(" Q:");
+  SERIAL_PROTOCOL((int)movesplanned());
+  #ifdef REALTIME_COMMANDS
+  if(rt_feed_hold) {
+    SERIAL_PROTOCOLLNPGM(" S:Hold");
+  }
+  else
+  #endif
+  if(Stopped) {
+    SERIAL_PROTOCOLLNPGM(" S:Stopped");
+  }
+  else {
+    SERIAL_PROTOCOLLNPGM(" S:Run");
+  }
+}
+#endif
+
+#ifdef REALTIME_COMMANDS
+// Handles what the RX interrupt could not do itself. Called through manage_inactivity(),
+// so it also runs inside the M109/M190 waits, st_synchronize() and a full planner buffer.
+void realtime_commands()
+{
+  static bool was_held = false;
+  if(rt_command_flags & RT_FLAG_KILL)
+    kill();
+  if(rt_feed_hold != was_held) {
+    was_held = rt_feed_hold;
+    if(was_held) {
+      LCD_MESSAGEPGM(MSG_FEED_HOLD);
+    }
+    else {
+      LCD_MESSAGEPGM(MSG_FEED_RESUMED);
+    }
+  }
+  if(rt_command_flags & RT_FLAG_STATUS) {
+    CRITICAL_SECTION_START;
+    rt_command_flags &= ~RT_FLAG_STATUS;
+    CRITICAL_SECTION_END;
+    #ifdef SERIAL_PORT_2
+      uint8_t saved_port = serial_reply_port;
+      serial_reply_port = 0;
+      status_report();
+      serial_reply_port = saved_port;
+    #else
+      status_report();
+    #endif
+  }
+  #ifdef SERIAL_PORT_2
+  if(rt_command_flags & RT_FLAG_STATUS1) {
+    CRITICAL_SECTION_START;
+    rt_command_flags &= ~RT_FLAG_STATUS1;
+    CRITICAL_SECTION_END;
+    uint8_t saved_port = serial_reply_port;
+    serial_reply_port = 1;
+    status_report();
+    serial_reply_port = saved_port;
+  }
+  #endif
+}
+#endif //REALTIME_COMMANDS
+
+#ifdef AUTO_REPORT
+// Pushes the status line every autoreport_interval ms, so the host doesn't have to poll M105/M114.
+void auto_report()
+{
+  if(autoreport_interval == 0)
+    return;
+  if((millis() - previous_millis_autoreport) < autoreport_interval)
+    return;
+  previous_millis_autoreport = millis();
+  #ifdef SERIAL_PORT_2
+    uint8_t saved_port = serial_reply_port;
+    serial_reply_port = autoreport_port;
+    status_report();
+    serial_reply_port = saved_port;
+  #else
+    status_report();
+  #endif
+}
+#endif //AUTO_REPORT
+
 void manage_inactivity(byte debug) 
 { 
+  #ifdef REALTIME_COMMANDS
+    realtime_commands();
+  #endif
+  #ifdef AUTO_REPORT
+    auto_report();
+  #endif
   if( (millis() - previous_millis_cmd) >  max_inactive_time ){
     if(max_inactive_time){
       PSU_off();//Elefu:Instead of a proper kill on idle, we just turn off the PSU
@@ -1929,7 +2505,10 @@ void Stop()
   disable_heater();
   if(Stopped == false) {
     Stopped = true;
-    Stopped_gcode_LastN = gcode_LastN; // Save last g_code for restart
+    Stopped_gcode_LastN = serial_channel[NUMBERED_CHANNEL].LastN; // Save last g_code for restart
+    #ifdef SERIAL_PORT_2
+      Stopped_gcode_channel = numbered_channel;
+    #endif
     SERIAL_ERROR_START;
     SERIAL_ERRORLNPGM(MSG_ERR_STOPPED);
     LCD_MESSAGEPGM(MSG_STOPPED);
@@ -22,6 +22,7 @@
 
 #include "Marlin.h"
 #include "MarlinSerial.h"
+#include "fixedpoint.h"
 
 #if MOTHERBOARD != 8 // !teensylu
 // this next line disables the entire HardwareSerial.cpp, 
@@ -32,8 +33,59 @@
   ring_buffer rx_buffer  =  { { 0 }, 0, 0 };
 #endif
 
+#ifdef REALTIME_COMMANDS
+volatile unsigned char rt_command_flags = 0;
+volatile bool rt_feed_hold = false;
+volatile uint8_t rt_binary_ports = 0;
+static uint8_t rt_line_start = 3; // bit per port: the last byte stored was a line end, no line is begun
+
+// Called for every received byte, from the RX interrupt or from checkRx() in the stepper interrupt.
+// Only sets flags, the status report and the kill are done by the main loop. '?', '!' and '~' only
+// count between lines, so they can still be part of a line (8.3 names like FILE~1.GCO, M117 text);
+// ctrl-x never is part of G-code and counts everywhere. The frames of a binary transfer are left alone,
+// any byte value can be in them.
+bool rt_command_char(unsigned char c, uint8_t port)
+{
+  uint8_t bit = 1 << port;
+  if(rt_binary_ports & bit)
+  {
+    rt_line_start |= bit; // the line after the transfer, M29
+    return false;
+  }
+  if(c == RT_CMD_KILL)
+  {
+    rt_command_flags |= RT_FLAG_KILL;
+    return true;
+  }
+  if(rt_line_start & bit)
+  {
+    switch(c)
+    {
+      case RT_CMD_STATUS:
+        rt_command_flags |= port ? RT_FLAG_STATUS1 : RT_FLAG_STATUS;
+        return true;
+      case RT_CMD_FEED_HOLD:
+        rt_feed_hold = true;
+        return true;
+      case RT_CMD_RESUME:
+        rt_feed_hold = false;
+        return true;
+    }
+  }
+  if(c == '\n' || c == '\r')
+    rt_line_start |= bit;
+  else
+    rt_line_start &= ~bit;
+  return false;
+}
+#endif
+
 FORCE_INLINE void store_char(unsigned char c)
 {
+  #ifdef REALTIME_COMMANDS
+    if(rt_command_char(c, 0))
+      return;
+  #endif
   int i = (unsigned int)(rx_buffer.head + 1) % RX_BUFFER_SIZE;
 
   // if we should be storing the received character into the location
@@ -64,6 +116,84 @@ FORCE_INLINE void store_char(unsigned char c)
   }
 #endif
 
+#ifdef SERIAL_PORT_2
+ring_buffer rx_buffer1  =  { { 0 }, 0, 0 };
+tx_ring_buffer tx_buffer1  =  { { 0 }, 0, 0 };
+uint8_t serial_reply_port = 0;
+
+SIGNAL(USART1_RX_vect)
+{
+  unsigned char c  =  UDR1;
+  #ifdef REALTIME_COMMANDS
+    if(rt_command_char(c, 1))
+      return;
+  #endif
+  int i = (unsigned int)(rx_buffer1.head + 1) % RX_BUFFER_SIZE;
+  if (i != rx_buffer1.tail) {
+    rx_buffer1.buffer[rx_buffer1.head] = c;
+    rx_buffer1.head = i;
+  }
+}
+
+SIGNAL(USART1_UDRE_vect)
+{
+  if (tx_buffer1.head == tx_buffer1.tail) {
+    cbi(UCSR1B, UDRIE1); // nothing left to send
+  } else {
+    UDR1 = tx_buffer1.buffer[tx_buffer1.tail];
+    tx_buffer1.tail = (tx_buffer1.tail + 1) % TX_BUFFER_SIZE;
+  }
+}
+
+void MarlinSerial1::begin(long baud)
+{
+  uint16_t baud_setting = (F_CPU / 4 / baud - 1) / 2;
+
+  UCSR1A = 1 << U2X1;
+  UBRR1H = baud_setting >> 8;
+  UBRR1L = baud_setting;
+
+  sbi(UCSR1B, RXEN1);
+  sbi(UCSR1B, TXEN1);
+  sbi(UCSR1B, RXCIE1);
+}
+
+int MarlinSerial1::read(void)
+{
+  if (rx_buffer1.head == rx_buffer1.tail) {
+    return -1;
+  } else {
+    unsigned char c = rx_buffer1.buffer[rx_buffer1.tail];
+    rx_buffer1.tail = (unsigned int)(rx_buffer1.tail + 1) % RX_BUFFER_SIZE;
+    return c;
+  }
+}
+
+void MarlinSerial1::flush(void)
+{
+  rx_buffer1.head = rx_buffer1.tail;
+}
+
+void MarlinSerial1::write(uint8_t c)
+{
+  unsigned char i = (tx_buffer1.head + 1) % TX_BUFFER_SIZE;
+
+  // Ring full: wait for the interrupt to make room. With interrupts off (kill(), messages from an ISR)
+  // the bytes are pushed out here by polling instead.
+  while (i == tx_buffer1.tail) {
+    if (!(SREG & (1 << SREG_I)) && (UCSR1A & (1 << UDRE1))) {
+      UDR1 = tx_buffer1.buffer[tx_buffer1.tail];
+      tx_buffer1.tail = (tx_buffer1.tail + 1) % TX_BUFFER_SIZE;
+    }
+  }
+  tx_buffer1.buffer[tx_buffer1.head] = c;
+  tx_buffer1.head = i;
+  sbi(UCSR1B, UDRIE1);
+}
+
+MarlinSerial1 MSerial1;
+#endif //SERIAL_PORT_2
+
 // Constructors ////////////////////////////////////////////////////////////////
 
 MarlinSerial::MarlinSerial()
@@ -287,6 +417,15 @@ void MarlinSerial::printNumber(unsigned long n, uint8_t base)
 
 void MarlinSerial::printFloat(double number, uint8_t digits) 
 { 
+  // Normal case: one multiply to a scaled long, the digits are then integer math.
+  if(fixp_fits(number, digits))
+  {
+    char buf[FIXP_BUFSIZE];
+    fixp_format(buf, fixp_from_float(number, digits), digits);
+    write(buf);
+    return;
+  }
+
   // Handle negative numbers
   if (number < 0.0)
   {
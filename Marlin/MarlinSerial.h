@@ -50,6 +50,64 @@ struct ring_buffer
   extern ring_buffer rx_buffer;
 #endif
 
+#ifdef REALTIME_COMMANDS
+  // bits in rt_command_flags, set from the RX path and cleared by the main loop
+  #define RT_FLAG_STATUS  1
+  #define RT_FLAG_STATUS1 2 // status asked for on the second port
+  #define RT_FLAG_KILL    4
+
+  extern volatile unsigned char rt_command_flags;
+  extern volatile bool rt_feed_hold; // the stepper interrupt doesn't start new blocks while this is set
+  extern volatile uint8_t rt_binary_ports; // bit per port that takes M560 frames, its bytes all go to the buffer
+
+  // returns true if c was a real-time command, which must then not be stored in the receive buffer of port.
+  // Every byte has to go through here, it keeps track of where the lines of each port end.
+  bool rt_command_char(unsigned char c, uint8_t port);
+#endif
+
+#ifdef SERIAL_PORT_2
+  #if !defined(UBRR1H)
+    #error SERIAL_PORT_2 needs a processor with USART1
+  #endif
+  #if MOTHERBOARD == 21 && EXTRUDERS > 1
+    #error SERIAL_PORT_2 uses the E1 step/dir pins of the Elefu RA board
+  #endif
+
+  #define TX_BUFFER_SIZE 64
+
+  struct tx_ring_buffer
+  {
+    unsigned char buffer[TX_BUFFER_SIZE];
+    volatile unsigned char head;
+    volatile unsigned char tail;
+  };
+
+  extern ring_buffer rx_buffer1;
+  extern tx_ring_buffer tx_buffer1;
+
+  // Where MSerial output goes: 0 is the main port, 1 the second port.
+  // The main loop points it at the port that sent the command being processed.
+  extern uint8_t serial_reply_port;
+
+  // The second command channel on USART1. Both directions go through interrupts and ring buffers,
+  // so a slow device on this port only holds up the main loop when the TX ring is full.
+  class MarlinSerial1
+  {
+    public:
+      void begin(long);
+      int read(void);
+      void flush(void);
+      void write(uint8_t c);
+
+      FORCE_INLINE int available(void)
+      {
+        return (unsigned int)(RX_BUFFER_SIZE + rx_buffer1.head - rx_buffer1.tail) % RX_BUFFER_SIZE;
+      }
+  };
+
+  extern MarlinSerial1 MSerial1;
+#endif
+
 class MarlinSerial //: public Stream
 {
 
@@ -68,6 +126,12 @@ class MarlinSerial //: public Stream
     
     FORCE_INLINE void write(uint8_t c)
     {
+      #ifdef SERIAL_PORT_2
+        if(serial_reply_port) {
+          MSerial1.write(c);
+          return;
+        }
+      #endif
       while (!((UCSR0A) & (1 << UDRE0)))
         ;
 
@@ -79,6 +143,10 @@ class MarlinSerial //: public Stream
     {
       if((UCSR0A & (1<<RXC0)) != 0) {
         unsigned char c  =  UDR0;
+        #ifdef REALTIME_COMMANDS
+          if(rt_command_char(c, 0))
+            return;
+        #endif
         int i = (unsigned int)(rx_buffer.head + 1) % RX_BUFFER_SIZE;
 
         // if we should be storing the received character into the location
@@ -21,6 +21,75 @@
 
 #ifdef SDSUPPORT
 #include "Sd2Card.h"
+#if USE_SD_CRC == 1
+#include <util/crc16.h>
+#elif USE_SD_CRC == 2
+/** CRC16 of the data blocks, CCITT polynomial, one entry per byte value */
+static const uint16_t crcTable[256] PROGMEM = {
+  0X0000, 0X1021, 0X2042, 0X3063, 0X4084, 0X50A5, 0X60C6, 0X70E7,
+  0X8108, 0X9129, 0XA14A, 0XB16B, 0XC18C, 0XD1AD, 0XE1CE, 0XF1EF,
+  0X1231, 0X0210, 0X3273, 0X2252, 0X52B5, 0X4294, 0X72F7, 0X62D6,
+  0X9339, 0X8318, 0XB37B, 0XA35A, 0XD3BD, 0XC39C, 0XF3FF, 0XE3DE,
+  0X2462, 0X3443, 0X0420, 0X1401, 0X64E6, 0X74C7, 0X44A4, 0X5485,
+  0XA56A, 0XB54B, 0X8528, 0X9509, 0XE5EE, 0XF5CF, 0XC5AC, 0XD58D,
+  0X3653, 0X2672, 0X1611, 0X0630, 0X76D7, 0X66F6, 0X5695, 0X46B4,
+  0XB75B, 0XA77A, 0X9719, 0X8738, 0XF7DF, 0XE7FE, 0XD79D, 0XC7BC,
+  0X48C4, 0X58E5, 0X6886, 0X78A7, 0X0840, 0X1861, 0X2802, 0X3823,
+  0XC9CC, 0XD9ED, 0XE98E, 0XF9AF, 0X8948, 0X9969, 0XA90A, 0XB92B,
+  0X5AF5, 0X4AD4, 0X7AB7, 0X6A96, 0X1A71, 0X0A50, 0X3A33, 0X2A12,
+  0XDBFD, 0XCBDC, 0XFBBF, 0XEB9E, 0X9B79, 0X8B58, 0XBB3B, 0XAB1A,
+  0X6CA6, 0X7C87, 0X4CE4, 0X5CC5, 0X2C22, 0X3C03, 0X0C60, 0X1C41,
+  0XEDAE, 0XFD8F, 0XCDEC, 0XDDCD, 0XAD2A, 0XBD0B, 0X8D68, 0X9D49,
+  0X7E97, 0X6EB6, 0X5ED5, 0X4EF4, 0X3E13, 0X2E32, 0X1E51, 0X0E70,
+  0XFF9F, 0XEFBE, 0XDFDD, 0XCFFC, 0XBF1B, 0XAF3A, 0X9F59, 0X8F78,
+  0X9188, 0X81A9, 0XB1CA, 0XA1EB, 0XD10C, 0XC12D, 0XF14E, 0XE16F,
+  0X1080, 0X00A1, 0X30C2, 0X20E3, 0X5004, 0X4025, 0X7046, 0X6067,
+  0X83B9, 0X9398, 0XA3FB, 0XB3DA, 0XC33D, 0XD31C, 0XE37F, 0XF35E,
+  0X02B1, 0X1290, 0X22F3, 0X32D2, 0X4235, 0X5214, 0X6277, 0X7256,
+  0XB5EA, 0XA5CB, 0X95A8, 0X8589, 0XF56E, 0XE54F, 0XD52C, 0XC50D,
+  0X34E2, 0X24C3, 0X14A0, 0X0481, 0X7466, 0X6447, 0X5424, 0X4405,
+  0XA7DB, 0XB7FA, 0X8799, 0X97B8, 0XE75F, 0XF77E, 0XC71D, 0XD73C,
+  0X26D3, 0X36F2, 0X0691, 0X16B0, 0X6657, 0X7676, 0X4615, 0X5634,
+  0XD94C, 0XC96D, 0XF90E, 0XE92F, 0X99C8, 0X89E9, 0XB98A, 0XA9AB,
+  0X5844, 0X4865, 0X7806, 0X6827, 0X18C0, 0X08E1, 0X3882, 0X28A3,
+  0XCB7D, 0XDB5C, 0XEB3F, 0XFB1E, 0X8BF9, 0X9BD8, 0XABBB, 0XBB9A,
+  0X4A75, 0X5A54, 0X6A37, 0X7A16, 0X0AF1, 0X1AD0, 0X2AB3, 0X3A92,
+  0XFD2E, 0XED0F, 0XDD6C, 0XCD4D, 0XBDAA, 0XAD8B, 0X9DE8, 0X8DC9,
+  0X7C26, 0X6C07, 0X5C64, 0X4C45, 0X3CA2, 0X2C83, 0X1CE0, 0X0CC1,
+  0XEF1F, 0XFF3E, 0XCF5D, 0XDF7C, 0XAF9B, 0XBFBA, 0X8FD9, 0X9FF8,
+  0X6E17, 0X7E36, 0X4E55, 0X5E74, 0X2E93, 0X3EB2, 0X0ED1, 0X1EF0
+};
+#endif  // USE_SD_CRC
+//------------------------------------------------------------------------------
+/** CRC16 of data blocks, one byte at a time - zero without USE_SD_CRC */
+static inline __attribute__((always_inline))
+  uint16_t spiCrc(uint16_t crc, uint8_t b) {
+#if USE_SD_CRC == 1
+  return _crc_xmodem_update(crc, b);
+#elif USE_SD_CRC == 2
+  return (crc << 8) ^ pgm_read_word(&crcTable[(crc >> 8) ^ b]);
+#else  // USE_SD_CRC
+  (void)crc;
+  (void)b;
+  return 0;
+#endif  // USE_SD_CRC
+}
+//------------------------------------------------------------------------------
+#if USE_SD_CRC
+/** CRC7 of a command, with the end bit */
+static uint8_t CRC7(const uint8_t* buf, uint8_t n) {
+  uint8_t crc = 0;
+  for (uint8_t i = 0; i < n; i++) {
+    uint8_t d = buf[i];
+    for (uint8_t j = 0; j < 8; j++) {
+      crc <<= 1;
+      if ((d ^ crc) & 0X80) crc ^= 0X09;
+      d <<= 1;
+    }
+  }
+  return (crc << 1) | 1;
+}
+#endif  // USE_SD_CRC
 //------------------------------------------------------------------------------
 #ifndef SOFTWARE_SPI
 // functions for hardware SPI
@@ -46,18 +115,44 @@ static uint8_t spiRec() {
   return SPDR;
 }
 //------------------------------------------------------------------------------
-/** SPI read data - only one call so force inline */
+/**
+ * SPI read data, returns the CRC16 of it - only one call so force inline
+ *
+ * Each byte is taken out of SPDR and the next transfer started before it is
+ * stored, so the store and the CRC run while the next byte is on the bus.
+ * Two bytes a round halve the loop overhead.
+ */
 static inline __attribute__((always_inline))
-  void spiRead(uint8_t* buf, uint16_t nbyte) {
-  if (nbyte-- == 0) return;
+  uint16_t spiRead(uint8_t* buf, uint16_t nbyte) {
+  uint16_t crc = 0;
+  uint8_t b;
+  if (nbyte == 0) return crc;
+  uint8_t* last = buf + nbyte - 1;
   SPDR = 0XFF;
-  for (uint16_t i = 0; i < nbyte; i++) {
+  while (buf + 1 < last) {
     while (!(SPSR & (1 << SPIF)));
-    buf[i] = SPDR;
+    b = SPDR;
     SPDR = 0XFF;
+    buf[0] = b;
+    crc = spiCrc(crc, b);
+    while (!(SPSR & (1 << SPIF)));
+    b = SPDR;
+    SPDR = 0XFF;
+    buf[1] = b;
+    crc = spiCrc(crc, b);
+    buf += 2;
+  }
+  if (buf < last) {
+    while (!(SPSR & (1 << SPIF)));
+    b = SPDR;
+    SPDR = 0XFF;
+    *buf++ = b;
+    crc = spiCrc(crc, b);
   }
   while (!(SPSR & (1 << SPIF)));
-  buf[nbyte] = SPDR;
+  b = SPDR;
+  *buf = b;
+  return spiCrc(crc, b);
 }
 //------------------------------------------------------------------------------
 /** SPI send a byte */
@@ -66,17 +161,30 @@ static void spiSend(uint8_t b) {
   while (!(SPSR & (1 << SPIF)));
 }
 //------------------------------------------------------------------------------
-/** SPI send block - only one call so force inline */
+/**
+ * SPI send block, returns the CRC16 of it - only one call so force inline
+ *
+ * The next byte is loaded before the wait, so it goes out as soon as the
+ * last one is done, and the CRC runs while it is on the bus.
+ */
 static inline __attribute__((always_inline))
-  void spiSendBlock(uint8_t token, const uint8_t* buf) {
+  uint16_t spiSendBlock(uint8_t token, const uint8_t* buf) {
+  uint16_t crc = 0;
+  const uint8_t* end = buf + 512;
   SPDR = token;
-  for (uint16_t i = 0; i < 512; i += 2) {
+  while (buf < end) {
+    uint8_t b = buf[0];
     while (!(SPSR & (1 << SPIF)));
-    SPDR = buf[i];
+    SPDR = b;
+    crc = spiCrc(crc, b);
+    b = buf[1];
     while (!(SPSR & (1 << SPIF)));
-    SPDR = buf[i + 1];
+    SPDR = b;
+    crc = spiCrc(crc, b);
+    buf += 2;
   }
   while (!(SPSR & (1 << SPIF)));
+  return crc;
 }
 //------------------------------------------------------------------------------
 #else  // SOFTWARE_SPI
@@ -110,11 +218,14 @@ static uint8_t spiRec() {
   return data;
 }
 //------------------------------------------------------------------------------
-/** Soft SPI read data */
-static void spiRead(uint8_t* buf, uint16_t nbyte) {
+/** Soft SPI read data, returns the CRC16 of it */
+static uint16_t spiRead(uint8_t* buf, uint16_t nbyte) {
+  uint16_t crc = 0;
   for (uint16_t i = 0; i < nbyte; i++) {
     buf[i] = spiRec();
+    crc = spiCrc(crc, buf[i]);
   }
+  return crc;
 }
 //------------------------------------------------------------------------------
 /** Soft SPI send byte */
@@ -141,23 +252,38 @@ static void spiSend(uint8_t data) {
   sei();
 }
 //------------------------------------------------------------------------------
-/** Soft SPI send block */
-  void spiSendBlock(uint8_t token, const uint8_t* buf) {
+/** Soft SPI send block, returns the CRC16 of it */
+  uint16_t spiSendBlock(uint8_t token, const uint8_t* buf) {
+  uint16_t crc = 0;
   spiSend(token);
   for (uint16_t i = 0; i < 512; i++) {
     spiSend(buf[i]);
+    crc = spiCrc(crc, buf[i]);
   }
+  return crc;
 }
 #endif  // SOFTWARE_SPI
 //------------------------------------------------------------------------------
 // send command and return error code.  Return zero for OK
 uint8_t Sd2Card::cardCommand(uint8_t cmd, uint32_t arg) {
+  // any other command ends a multiple block read or write
+  if (inReadStream_ && cmd != CMD12) readStop();
+  if (inWriteStream_) writeStop();
+
   // select card
   chipSelectLow();
 
   // wait up to 300 ms if busy
   waitNotBusy(300);
 
+#if USE_SD_CRC
+  // send command, argument and the CRC the card checks after CMD59
+  uint8_t buf[6];
+  buf[0] = cmd | 0x40;
+  for (uint8_t i = 0; i < 4; i++) buf[1 + i] = arg >> (24 - 8 * i);
+  buf[5] = CRC7(buf, 5);
+  for (uint8_t i = 0; i < 6; i++) spiSend(buf[i]);
+#else  // USE_SD_CRC
   // send command
   spiSend(cmd | 0x40);
 
@@ -169,6 +295,7 @@ uint8_t Sd2Card::cardCommand(uint8_t cmd, uint32_t arg) {
   if (cmd == CMD0) crc = 0X95;  // correct crc for CMD0 with arg 0
   if (cmd == CMD8) crc = 0X87;  // correct crc for CMD8 with arg 0X1AA
   spiSend(crc);
+#endif  // USE_SD_CRC
 
   // skip stuff byte for stop read
   if (cmd == CMD12) spiRec();
@@ -285,6 +412,7 @@ bool Sd2Card::eraseSingleBlockEnable() {
  */
 bool Sd2Card::init(uint8_t sckRateID, uint8_t chipSelectPin) {
   errorCode_ = type_ = 0;
+  inReadStream_ = inWriteStream_ = false;
   chipSelectPin_ = chipSelectPin;
   // 16-bit init start time allows over a minute
   uint16_t t0 = (uint16_t)millis();
@@ -351,6 +479,13 @@ bool Sd2Card::init(uint8_t sckRateID, uint8_t chipSelectPin) {
     // discard rest of ocr - contains allowed voltage range
     for (uint8_t i = 0; i < 3; i++) spiRec();
   }
+#if USE_SD_CRC
+  // from here on the card checks the CRC of every command and written block
+  if (cardCommand(CMD59, 1)) {
+    error(SD_CARD_ERROR_CMD59);
+    goto fail;
+  }
+#endif  // USE_SD_CRC
   chipSelectHigh();
 
 #ifndef SOFTWARE_SPI
@@ -387,6 +522,29 @@ bool Sd2Card::readBlock(uint32_t blockNumber, uint8_t* dst) {
   return false;
 }
 //------------------------------------------------------------------------------
+/**
+ * Read a 512 byte block, continuing a multiple block read if the block
+ * follows the one read last by this function. Otherwise a new CMD18 is
+ * started at \a blockNumber.
+ *
+ * \param[in] blockNumber Logical block to be read.
+ * \param[out] dst Pointer to the location that will receive the data.
+
+ * \return The value one, true, is returned for success and
+ * the value zero, false, is returned for failure.
+ */
+bool Sd2Card::readBlockStream(uint32_t blockNumber, uint8_t* dst) {
+  if (!inReadStream_ || blockNumber != streamBlock_) {
+    if (!readStart(blockNumber)) return false;
+  }
+  if (!readData(dst)) {
+    readStop();
+    return false;
+  }
+  streamBlock_ = blockNumber + 1;
+  return true;
+}
+//------------------------------------------------------------------------------
 /** Read one data block in a multiple block read sequence
  *
  * \param[in] dst Pointer to the location for the data to be read.
@@ -400,6 +558,9 @@ bool Sd2Card::readData(uint8_t *dst) {
 }
 //------------------------------------------------------------------------------
 bool Sd2Card::readData(uint8_t* dst, uint16_t count) {
+#if USE_SD_CRC
+  uint16_t crc;
+#endif  // USE_SD_CRC
   // wait for start block token
   uint16_t t0 = millis();
   while ((status_ = spiRec()) == 0XFF) {
@@ -412,12 +573,25 @@ bool Sd2Card::readData(uint8_t* dst, uint16_t count) {
     error(SD_CARD_ERROR_READ);
     goto fail;
   }
+#if USE_SD_CRC
+  // transfer data
+  crc = spiRead(dst, count);
+
+  // the card's CRC of the block, high byte first
+  crc ^= (uint16_t)spiRec() << 8;
+  crc ^= spiRec();
+  if (crc) {
+    error(SD_CARD_ERROR_READ_CRC);
+    goto fail;
+  }
+#else  // USE_SD_CRC
   // transfer data
   spiRead(dst, count);
 
   // discard CRC
   spiRec();
   spiRec();
+#endif  // USE_SD_CRC
   chipSelectHigh();
   return true;
 
@@ -451,11 +625,13 @@ bool Sd2Card::readRegister(uint8_t cmd, void* buf) {
  * the value zero, false, is returned for failure.
  */
 bool Sd2Card::readStart(uint32_t blockNumber) {
+  streamBlock_ = blockNumber;
   if (type()!= SD_CARD_TYPE_SDHC) blockNumber <<= 9;
   if (cardCommand(CMD18, blockNumber)) {
     error(SD_CARD_ERROR_CMD18);
     goto fail;
   }
+  inReadStream_ = true;
   chipSelectHigh();
   return true;
 
@@ -470,6 +646,7 @@ bool Sd2Card::readStart(uint32_t blockNumber) {
  * the value zero, false, is returned for failure.
  */
 bool Sd2Card::readStop() {
+  inReadStream_ = false;
   chipSelectLow();
   if (cardCommand(CMD12, 0)) {
     error(SD_CARD_ERROR_CMD12);
@@ -551,6 +728,32 @@ bool Sd2Card::writeBlock(uint32_t blockNumber, const uint8_t* src) {
   return false;
 }
 //------------------------------------------------------------------------------
+/**
+ * Write a 512 byte block, continuing a multiple block write if the block
+ * follows the one written last by this function. Otherwise a new CMD25 is
+ * started at \a blockNumber.
+ *
+ * \param[in] blockNumber Logical block to be written.
+ * \param[in] src Pointer to the location of the data to be written.
+ * \param[in] eraseCount The number of blocks to be pre-erased if a new
+ * CMD25 is started.
+ *
+ * \return The value one, true, is returned for success and
+ * the value zero, false, is returned for failure.
+ */
+bool Sd2Card::writeBlockStream(uint32_t blockNumber, const uint8_t* src,
+  uint32_t eraseCount) {
+  if (!inWriteStream_ || blockNumber != streamBlock_) {
+    if (!writeStart(blockNumber, eraseCount)) return false;
+  }
+  if (!writeData(src)) {
+    writeStop();
+    return false;
+  }
+  streamBlock_ = blockNumber + 1;
+  return true;
+}
+//------------------------------------------------------------------------------
 /** Write one data block in a multiple block write sequence
  * \param[in] src Pointer to the location of the data to be written.
  * \return The value one, true, is returned for success and
@@ -572,10 +775,17 @@ bool Sd2Card::writeData(const uint8_t* src) {
 //------------------------------------------------------------------------------
 // send one block of data for write block or write multiple blocks
 bool Sd2Card::writeData(uint8_t token, const uint8_t* src) {
+#if USE_SD_CRC
+  uint16_t crc = spiSendBlock(token, src);
+
+  spiSend(crc >> 8);
+  spiSend(crc & 0XFF);
+#else  // USE_SD_CRC
   spiSendBlock(token, src);
 
   spiSend(0xff);  // dummy crc
   spiSend(0xff);  // dummy crc
+#endif  // USE_SD_CRC
 
   status_ = spiRec();
   if ((status_ & DATA_RES_MASK) != DATA_RES_ACCEPTED) {
@@ -606,12 +816,14 @@ bool Sd2Card::writeStart(uint32_t blockNumber, uint32_t eraseCount) {
     error(SD_CARD_ERROR_ACMD23);
     goto fail;
   }
+  streamBlock_ = blockNumber;
   // use address if not SDHC card
   if (type() != SD_CARD_TYPE_SDHC) blockNumber <<= 9;
   if (cardCommand(CMD25, blockNumber)) {
     error(SD_CARD_ERROR_CMD25);
     goto fail;
   }
+  inWriteStream_ = true;
   chipSelectHigh();
   return true;
 
@@ -626,6 +838,7 @@ bool Sd2Card::writeStart(uint32_t blockNumber, uint32_t eraseCount) {
  * the value zero, false, is returned for failure.
  */
 bool Sd2Card::writeStop() {
+  inWriteStream_ = false;
   chipSelectLow();
   if (!waitNotBusy(SD_WRITE_TIMEOUT)) goto fail;
   spiSend(STOP_TRAN_TOKEN);
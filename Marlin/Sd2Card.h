@@ -103,6 +103,10 @@ uint8_t const SD_CARD_ERROR_WRITE_TIMEOUT = 0X17;
 uint8_t const SD_CARD_ERROR_SCK_RATE = 0X18;
 /** init() not called */
 uint8_t const SD_CARD_ERROR_INIT_NOT_CALLED = 0X19;
+/** card did not accept CRC checking, CMD59 */
+uint8_t const SD_CARD_ERROR_CMD59 = 0X1A;
+/** the CRC of a block read doesn't match */
+uint8_t const SD_CARD_ERROR_READ_CRC = 0X1B;
 //------------------------------------------------------------------------------
 // card types
 /** Standard capacity V1 SD card */
@@ -154,7 +158,8 @@ uint8_t const SPI_SCK_PIN = SOFT_SPI_SCK_PIN;
 class Sd2Card {
  public:
   /** Construct an instance of Sd2Card. */
-  Sd2Card() : errorCode_(SD_CARD_ERROR_INIT_NOT_CALLED), type_(0) {}
+  Sd2Card() : errorCode_(SD_CARD_ERROR_INIT_NOT_CALLED), type_(0),
+    inReadStream_(false), inWriteStream_(false) {}
   uint32_t cardSize();
   bool erase(uint32_t firstBlock, uint32_t lastBlock);
   bool eraseSingleBlockEnable();
@@ -178,6 +183,7 @@ class Sd2Card {
   bool init(uint8_t sckRateID = SPI_FULL_SPEED,
     uint8_t chipSelectPin = SD_CHIP_SELECT_PIN);
   bool readBlock(uint32_t block, uint8_t* dst);
+  bool readBlockStream(uint32_t block, uint8_t* dst);
   /**
    * Read a card's CID register. The CID contains card identification
    * information such as Manufacturer ID, Product name, Product serial
@@ -210,9 +216,15 @@ class Sd2Card {
    */
   int type() const {return type_;}
   bool writeBlock(uint32_t blockNumber, const uint8_t* src);
+  bool writeBlockStream(uint32_t blockNumber, const uint8_t* src,
+    uint32_t eraseCount);
   bool writeData(const uint8_t* src);
   bool writeStart(uint32_t blockNumber, uint32_t eraseCount);
   bool writeStop();
+  /** End a multiple block write left open by writeBlockStream().
+   * \return true for success or false for failure.
+   */
+  bool writeStreamStop() {return inWriteStream_ ? writeStop() : true;}
  private:
   //----------------------------------------------------------------------------
   uint8_t chipSelectPin_;
@@ -220,6 +232,9 @@ class Sd2Card {
   uint8_t spiRate_;
   uint8_t status_;
   uint8_t type_;
+  bool inReadStream_;          // a CMD18 from readStart() is open
+  bool inWriteStream_;         // a CMD25 from writeStart() is open
+  uint32_t streamBlock_;       // next block of the open CMD18 or CMD25
   // private functions
   uint8_t cardAcmd(uint8_t cmd, uint32_t arg) {
     cardCommand(CMD55, 0);
@@ -93,6 +93,7 @@ dir_t* SdBaseFile::cacheDirEntry(uint8_t action) {
 bool SdBaseFile::close() {
   bool rtn = sync();
   type_ = FAT_FILE_TYPE_CLOSED;
+  extents_ = 0;
   return rtn;
 }
 //------------------------------------------------------------------------------
@@ -769,6 +770,7 @@ bool SdBaseFile::openCachedEntry(uint8_t dirIndex, uint8_t oflag) {
   // set to start of file
   curCluster_ = 0;
   curPosition_ = 0;
+  extents_ = 0;
   if ((oflag & O_TRUNC) && !truncate(0)) return false;
   return oflag & O_AT_END ? seekEnd(0) : true;
 
@@ -910,6 +912,7 @@ bool SdBaseFile::openRoot(SdVolume* vol) {
   // set to start of file
   curCluster_ = 0;
   curPosition_ = 0;
+  extents_ = 0;
 
   // root has no directory entry
   dirBlock_ = 0;
@@ -1068,8 +1071,8 @@ int16_t SdBaseFile::read(void* buf, uint16_t nbyte) {
           // use first cluster in file
           curCluster_ = firstCluster_;
         } else {
-          // get next cluster from FAT
-          if (!vol_->fatGet(curCluster_, &curCluster_)) goto fail;
+          // get next cluster from the extent map or the FAT
+          if (!nextCluster()) goto fail;
         }
       }
       block = vol_->clusterStartBlock(curCluster_) + blockOfCluster;
@@ -1079,9 +1082,9 @@ int16_t SdBaseFile::read(void* buf, uint16_t nbyte) {
     // amount to be read from current block
     if (n > (512 - offset)) n = 512 - offset;
 
-    // no buffering needed if n == 512
+    // no buffering needed if n == 512, consecutive blocks are streamed
     if (n == 512 && block != vol_->cacheBlockNumber()) {
-      if (!vol_->readBlock(block, dst)) goto fail;
+      if (!vol_->readBlockStream(block, dst)) goto fail;
     } else {
       // read block to cache and copy data to caller
       if (!vol_->cacheRawBlock(block, SdVolume::CACHE_FOR_READ)) goto fail;
@@ -1211,6 +1214,52 @@ bool SdBaseFile::remove(SdBaseFile* dirFile, const char* path) {
   return false;
 }
 //------------------------------------------------------------------------------
+/** Add contiguous clusters to the end of a file for data that is written
+ * to the card with raw block writes instead of write().
+ *
+ * The clusters follow the file's last cluster if those are free. The file
+ * size grows by whole clusters; truncate() the file to the length actually
+ * written when done. The FAT is only updated in the volume cache.
+ *
+ * \note The file must be empty or only have been grown by reserveContiguous().
+ *
+ * \param[in] size Number of bytes to add, rounded up to whole clusters.
+ * \param[out] bgnBlock First block of the added clusters.
+ * \param[out] blockCount Number of blocks added.
+ *
+ * \return The value one, true, is returned for success and
+ * the value zero, false, is returned for failure.
+ * Reasons for failure include the file is not open for write, there is
+ * no free contiguous space of \a size or an I/O error occurred.
+ */
+bool SdBaseFile::reserveContiguous(uint32_t size, uint32_t* bgnBlock,
+                                   uint32_t* blockCount) {
+  uint32_t count;
+  uint32_t cluster;
+  if (!isFile() || !(flags_ & O_WRITE) || size == 0) goto fail;
+  extents_ = 0;
+
+  // number of clusters needed, continuing from the last one
+  count = ((size - 1) >> (vol_->clusterSizeShift_ + 9)) + 1;
+  cluster = firstCluster_ ? curCluster_ : 0;
+  if (!vol_->allocContiguous(count, &cluster)) goto fail;
+
+  if (firstCluster_ == 0) {
+    firstCluster_ = cluster;
+    flags_ |= F_FILE_DIR_DIRTY;
+  }
+  // keep the last cluster for the next call
+  curCluster_ = cluster + count - 1;
+  fileSize_ += count << (vol_->clusterSizeShift_ + 9);
+
+  *bgnBlock = vol_->clusterStartBlock(cluster);
+  *blockCount = count << vol_->clusterSizeShift_;
+  return true;
+
+ fail:
+  return false;
+}
+//------------------------------------------------------------------------------
 /** Rename a file or subdirectory.
  *
  * \param[in] dirFile Directory for the new path.
@@ -1409,6 +1458,7 @@ bool SdBaseFile::rmRfStar() {
 SdBaseFile::SdBaseFile(const char* path, uint8_t oflag) {
   type_ = FAT_FILE_TYPE_CLOSED;
   writeError = false;
+  extents_ = 0;
   open(path, oflag);
 }
 //------------------------------------------------------------------------------
@@ -1439,6 +1489,10 @@ bool SdBaseFile::seekSet(uint32_t pos) {
   nCur = (curPosition_ - 1) >> (vol_->clusterSizeShift_ + 9);
   nNew = (pos - 1) >> (vol_->clusterSizeShift_ + 9);
 
+  if (extents_ && mapCluster(nNew, &curCluster_)) {
+    curPosition_ = pos;
+    goto done;
+  }
   if (nNew < nCur || curPosition_ == 0) {
     // must follow chain from first cluster
     curCluster_ = firstCluster_;
@@ -1458,6 +1512,87 @@ bool SdBaseFile::seekSet(uint32_t pos) {
   return false;
 }
 //------------------------------------------------------------------------------
+/** Cluster number \a index of the file from the extent map.
+ * \return false if the map doesn't reach that far.
+ */
+bool SdBaseFile::mapCluster(uint32_t index, uint32_t* cluster) {
+  for (uint8_t i = 0; i < extents_->count; i++) {
+    if (index < extents_->extent[i].length) {
+      *cluster = extents_->extent[i].first + index;
+      return true;
+    }
+    index -= extents_->extent[i].length;
+  }
+  return false;
+}
+//------------------------------------------------------------------------------
+/** Advance curCluster_ to the next cluster of the file, from the extent map
+ * if there is one that covers it, else from the FAT.
+ */
+bool SdBaseFile::nextCluster() {
+  if (extents_) {
+    for (uint8_t i = 0; i < extents_->count; i++) {
+      uint32_t n = curCluster_ - extents_->extent[i].first;
+      if (n < extents_->extent[i].length) {
+        if (n + 1 < extents_->extent[i].length) {
+          curCluster_++;
+          return true;
+        }
+        if (i + 1 < extents_->count) {
+          curCluster_ = extents_->extent[i + 1].first;
+          return true;
+        }
+        break;
+      }
+    }
+  }
+  return vol_->fatGet(curCluster_, &curCluster_);
+}
+//------------------------------------------------------------------------------
+/** Walk the cluster chain of a file opened for reading once and keep it in
+ * \a map as runs of consecutive clusters. Reads and seeks then take the
+ * clusters from the map and only go to the FAT beyond its end, so they
+ * don't evict file data from the volume cache. The map is dropped by
+ * close() and by any write; \a map must stay valid until then.
+ *
+ * \param[out] map Receives the runs.
+ *
+ * \return The value one, true, is returned for success and
+ * the value zero, false, is returned for failure.
+ */
+bool SdBaseFile::mapExtents(SdExtentMap* map) {
+  uint32_t cluster = firstCluster_;
+  uint32_t n;
+  extents_ = 0;
+  map->count = 0;
+  map->complete = true;
+  if (!isFile()) goto fail;
+
+  // clusters the file occupies
+  n = (fileSize_ + ((uint32_t)512 << vol_->clusterSizeShift_) - 1)
+      >> (vol_->clusterSizeShift_ + 9);
+  while (n--) {
+    uint8_t i = map->count;
+    if (i && cluster == map->extent[i - 1].first + map->extent[i - 1].length
+        && map->extent[i - 1].length != 0XFFFF) {
+      map->extent[i - 1].length++;
+    } else if (i < SD_EXTENT_COUNT) {
+      map->extent[i].first = cluster;
+      map->extent[i].length = 1;
+      map->count++;
+    } else {
+      map->complete = false;
+      break;
+    }
+    if (n && !vol_->fatGet(cluster, &cluster)) goto fail;
+  }
+  extents_ = map;
+  return true;
+
+ fail:
+  return false;
+}
+//------------------------------------------------------------------------------
 void SdBaseFile::setpos(fpos_t* pos) {
   curPosition_ = pos->position;
   curCluster_ = pos->cluster;
@@ -1634,6 +1769,7 @@ bool SdBaseFile::truncate(uint32_t length) {
   uint32_t newPos;
   // error if not a normal file or read-only
   if (!isFile() || !(flags_ & O_WRITE)) goto fail;
+  extents_ = 0;
 
   // error if length is greater than current size
   if (length > fileSize_) goto fail;
@@ -1701,6 +1837,8 @@ int16_t SdBaseFile::write(const void* buf, uint16_t nbyte) {
 
   // error if not a normal file or is read-only
   if (!isFile() || !(flags_ & O_WRITE)) goto fail;
+  // the cluster chain may change
+  extents_ = 0;
 
   // seek to end of file if append flag
   if ((flags_ & O_APPEND) && curPosition_ != fileSize_) {
@@ -42,6 +42,23 @@ struct fpos_t {
   uint32_t cluster;
   fpos_t() : position(0), cluster(0) {}
 };
+//------------------------------------------------------------------------------
+/**
+ * \struct SdExtentMap
+ * \brief Cluster chain of an open file as runs of consecutive clusters.
+ * See SdBaseFile::mapExtents().
+ */
+struct SdExtentMap {
+  /** runs in use */
+  uint8_t count;
+  /** the runs cover the whole file */
+  bool complete;
+  /** first cluster and length in clusters of each run */
+  struct {
+    uint32_t first;
+    uint16_t length;
+  } extent[SD_EXTENT_COUNT];
+};
 
 // use the gnu style oflag in open()
 /** open() oflag for reading */
@@ -182,7 +199,7 @@ uint16_t const FAT_DEFAULT_TIME = (1 << 11);
 class SdBaseFile {
  public:
   /** Create an instance. */
-  SdBaseFile() : writeError(false), type_(FAT_FILE_TYPE_CLOSED) {}
+  SdBaseFile() : writeError(false), type_(FAT_FILE_TYPE_CLOSED), extents_(0) {}
   SdBaseFile(const char* path, uint8_t oflag);
   ~SdBaseFile() {if(isOpen()) close();}
   /**
@@ -272,6 +289,9 @@ class SdBaseFile {
   bool makeDir(SdBaseFile* dir, const char* path) {
     return mkdir(dir, path, false);
   }
+  bool mapExtents(SdExtentMap* map);
+  /** Go back to following the cluster chain in the FAT. */
+  void unmapExtents() {extents_ = 0;}
   bool open(SdBaseFile* dirFile, uint16_t index, uint8_t oflag);
   bool open(SdBaseFile* dirFile, const char* path, uint8_t oflag);
   bool open(const char* path, uint8_t oflag = O_READ);
@@ -286,6 +306,8 @@ class SdBaseFile {
   int8_t readDir(dir_t* dir);
   static bool remove(SdBaseFile* dirFile, const char* path);
   bool remove();
+  bool reserveContiguous(uint32_t size, uint32_t* bgnBlock,
+                         uint32_t* blockCount);
   /** Set the file's current position to zero. */
   void rewind() {seekSet(0);}
   bool rename(SdBaseFile* dirFile, const char* newPath);
@@ -345,12 +367,15 @@ class SdBaseFile {
   uint32_t  fileSize_;      // file size in bytes
   uint32_t  firstCluster_;  // first cluster of file
   SdVolume* vol_;           // volume where file is located
+  SdExtentMap* extents_;    // cluster map from mapExtents(), or 0
 
   /** experimental don't use */
   bool openParent(SdBaseFile* dir);
   // private functions
   bool addCluster();
   bool addDirCluster();
+  bool mapCluster(uint32_t index, uint32_t* cluster);
+  bool nextCluster();
   dir_t* cacheDirEntry(uint8_t action);
   int8_t lsPrintNext( uint8_t flags, uint8_t indent);
   static bool make83Name(const char* str, uint8_t* name, const char** ptr);
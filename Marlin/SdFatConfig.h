@@ -79,6 +79,34 @@
  */
 #define SET_SPI_SS_HIGH 1
 //------------------------------------------------------------------------------
+/**
+ * Read consecutive whole blocks of a file with one CMD18 multiple block
+ * read if SD_READ_STREAM is nonzero, instead of a CMD17 per block.
+ * The stream ends on the first other command: a read out of sequence,
+ * a FAT or directory access or a write.
+ */
+#define SD_READ_STREAM 1
+//------------------------------------------------------------------------------
+/**
+ * Number of runs of consecutive clusters an SdExtentMap holds. Each takes
+ * six bytes. A file in more pieces is mapped as far as the map goes and
+ * the rest of its cluster chain is read from the FAT.
+ */
+#define SD_EXTENT_COUNT 8
+//------------------------------------------------------------------------------
+/**
+ * Set USE_SD_CRC nonzero to have the card check the CRC of every command
+ * and written block, and to check the CRC16 of every block read. The CRC
+ * is computed in the SPI loops while the next byte is on the bus.
+ *
+ * USE_SD_CRC 1 - the small _crc_xmodem_update() of avr-libc, which is
+ * slower than the bus at full speed.
+ *
+ * USE_SD_CRC 2 - a table in flash, 512 bytes more, mostly hidden behind
+ * the transfer.
+ */
+#define USE_SD_CRC 0
+//------------------------------------------------------------------------------
 /**
  * Define MEGA_SOFT_SPI nonzero to use software SPI on Mega Arduinos.
  * Pins used are SS 10, MOSI 11, MISO 12, and SCK 13.
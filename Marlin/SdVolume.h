@@ -188,6 +188,13 @@ class SdVolume {
   }
   bool readBlock(uint32_t block, uint8_t* dst) {
     return sdCard_->readBlock(block, dst);}
+  bool readBlockStream(uint32_t block, uint8_t* dst) {
+#if SD_READ_STREAM
+    return sdCard_->readBlockStream(block, dst);
+#else  // SD_READ_STREAM
+    return sdCard_->readBlock(block, dst);
+#endif  // SD_READ_STREAM
+  }
   bool writeBlock(uint32_t block, const uint8_t* dst) {
     return sdCard_->writeBlock(block, dst);
   }
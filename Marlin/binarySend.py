@@ -0,0 +1,191 @@
+#!/usr/bin/python
+#
+# Uploads a file to the printer's SD card with the M560 binary transfer
+"""Binary SD upload
+
+Sends a file to the SD card through M560 (SD_BINARY_TRANSFER in Configuration_adv.h): the data
+goes in CRC checked frames of the size the printer asks for, as many of them ahead of the
+printer's acks as its receive buffer holds, and is written to the card as it comes. Much faster than M28, which waits for an ok after every line.
+Needs pyserial.
+
+Usage: python binarySend.py [options] file
+
+Options:
+  -h, --help        show this help
+  --port=...        serial port (default: /dev/ttyUSB0)
+  --baud=...        baud rate (default: BAUDRATE from Configuration.h)
+  --name=...        8.3 name on the card (default: the file's own name)
+  --window=...      frames sent ahead of the acks (default: what the printer reports, more can
+                    overrun its receive buffer)
+  --no-reset        don't wait for the printer to restart after the port is opened
+
+Frames are 0xA5, the sequence number (one byte), the data length (two bytes, little endian,
+0 for the end frame), the data and a CRC-16/XMODEM of everything behind the 0xA5 (two bytes,
+little endian). The printer answers "ack:<seq>" for every frame it wrote and "resend:<seq>"
+when a frame was broken or missing; everything from that frame on is sent again. When the
+printer reports an error the transfer is over, the abort frame (length 0xFFFF, no data) tells
+it to give the port back to command lines; without it the printer waits until the port has
+been quiet for BINARY_TIMEOUT.
+"""
+
+from __future__ import print_function
+import getopt
+import os
+import re
+import struct
+import sys
+import time
+
+FRAME_SYNC = 0xA5
+ABORT = None          # frame() with this as data gives the abort frame, length 0xFFFF and no data
+ACK_TIMEOUT = 2.0     # seconds without an answer before the unacknowledged frames are sent again
+
+here = os.path.dirname(os.path.abspath(__file__))
+
+def make_crc_table():
+    table = []
+    for n in range(256):
+        crc = n << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) if crc & 0x8000 else crc << 1
+        table.append(crc & 0xFFFF)
+    return table
+
+CRC_TABLE = make_crc_table()
+
+def crc_xmodem(data, crc=0):
+    "_crc_xmodem_update() of avr-libc over all bytes of data"
+    for b in bytearray(data):
+        crc = ((crc << 8) & 0xFFFF) ^ CRC_TABLE[(crc >> 8) ^ b]
+    return crc
+
+def frame(seq, data):
+    if data is ABORT:
+        body = struct.pack("<BH", seq & 0xFF, 0xFFFF)
+    else:
+        body = struct.pack("<BH", seq & 0xFF, len(data)) + data
+    return struct.pack("<B", FRAME_SYNC) + body + struct.pack("<H", crc_xmodem(body))
+
+def config_baud():
+    for line in open(os.path.join(here, "Configuration.h")):
+        m = re.match(r'\s*#define\s+BAUDRATE\s+(\d+)', line)
+        if m:
+            return int(m.group(1))
+    return 250000
+
+class Printer:
+    def __init__(self, port, baud, reset):
+        import serial
+        self.port = serial.Serial(port, baud, timeout=0.1)
+        if reset:
+            time.sleep(2)   # the bootloader runs after the port opens
+        self.port.reset_input_buffer()
+        self.pending = b""
+
+    def readline(self, timeout):
+        "One line from the printer, None if none came within timeout seconds"
+        end = time.time() + timeout
+        while b"\n" not in self.pending:
+            if time.time() > end:
+                return None
+            self.pending += self.port.read(self.port.in_waiting or 1)
+        line, self.pending = self.pending.split(b"\n", 1)
+        return line.decode("ascii", "replace").strip()
+
+    def command(self, text, timeout=10.0):
+        "Sends a line and returns the answers in front of its ok"
+        self.port.write((text + "\n").encode("ascii"))
+        answers = []
+        while True:
+            line = self.readline(timeout)
+            if line is None:
+                raise SystemExit("no answer to %s" % text)
+            if line.startswith("ok"):
+                return answers
+            if line.startswith("Error") or line.startswith("open failed"):
+                raise SystemExit("%s: %s" % (text, line))
+            answers.append(line)
+
+def send(printer, data, size, window):
+    frames = [data[i:i+size] for i in range(0, len(data), size)] + [b""]
+    base = 0            # oldest frame without an ack
+    sent = 0            # next frame to go out
+    while base < len(frames):
+        while sent < len(frames) and sent - base < window:
+            printer.port.write(frame(sent, frames[sent]))
+            sent += 1
+        line = printer.readline(ACK_TIMEOUT)
+        if line is None:
+            sent = base
+            continue
+        m = re.match(r'(ack|resend):(\d+)', line)
+        if not m:
+            if line.startswith("Error"):
+                # the printer drops the frames still in flight until this one, then takes lines again
+                printer.port.write(frame(0, ABORT))
+                raise SystemExit(line)
+            print(line)
+            continue
+        # the printer counts in one byte, find the frame among the ones in flight
+        index = base + ((int(m.group(2)) - base) & 0xFF)
+        if index > sent:
+            continue
+        if m.group(1) == "ack":
+            base = max(base, index + 1)
+        else:
+            base = sent = index
+
+def main(argv):
+    port = "/dev/ttyUSB0"
+    baud = config_baud()
+    name = None
+    window = None
+    reset = True
+    try:
+        opts, args = getopt.getopt(argv, "h", ["help", "port=", "baud=", "name=", "window=", "no-reset"])
+    except getopt.GetoptError:
+        usage()
+        sys.exit(2)
+    for opt, arg in opts:
+        if opt in ("-h", "--help"):
+            usage()
+            sys.exit()
+        elif opt == "--port":
+            port = arg
+        elif opt == "--baud":
+            baud = int(arg)
+        elif opt == "--name":
+            name = arg
+        elif opt == "--window":
+            window = int(arg)
+        elif opt == "--no-reset":
+            reset = False
+    if len(args) != 1:
+        usage()
+        sys.exit(2)
+    data = open(args[0], "rb").read()
+    if name is None:
+        name = os.path.basename(args[0]).lower()
+
+    printer = Printer(port, baud, reset)
+    size = None
+    for line in printer.command("M560 " + name):
+        m = re.search(r'frame:(\d+)', line)
+        if m:
+            size = int(m.group(1))
+        m = re.search(r'window:(\d+)', line)
+        if m and window is None:
+            window = int(m.group(1))
+    if size is None:
+        raise SystemExit("M560: the printer didn't start the transfer")
+    start = time.time()
+    send(printer, data, size, window or 1)
+    seconds = time.time() - start
+    printer.command("M29")
+    print("%d bytes in %.1fs, %.1f kB/s" % (len(data), seconds, len(data) / 1024.0 / max(seconds, 0.001)))
+
+def usage():
+    print(__doc__)
+
+if __name__ == "__main__":
+    main(sys.argv[1:])
@@ -4,6 +4,10 @@
 #include "stepper.h"
 #include "temperature.h"
 #include "language.h"
+#include "fixedpoint.h"
+#ifdef SD_BINARY_TRANSFER
+#include <util/crc16.h>
+#endif
 
 #ifdef SDSUPPORT
 
@@ -17,6 +21,26 @@ CardReader::CardReader()
    cardOK = false;
    saving = false;
    autostart_atmillis=0;
+#ifdef SD_READAHEAD
+   ra_cur=0;
+   ra_pos=0;
+   readaheadClear();
+#endif
+#ifdef SD_FAST_UPLOAD
+   uploading = false;
+#endif
+#ifdef SD_BINARY_TRANSFER
+   bt_mode = BT_OFF;
+#endif
+#ifdef SD_DIR_CACHE
+   dircacheClear();
+#endif
+#ifdef SD_GCB
+   gcb = false;
+#endif
+#ifdef SD_INDEX
+   ix_active = false;
+#endif
 
    autostart_stilltocheck=true; //the sd start is delayed, because otherwise the serial cannot answer fast enought to make contact with the hostsoftware.
    lastnr=0;
@@ -29,24 +53,65 @@ CardReader::CardReader()
   autostart_atmillis=millis()+5000;
 }
 
-char *createFilename(char *buffer,const dir_t &p) //buffer>12characters
+char *createFilename(char *buffer,const uint8_t *name) //buffer>12characters
 {
   char *pos=buffer;
   for (uint8_t i = 0; i < 11; i++) 
   {
-    if (p.name[i] == ' ')continue;
+    if (name[i] == ' ')continue;
     if (i == 8) 
     {
       *pos++='.';
     }
-    *pos++=p.name[i];
+    *pos++=name[i];
   }
   *pos++=0;
   return buffer;
 }
 
+// the entries the menu shows: G-code files, no ~ backups, and subdirectories, nothing deleted or hidden
+static bool lsListed(const dir_t &p)
+{
+  if (p.name[0] == DIR_NAME_DELETED || p.name[0] == '.'|| p.name[0] == '_') return false;
+  if (!DIR_IS_FILE_OR_SUBDIR(&p)) return false;
+  if (!DIR_IS_SUBDIR(&p))
+  {
+    if(p.name[8]!='G') return false;
+    if(p.name[9]=='~') return false;
+  }
+  return true;
+}
 
-void  CardReader::lsDive(const char *prepend,SdFile parent)
+// M20 part for a subdirectory of parent: its files are listed behind the path
+void CardReader::lsSubdir(const char *prepend,SdFile &parent,const uint8_t *name)
+{
+  char path[13*2];
+  char lfilename[13];
+  createFilename(lfilename,name);
+  
+  path[0]=0;
+  if(strlen(prepend)==0) //avoid leading / if already in prepend
+  {
+   strcat(path,"/");
+  }
+  strcat(path,prepend);
+  strcat(path,lfilename);
+  strcat(path,"/");
+  
+  //Serial.print(path);
+  
+  SdFile dir;
+  if(!dir.open(parent,lfilename, O_READ))
+  {
+    SERIAL_ECHO_START;
+    SERIAL_ECHOLN(MSG_SD_CANT_OPEN_SUBDIR);
+    SERIAL_ECHOLN(lfilename);
+  }
+  lsDive(path,dir);
+  //close done automatically by destructor of SdFile
+}
+
+void  CardReader::lsDive(const char *prepend,SdFile &parent)
 {
   dir_t p;
  uint8_t cnt=0;
@@ -55,58 +120,16 @@ void  CardReader::lsDive(const char *prepend,SdFile parent)
   {
     if( DIR_IS_SUBDIR(&p) && lsAction!=LS_Count && lsAction!=LS_GetFilename) // hence LS_SerialPrint
     {
-
-      char path[13*2];
-      char lfilename[13];
-      createFilename(lfilename,p);
-      
-      path[0]=0;
-      if(strlen(prepend)==0) //avoid leading / if already in prepend
-      {
-       strcat(path,"/");
-      }
-      strcat(path,prepend);
-      strcat(path,lfilename);
-      strcat(path,"/");
-      
-      //Serial.print(path);
-      
-      SdFile dir;
-      if(!dir.open(parent,lfilename, O_READ))
-      {
-        if(lsAction==LS_SerialPrint)
-        {
-          SERIAL_ECHO_START;
-          SERIAL_ECHOLN(MSG_SD_CANT_OPEN_SUBDIR);
-          SERIAL_ECHOLN(lfilename);
-        }
-      }
-      lsDive(path,dir);
-      //close done automatically by destructor of SdFile
-
-      
+      lsSubdir(prepend,parent,p.name);
     }
     else
     {
       if (p.name[0] == DIR_NAME_FREE) break;
-      if (p.name[0] == DIR_NAME_DELETED || p.name[0] == '.'|| p.name[0] == '_') continue;
-      if ( p.name[0] == '.')
-      {
-        if ( p.name[1] != '.')
-        continue;
-      }
-      
-      if (!DIR_IS_FILE_OR_SUBDIR(&p)) continue;
+      if (!lsListed(p)) continue;
       filenameIsDir=DIR_IS_SUBDIR(&p);
       
-      
-      if(!filenameIsDir)
-      {
-        if(p.name[8]!='G') continue;
-        if(p.name[9]=='~') continue;
-      }
       //if(cnt++!=nr) continue;
-      createFilename(filename,p);
+      createFilename(filename,p.name);
       if(lsAction==LS_SerialPrint)
       {
         SERIAL_PROTOCOL(prepend);
@@ -133,14 +156,64 @@ void CardReader::ls()
   if(lsAction==LS_Count)
   nrFiles=0;
 
+#ifdef SD_DIR_CACHE
+  if(workDir.isRoot() && dircacheUsable())
+  {
+    for(uint8_t i=0;i<dircacheCount;i++)
+    {
+      if(dircache[i].flags&DC_DIR)
+        lsSubdir("",root,dircache[i].name);
+      else
+        SERIAL_PROTOCOLLN(createFilename(filename,dircache[i].name));
+    }
+    return;
+  }
+#endif
   root.rewind();
   lsDive("",root);
 }
 
+#ifdef SD_DIR_CACHE
+// Reads workDir into the cache unless that is already done, returns false if it doesn't fit
+bool CardReader::dircacheUsable()
+{
+  if(dircacheState==DC_EMPTY)
+  {
+    dir_t p;
+    dircacheCount=0;
+    dircacheState=DC_FILLED;
+    workDir.rewind();
+    while(workDir.readDir(p) > 0)
+    {
+      uint8_t flags=lsListed(p) ? DC_MENU : 0;
+      if(DIR_IS_SUBDIR(&p))
+        flags|=DC_DIR;
+      if(!flags)
+        continue;
+      if(dircacheCount==SD_DIR_CACHE)
+      {
+        dircacheState=DC_TOO_BIG;
+        break;
+      }
+      memcpy(dircache[dircacheCount].name,p.name,11);
+      dircache[dircacheCount].flags=flags;
+      dircacheCount++;
+    }
+  }
+  return dircacheState==DC_FILLED;
+}
+#endif //SD_DIR_CACHE
+
 
 void CardReader::initsd()
 {
+#ifdef SD_INDEX
+  indexDrop();
+#endif
   cardOK = false;
+#ifdef SD_DIR_CACHE
+  dircacheClear();
+#endif
   if(root.isOpen())
     root.close();
   if (!card.init(SPI_FULL_SPEED,SDSS))
@@ -185,17 +258,29 @@ void CardReader::setroot()
   workDir=root;
   
   curDir=&workDir;
+#ifdef SD_DIR_CACHE
+  dircacheClear();
+#endif
 }
 void CardReader::release()
 {
+#ifdef SD_INDEX
+  indexDrop();
+#endif
   sdprinting = false;
   cardOK = false;
+#ifdef SD_DIR_CACHE
+  dircacheClear();
+#endif
 }
 
 void CardReader::startFileprint()
 {
   if(cardOK)
   {
+#ifdef SD_INDEX
+    indexDrop();
+#endif
     sdprinting = true;
     
   }
@@ -215,6 +300,16 @@ void CardReader::openFile(char* name,bool read)
 {
   if(!cardOK)
     return;
+#ifdef SD_FAST_UPLOAD
+  if(uploading)
+    uploadEnd();
+#endif
+#ifdef SD_BINARY_TRANSFER
+  binaryEnd();
+#endif
+#ifdef SD_INDEX
+  indexDrop();
+#endif
   file.close();
   sdprinting = false;
   
@@ -227,12 +322,12 @@ void CardReader::openFile(char* name,bool read)
   if(name[0]=='/')
   {
     dirname_start=strchr(name,'/')+1;
-    while(dirname_start>0)
+    while(dirname_start)
     {
       dirname_end=strchr(dirname_start,'/');
       //SERIAL_ECHO("start:");SERIAL_ECHOLN((int)(dirname_start-name));
       //SERIAL_ECHO("end  :");SERIAL_ECHOLN((int)(dirname_end-name));
-      if(dirname_end>0 && dirname_end>dirname_start)
+      if(dirname_end!=NULL && dirname_end>dirname_start)
       {
         char subdirname[13];
         strncpy(subdirname, dirname_start, dirname_end-dirname_start);
@@ -270,11 +365,29 @@ void CardReader::openFile(char* name,bool read)
     if (file.open(curDir, fname, O_READ)) 
     {
       filesize = file.fileSize();
+      file.mapExtents(&extents);
+#ifdef SD_INDEX
+      fileDir = *curDir;
+#endif
       SERIAL_PROTOCOLPGM(MSG_SD_FILE_OPENED);
       SERIAL_PROTOCOL(fname);
       SERIAL_PROTOCOLPGM(MSG_SD_SIZE);
       SERIAL_PROTOCOLLN(filesize);
       sdpos = 0;
+#ifdef SD_GCB
+      // pre-parsed files are known by their header, whatever they are called
+      char header[4];
+      gcb = file.read(header, 4) == 4 && memcmp(header, "GCB\1", 4) == 0;
+      for(uint8_t i=0;i<NUM_AXIS;i++)
+        gcb_last[i] = 0;
+      if(gcb)
+        sdpos = 4;
+      file.seekSet(sdpos);
+#endif
+#ifdef SD_READAHEAD
+      ra_pos = sdpos;
+      readaheadClear();
+#endif
       
       SERIAL_PROTOCOLLNPGM(MSG_SD_FILE_SELECTED);
       LCD_MESSAGE(fname);
@@ -288,6 +401,12 @@ void CardReader::openFile(char* name,bool read)
   }
   else 
   { //write
+#ifdef SD_GCB
+    gcb = false;
+#endif
+#ifdef SD_DIR_CACHE
+    dircacheClear(); // the file may be new
+#endif
     if (!file.open(curDir, fname, O_CREAT | O_APPEND | O_WRITE | O_TRUNC))
     {
       SERIAL_PROTOCOLPGM(MSG_SD_OPEN_FILE_FAIL);
@@ -297,6 +416,13 @@ void CardReader::openFile(char* name,bool read)
     else
     {
       saving = true;
+#ifdef SD_FAST_UPLOAD
+      // the first clusters are reserved when the first block is full
+      uploading = true;
+      up_len = 0;
+      up_block = up_end = 0;
+      up_size = 0;
+#endif
       SERIAL_PROTOCOLPGM(MSG_SD_WRITE_TO_FILE);
       SERIAL_PROTOCOLLN(name);
       LCD_MESSAGE(fname);
@@ -309,6 +435,16 @@ void CardReader::removeFile(char* name)
 {
   if(!cardOK)
     return;
+#ifdef SD_FAST_UPLOAD
+  if(uploading)
+    uploadEnd();
+#endif
+#ifdef SD_BINARY_TRANSFER
+  binaryEnd();
+#endif
+#ifdef SD_INDEX
+  indexDrop();
+#endif
   file.close();
   sdprinting = false;
   
@@ -321,12 +457,12 @@ void CardReader::removeFile(char* name)
   if(name[0]=='/')
   {
     dirname_start=strchr(name,'/')+1;
-    while(dirname_start>0)
+    while(dirname_start)
     {
       dirname_end=strchr(dirname_start,'/');
       //SERIAL_ECHO("start:");SERIAL_ECHOLN((int)(dirname_start-name));
       //SERIAL_ECHO("end  :");SERIAL_ECHOLN((int)(dirname_end-name));
-      if(dirname_end>0 && dirname_end>dirname_start)
+      if(dirname_end!=NULL && dirname_end>dirname_start)
       {
         char subdirname[13];
         strncpy(subdirname, dirname_start, dirname_end-dirname_start);
@@ -361,6 +497,9 @@ void CardReader::removeFile(char* name)
   }
     if (file.remove(curDir, fname)) 
     {
+#ifdef SD_DIR_CACHE
+      dircacheClear();
+#endif
       SERIAL_PROTOCOLPGM("File deleted:");
       SERIAL_PROTOCOL(fname);
       sdpos = 0;
@@ -388,20 +527,19 @@ void CardReader::getStatus()
 }
 void CardReader::write_command(char *buf)
 {
-  char* begin = buf;
-  char* npos = 0;
+  // get_command() has already taken off the line number, the checksum and comments
   char* end = buf + strlen(buf) - 1;
 
   file.writeError = false;
-  if((npos = strchr(buf, 'N')) != NULL)
-  {
-    begin = strchr(npos, ' ') + 1;
-    end = strchr(npos, '*') - 1;
-  }
   end[1] = '\r';
   end[2] = '\n';
   end[3] = '\0';
-  file.write(begin);
+#ifdef SD_FAST_UPLOAD
+  if (uploading)
+    uploadWrite(buf, end + 3 - buf);
+  else
+#endif
+  file.write(buf);
   if (file.writeError)
   {
     SERIAL_ERROR_START;
@@ -462,6 +600,13 @@ void CardReader::checkautostart(bool force)
 
 void CardReader::closefile()
 {
+#ifdef SD_FAST_UPLOAD
+  if(uploading)
+    uploadEnd();
+#endif
+#ifdef SD_BINARY_TRANSFER
+  binaryEnd();
+#endif
   file.sync();
   file.close();
   saving = false; 
@@ -470,6 +615,24 @@ void CardReader::closefile()
 void CardReader::getfilename(const uint8_t nr)
 {
   curDir=&workDir;
+#ifdef SD_DIR_CACHE
+  if(dircacheUsable())
+  {
+    uint8_t n=0;
+    for(uint8_t i=0;i<dircacheCount;i++)
+    {
+      if(!(dircache[i].flags&DC_MENU))
+        continue;
+      if(n++==nr)
+      {
+        createFilename(filename,dircache[i].name);
+        filenameIsDir=dircache[i].flags&DC_DIR;
+        return;
+      }
+    }
+    return;
+  }
+#endif
   lsAction=LS_GetFilename;
   nrFiles=nr;
   curDir->rewind();
@@ -480,6 +643,16 @@ void CardReader::getfilename(const uint8_t nr)
 uint16_t CardReader::getnrfilenames()
 {
   curDir=&workDir;
+#ifdef SD_DIR_CACHE
+  if(dircacheUsable())
+  {
+    uint16_t n=0;
+    for(uint8_t i=0;i<dircacheCount;i++)
+      if(dircache[i].flags&DC_MENU)
+        n++;
+    return n;
+  }
+#endif
   lsAction=LS_Count;
   nrFiles=0;
   curDir->rewind();
@@ -508,6 +681,9 @@ void CardReader::chdir(const char * relpath)
     workDirParent=*parent;
     
     workDir=newfile;
+#ifdef SD_DIR_CACHE
+    dircacheClear();
+#endif
   }
 }
 
@@ -517,9 +693,770 @@ void CardReader::updir()
   {
     workDir=workDirParent;
     workDirParent=workDirParentParent;
+#ifdef SD_DIR_CACHE
+    dircacheClear();
+#endif
+  }
+}
+
+
+#ifdef SD_READAHEAD
+// Loads the next piece of the file into buffer i. After a seek the first read only goes to the
+// end of the block, so the following ones are whole aligned blocks, which SdBaseFile::read()
+// copies from the card straight into the buffer without going through the volume cache.
+void CardReader::fillBuffer(uint8_t i)
+{
+  uint16_t n = 512 - (file.curPosition() & 0x1FF);
+  int16_t r = file.read(ra_buf[i], n);
+  ra_len[i] = (r > 0) ? r : 0;
+}
+
+// The buffer get() reads from is used up: continue in the other one, loading it first if
+// readahead() hasn't done so yet. Returns false at the end of the file or on a read error.
+bool CardReader::nextBuffer()
+{
+  uint8_t spare = ra_cur ^ 1;
+  if(ra_len[spare] == 0)
+    fillBuffer(spare);
+  ra_len[ra_cur] = 0;
+  ra_cur = spare;
+  ra_idx = 0;
+  return ra_len[spare] != 0;
+}
+
+// Called when the main loop has time, while the command queue is full
+void CardReader::readahead()
+{
+  uint8_t spare = ra_cur ^ 1;
+  if(sdprinting && ra_len[spare] == 0 && file.curPosition() < filesize)
+    fillBuffer(spare);
+}
+
+// The next command of the file for get_command(), taken straight out of the buffers: it goes into cmd up
+// to the end of its line or a ':', while comments, blank lines and leading blanks are passed over in a
+// tight loop on the buffer instead of a get() per byte. Returns the length, 0 only when the file has
+// no more commands. A command longer than MAX_CMD_SIZE-1 is cut there, the rest comes as the next one.
+uint8_t CardReader::getCommand(char *cmd)
+{
+  uint8_t n = 0;
+  bool comment = false;
+  bool done = false;
+  while(!done)
+  {
+    if(ra_idx >= ra_len[ra_cur] && !nextBuffer())
+    {
+      sdpos = ra_pos;
+      break;
+    }
+    const uint8_t *buf = ra_buf[ra_cur];
+    const uint8_t *p = buf + ra_idx;
+    const uint8_t *end = buf + ra_len[ra_cur];
+    while(p < end)
+    {
+      if(comment)
+      {
+        while(p < end && *p != '\n' && *p != '\r')
+          p++;
+        if(p == end)
+          break;
+        comment = false;
+      }
+      uint8_t c = *p++;
+      if(c == '\n' || c == '\r' || c == ':')
+      {
+        if(n)
+        {
+          done = true;
+          break;
+        }
+      }
+      else if(c == ';')
+        comment = true;
+      else if(n || (c != ' ' && c != '\t'))
+      {
+        cmd[n++] = c;
+        if(n == MAX_CMD_SIZE - 1)
+        {
+          done = true;
+          break;
+        }
+      }
+    }
+    ra_pos += p - (buf + ra_idx);
+    ra_idx = p - buf;
+    sdpos = ra_pos - 1;
+  }
+  cmd[n] = 0;
+  return n;
+}
+#endif //SD_READAHEAD
+
+#ifdef SD_READ_BENCHMARK
+// M563: reads the file from the start through file.read(), like the print does, and reports how fast it went.
+// The read-ahead buffers are used for the data and the print position is put back afterwards.
+void CardReader::readBenchmark(uint32_t limit)
+{
+  if(!cardOK || !file.isOpen() || saving || sdprinting)
+  {
+    SERIAL_ERROR_START;
+    SERIAL_ERRORLNPGM(MSG_SD_BENCH_BUSY);
+    return;
   }
+#ifdef SD_INDEX
+  indexDrop();
+#endif
+  uint32_t resume = ra_pos;
+  uint32_t bytes = 0;
+  int16_t n = 0;
+  file.seekSet(0);
+  unsigned long start = millis();
+  while(bytes < limit && (n = file.read(ra_buf[0], 512)) > 0)
+  {
+    bytes += n;
+    if((bytes & 0x3FFF) == 0)
+      manage_heater();
+  }
+  unsigned long ms = millis() - start;
+  setIndex(resume);
+  if(n < 0)
+  {
+    SERIAL_ERROR_START;
+    SERIAL_ERRORLNPGM(MSG_SD_ERR_READ);
+    return;
+  }
+  SERIAL_ECHO_START;
+  SERIAL_ECHOPGM(MSG_SD_BENCH_READ);
+  SERIAL_ECHO(bytes);
+  SERIAL_ECHOPGM(MSG_SD_BENCH_BYTES);
+  SERIAL_ECHO(ms);
+  SERIAL_ECHOPGM(MSG_SD_BENCH_MS);
+  SERIAL_ECHO((uint32_t)(bytes * 1000.0 / (ms ? ms : 1)));
+  SERIAL_ECHOLNPGM(MSG_SD_BENCH_RATE);
 }
+#endif //SD_READ_BENCHMARK
 
+#ifdef SD_GCB
+int16_t CardReader::gcbInt()
+{
+  uint8_t lo = get();
+  return lo | ((uint16_t)(uint8_t)get() << 8);
+}
+
+long CardReader::gcbLong()
+{
+  long v = 0;
+  for(uint8_t i=0;i<32;i+=8)
+    v |= (long)(uint8_t)get() << i;
+  return v;
+}
+
+// Puts the next command of a .gcb file into the command queue entry cmd: a move as gcb_move_t, made up
+// from the changes in the record, anything else as its G-code line. Returns false at the end of the
+// file, and on a record it doesn't know, which also stops the print.
+bool CardReader::gcbNext(char *cmd)
+{
+  int16_t op = get();
+  while(op == GCB_SYNC)
+  {
+    gcb_sync = sdpos;
+    for(uint8_t i=0;i<NUM_AXIS;i++)
+      gcb_last[i] = gcbLong();
+    op = get();
+  }
+  if(op < 0)
+    return false;
+  if(op & GCB_MOVE_OP)
+  {
+    gcb_move_t *move = (gcb_move_t*)cmd;
+    move->marker = GCB_MOVE;
+    move->seen = op & (0x0F|GCB_F);
+    for(uint8_t i=0;i<NUM_AXIS;i++)
+    {
+      if(!(op & (1<<i)))
+        continue;
+      if(op & GCB_WIDE)
+        gcb_last[i] += gcbLong();
+      else
+        gcb_last[i] += gcbInt();
+      move->value[i] = gcb_last[i] * (i == E_AXIS ? GCB_E_UNIT : GCB_XYZ_UNIT);
+    }
+    if(op & GCB_F)
+      move->feedrate = (uint16_t)gcbInt();
+    return true;
+  }
+  if(op == GCB_LINE)
+  {
+    uint8_t n = 0;
+    int16_t c;
+    while((c = get()) > 0)
+      if(n < MAX_CMD_SIZE - 1 && (n || c > ' ')) // so it can't look like a move
+        cmd[n++] = c;
+    cmd[n] = 0;
+    return true;
+  }
+  SERIAL_ERROR_START;
+  SERIAL_ERRORPGM(MSG_GCB_BAD_RECORD);
+  SERIAL_ERRORLN(sdpos);
+  sdprinting = false;
+  return false;
+}
+#endif //SD_GCB
+
+#ifdef SD_INDEX
+// <name>.IDX, in fileDir
+void CardReader::indexName(char *name)
+{
+  file.getFilename(name);
+  char *dot = strchr(name, '.');
+  if(dot == NULL)
+    dot = name + strlen(name);
+  strcpy(dot, ".IDX");
+}
+
+// Opens the index of the file and checks that it was finished for this very file
+bool CardReader::indexOpen(SdFile &ix,IndexHeader &header)
+{
+  char name[13];
+  indexName(name);
+  if(!ix.open(&fileDir, name, O_READ))
+    return false;
+  if(ix.read(&header, sizeof(header)) == sizeof(header) && memcmp(header.magic, "GIX\1", 4) == 0 &&
+     header.size == filesize && header.cluster == file.firstCluster())
+    return true;
+  ix.close();
+  return false;
+}
+
+// M561: starts indexing the selected file, indexIdle() does the work
+void CardReader::indexStart()
+{
+  if(!cardOK || !file.isOpen() || saving || sdprinting)
+  {
+    SERIAL_ERROR_START;
+    SERIAL_ERRORLNPGM(MSG_SD_INDEX_BUSY);
+    return;
+  }
+  indexDrop(); // M561 again starts over
+  char name[13];
+  indexName(name);
+  IndexHeader header = {{'G','I','X',1}, 0, 0, 0};
+  if(!ixFile.open(&fileDir, name, O_CREAT | O_WRITE | O_TRUNC) || ixFile.write(&header, sizeof(header)) != sizeof(header))
+  {
+    ixFile.close();
+    SERIAL_PROTOCOLPGM(MSG_SD_OPEN_FILE_FAIL);
+    SERIAL_PROTOCOL(name);
+    SERIAL_PROTOCOLLNPGM(".");
+    return;
+  }
+#ifdef SD_DIR_CACHE
+  dircacheClear(); // the index may be new
+#endif
+#ifdef SD_READAHEAD
+  ix_resume = ra_pos;
+#else
+  ix_resume = file.curPosition();
+#endif
+#ifdef SD_GCB
+  memcpy(ix_gcb_last, gcb_last, sizeof(gcb_last));
+  gcb_sync = 4;
+#endif
+  setIndex(indexFileStart());
+  ix_active = true;
+  ix_pending = false;
+  ix_line = 0;
+  ix_next = SD_INDEX_LINES;
+  ix_entries = 0;
+  ix_layer = 0;
+  ix_z = 0;
+  ix_layer_z = -1;
+}
+
+// Appends an entry with the current layer and Z. False when it couldn't be written.
+bool CardReader::indexEntry(uint32_t pos,uint32_t line)
+{
+  IndexEntry e = {pos, line, ix_layer, ix_z};
+  if(ixFile.write(&e, sizeof(e)) != sizeof(e))
+  {
+    SERIAL_ERROR_START;
+    SERIAL_ERRORLNPGM(MSG_SD_ERR_WRITE_TO_FILE);
+    indexDrop();
+    return false;
+  }
+  ix_entries++;
+  return true;
+}
+
+// A G0/G1 at pos. A change of Z makes it a candidate for a layer start, which it becomes when something
+// extrudes before Z changes again, and only above the last layer: a Z hop comes back down before the
+// extruder primes, and a purge line under the first layer stays part of it.
+void CardReader::indexMove(uint32_t pos,bool zSeen,long z,bool eSeen)
+{
+  if(zSeen && z != ix_z)
+  {
+    ix_z = z;
+    ix_cand.pos = pos;
+    ix_cand.line = ix_line;
+    ix_pending = true;
+  }
+  if(eSeen && ix_pending)
+  {
+    ix_pending = false;
+    if(ix_z > ix_layer_z)
+    {
+      ix_layer++;
+      ix_layer_z = ix_z;
+      indexEntry(ix_cand.pos, ix_cand.line);
+    }
+  }
+}
+
+// A G-code line for the index: G0/G1 go to indexMove(), G92 Z sets the height without a move and
+// starts the layer count over from there. The G has to start the line, behind a line number.
+void CardReader::indexCommand(uint32_t pos,const char *line)
+{
+  while(*line == ' ' || *line == '\t')
+    line++;
+  if(*line == 'N')
+  {
+    line++;
+    while(*line == '-' || (*line >= '0' && *line <= '9'))
+      line++;
+    while(*line == ' ' || *line == '\t')
+      line++;
+  }
+  if(*line != 'G')
+    return;
+  long code = fixp_parse_long(line + 1);
+  const char *z = strchr(line, 'Z');
+  long zv = z ? fixp_parse(z + 1, 3) : 0; // 1/1000 mm, slicers don't write more decimals
+  if(code == 0 || code == 1)
+    indexMove(pos, z != NULL, zv, strchr(line, 'E') != NULL);
+  else if(code == 92 && z != NULL)
+  {
+    ix_z = zv;
+    ix_pending = false;
+    if(ix_layer_z > zv)
+      ix_layer_z = zv;
+  }
+}
+
+// Called from the main loop, reads about a block of the file per call while M561 is running
+void CardReader::indexIdle()
+{
+  if(!ix_active)
+    return;
+  uint32_t end = sdpos + 512;
+  while(ix_active && sdpos < end)
+  {
+    char line[MAX_CMD_SIZE];
+#ifdef SD_GCB
+    if(gcb)
+    {
+      // only the sync records can be started from, so there are no entries between layers
+      if(!gcbNext(line))
+      {
+        if(eof())
+          indexFinish();
+        else
+          indexDrop();
+        return;
+      }
+      ix_line++;
+      const gcb_move_t *move = (const gcb_move_t*)line;
+      if(move->marker == GCB_MOVE)
+        indexMove(gcb_sync, move->seen & (1<<Z_AXIS), gcb_last[Z_AXIS], move->seen & (1<<E_AXIS));
+      else
+        indexCommand(gcb_sync, line);
+      continue;
+    }
+#endif
+    // a line without its comment, looked at the way process_commands() would
+    uint8_t n = 0;
+    bool comment = false;
+    int16_t c = get();
+    uint32_t pos = sdpos;
+    while(c >= 0 && c != '\n')
+    {
+      if(c == ';')
+        comment = true;
+      if(!comment && n < MAX_CMD_SIZE - 1)
+        line[n++] = c;
+      c = get();
+    }
+    line[n] = 0;
+    if(c >= 0 || n > 0)
+    {
+      ix_line++;
+      if(!ix_pending && ix_line >= ix_next)
+      {
+        ix_next = ix_line + SD_INDEX_LINES;
+        if(!indexEntry(pos, ix_line))
+          return;
+      }
+      indexCommand(pos, line);
+    }
+    if(c < 0 && ix_active)
+    {
+      indexFinish();
+      return;
+    }
+  }
+}
+
+// The end of the file: the header is filled in, which makes the index valid
+void CardReader::indexFinish()
+{
+  IndexHeader header = {{'G','I','X',1}, filesize, file.firstCluster(), ix_line};
+  if(!ixFile.seekSet(0) || ixFile.write(&header, sizeof(header)) != sizeof(header) || !ixFile.close())
+  {
+    SERIAL_ERROR_START;
+    SERIAL_ERRORLNPGM(MSG_SD_ERR_WRITE_TO_FILE);
+    indexDrop();
+    return;
+  }
+  ix_active = false;
+  setIndex(ix_resume);
+#ifdef SD_GCB
+  memcpy(gcb_last, ix_gcb_last, sizeof(gcb_last));
+#endif
+  SERIAL_ECHO_START;
+  SERIAL_ECHOPGM(MSG_SD_INDEX_DONE);
+  SERIAL_ECHO(ix_layer);
+  SERIAL_ECHOPGM(MSG_SD_INDEX_ENTRIES);
+  SERIAL_ECHOLN(ix_entries);
+}
+
+// Gives up on an index that is being made. The header stays empty, so M562 won't take it.
+void CardReader::indexDrop()
+{
+  if(!ix_active)
+    return;
+  ix_active = false;
+  ixFile.close();
+  setIndex(ix_resume);
+#ifdef SD_GCB
+  memcpy(gcb_last, ix_gcb_last, sizeof(gcb_last));
+#endif
+  SERIAL_ECHO_START;
+  SERIAL_ECHOLNPGM(MSG_SD_INDEX_DROPPED);
+}
+
+// M562: moves the print position to the start of a layer, the first layer at or above a height, or a line.
+// A line is found from the entry before it by reading on; in a .gcb file it is the layer start before it.
+void CardReader::indexSeek(uint8_t by,long target)
+{
+  if(!cardOK || !file.isOpen() || saving || sdprinting || ix_active)
+  {
+    SERIAL_ERROR_START;
+    SERIAL_ERRORLNPGM(MSG_SD_INDEX_BUSY);
+    return;
+  }
+  SdFile ix;
+  IndexHeader header;
+  if(!indexOpen(ix, header))
+  {
+    SERIAL_ERROR_START;
+    SERIAL_ERRORLNPGM(MSG_SD_INDEX_MISSING);
+    return;
+  }
+  IndexEntry e;
+  IndexEntry found = {indexFileStart(), 1, 0, 0};
+  bool ok = by == IX_LINE && target >= 1 && (uint32_t)target <= header.lines;
+  uint16_t layer = 0;
+  while(ix.read(&e, sizeof(e)) == sizeof(e))
+  {
+    bool start = e.layer != layer; // the first entry of a layer is its start
+    layer = e.layer;
+    if(by == IX_LINE)
+    {
+      if(e.line > (uint32_t)target)
+        break;
+      found = e;
+    }
+    else if(start && (by == IX_LAYER ? e.layer == target : e.z >= target))
+    {
+      found = e;
+      ok = true;
+      break;
+    }
+  }
+  ix.close();
+  if(!ok)
+  {
+    SERIAL_ERROR_START;
+    SERIAL_ERRORLNPGM(MSG_SD_INDEX_NOT_FOUND);
+    return;
+  }
+  setIndex(found.pos);
+#ifdef SD_GCB
+  for(uint8_t i=0;i<NUM_AXIS;i++)
+    gcb_last[i] = 0; // until the sync record at found.pos
+  if(!gcb)
+#endif
+  while(by == IX_LINE && found.line < (uint32_t)target)
+  {
+    int16_t c;
+    while((c = get()) >= 0 && c != '\n')
+      ;
+    found.pos = sdpos + 1;
+    found.line++;
+  }
+  SERIAL_PROTOCOLPGM(MSG_SD_INDEX_SEEK);
+  SERIAL_PROTOCOL(found.layer);
+  SERIAL_PROTOCOLPGM(MSG_SD_INDEX_Z);
+  SERIAL_PROTOCOL_F(found.z / 1000.0, 3);
+  SERIAL_PROTOCOLPGM(MSG_SD_INDEX_LINE);
+  SERIAL_PROTOCOL(found.line);
+  SERIAL_PROTOCOLPGM(MSG_SD_INDEX_BYTE);
+  SERIAL_PROTOCOLLN(found.pos);
+}
+#endif //SD_INDEX
+
+#ifdef SD_FAST_UPLOAD
+// Appends n bytes of the upload to ra_buf[0] and writes it out each time it is full. When the
+// reserved blocks are used up, the next SD_UPLOAD_RESERVE bytes are reserved; if the card has
+// no contiguous space for them, the rest of the upload goes through file.write().
+void CardReader::uploadWrite(const char *buf, uint16_t n)
+{
+  while(n)
+  {
+    uint16_t k = 512 - up_len;
+    if(k > n)
+      k = n;
+    memcpy(ra_buf[0] + up_len, buf, k);
+    up_len += k;
+    buf += k;
+    n -= k;
+    if(up_len < 512)
+      break;
+    if(up_block == up_end)
+    {
+      uint32_t count;
+      if(!file.reserveContiguous(SD_UPLOAD_RESERVE, &up_block, &count))
+      {
+        uploadEnd();
+        if(n)
+          file.write(buf, n);
+        return;
+      }
+      up_end = up_block + count;
+    }
+    if(!card.writeBlockStream(up_block, ra_buf[0], up_end - up_block))
+    {
+      file.writeError = true;
+      return;
+    }
+    up_block++;
+    up_size += 512;
+    up_len = 0;
+  }
+}
+
+// Stops the multiple block write, cuts the file to the written length, which gives the unused
+// reserved clusters back and writes the FAT and the directory entry, and adds the partial last block.
+void CardReader::uploadEnd()
+{
+  uploading = false;
+  if(!card.writeStreamStop() || !file.truncate(up_size))
+  {
+    SERIAL_ERROR_START;
+    SERIAL_ERRORLNPGM(MSG_SD_ERR_WRITE_TO_FILE);
+  }
+  if(up_len)
+    file.write(ra_buf[0], up_len);
+}
+#endif //SD_FAST_UPLOAD
+
+#ifdef SD_BINARY_TRANSFER
+// Every frame the host may send ahead of the acks has to fit into the receive ring together, so none is
+// lost while the main loop is held up by an SD write, there is no flow control.
+#define BINARY_WINDOW ((RX_BUFFER_SIZE - 1) / (BINARY_FRAME_SIZE + 6))
+#define BINARY_ABORT 0xFFFF // length of the frame that ends the transfer early, it has no data
+#if BINARY_FRAME_SIZE > 512
+  #error BINARY_FRAME_SIZE is at most 512, the frames are collected in ra_buf[1]
+#endif
+#if BINARY_WINDOW < 1
+  #error BINARY_FRAME_SIZE + 6 has to fit into the RX_BUFFER_SIZE of MarlinSerial.h
+#endif
+
+// M560: opens the file like M28, but its data comes from port as frames through binaryByte()
+void CardReader::binaryStart(char* name,uint8_t port)
+{
+  openFile(name,false);
+  if(!saving)
+    return;
+  saving = false; // no command lines go to the file
+  bt_port = port;
+  binaryMode(BT_FRAMES);
+  bt_state = BT_SYNC;
+  bt_seq = 0;
+  bt_nak = false;
+  bt_timeouts = 0;
+  bt_millis = millis();
+  SERIAL_PROTOCOLPGM(MSG_BT_READY);
+  SERIAL_PROTOCOL(BINARY_FRAME_SIZE);
+  SERIAL_PROTOCOLPGM(MSG_BT_WINDOW);
+  SERIAL_PROTOCOLLN(BINARY_WINDOW);
+}
+
+// Takes the next byte of the frame coming in. Bytes in front of a frame's 0xA5 are skipped.
+void CardReader::binaryByte(uint8_t c)
+{
+  bt_millis = millis();
+  switch(bt_state)
+  {
+  case BT_SYNC:
+    if(c == 0xA5)
+    {
+      bt_crc = 0;
+      bt_state = BT_SEQ;
+    }
+    return;
+  case BT_SEQ:
+    bt_fseq = c;
+    bt_state = BT_LEN0;
+    break;
+  case BT_LEN0:
+    bt_len = c;
+    bt_state = BT_LEN1;
+    break;
+  case BT_LEN1:
+    bt_len |= c << 8;
+    if(bt_len > BINARY_FRAME_SIZE && bt_len != BINARY_ABORT) // a broken length, look for the next frame
+    {
+      bt_state = BT_SYNC;
+      binaryResend();
+      return;
+    }
+    bt_idx = 0;
+    bt_state = bt_len && bt_len != BINARY_ABORT ? BT_DATA : BT_CRC0;
+    break;
+  case BT_DATA:
+    ra_buf[1][bt_idx++] = c;
+    if(bt_idx == bt_len)
+      bt_state = BT_CRC0;
+    break;
+  case BT_CRC0:
+    bt_rxcrc = c;
+    bt_state = BT_CRC1;
+    return;
+  case BT_CRC1:
+    bt_rxcrc |= c << 8;
+    bt_state = BT_SYNC;
+    binaryFrame();
+    return;
+  }
+  bt_crc = _crc_xmodem_update(bt_crc, c);
+}
+
+// A frame is complete: write it if it is the expected one and intact, else ask for that one again
+void CardReader::binaryFrame()
+{
+  if(bt_len == BINARY_ABORT && bt_rxcrc == bt_crc) // the host gives up, whatever frame it was at
+  {
+    if(bt_mode == BT_FRAMES)
+      closefile();
+    binaryMode(BT_OFF);
+    return;
+  }
+  if(bt_mode == BT_DISCARD)
+    return;
+  if(bt_rxcrc != bt_crc || bt_fseq != bt_seq)
+  {
+    binaryResend();
+    return;
+  }
+  bt_nak = false;
+  bt_timeouts = 0;
+  if(bt_len)
+  {
+    file.writeError = false;
+    if(uploading)
+      uploadWrite((const char*)ra_buf[1], bt_len);
+    else
+      file.write(ra_buf[1], bt_len);
+    if(file.writeError)
+    {
+      SERIAL_ERROR_START;
+      SERIAL_ERRORLNPGM(MSG_SD_ERR_WRITE_TO_FILE);
+      binaryDiscard();
+      return;
+    }
+  }
+  else
+    binaryMode(BT_DONE); // back to lines, M29 closes the file
+  SERIAL_PROTOCOLPGM(MSG_BT_ACK);
+  SERIAL_PROTOCOLLN((int)bt_seq);
+  bt_seq++;
+}
+
+// While the frames come in, the real-time commands leave the bytes of the port alone
+void CardReader::binaryMode(uint8_t mode)
+{
+  bt_mode = mode;
+#ifdef REALTIME_COMMANDS
+  if(mode == BT_FRAMES || mode == BT_DISCARD)
+    rt_binary_ports |= 1 << bt_port;
+  else
+    rt_binary_ports = 0;
+#endif
+}
+
+// The file of the transfer is closed, or another one opened: no more frames go to it. A discard goes on,
+// the frames still in flight don't care about the file.
+void CardReader::binaryEnd()
+{
+  if(bt_mode != BT_DISCARD)
+    binaryMode(BT_OFF);
+}
+
+// The transfer failed: the file is closed at what was written, but the frames the host still has
+// in flight are G-code text, which must not reach the line parser as commands. The port stays with
+// binaryByte() until the host sends the abort frame or has been quiet for BINARY_TIMEOUT.
+void CardReader::binaryDiscard()
+{
+  closefile();
+  binaryMode(BT_DISCARD);
+  bt_state = BT_SYNC;
+  bt_millis = millis();
+}
+
+// Frames behind a lost one are dropped until it comes again, one request is enough for them all
+void CardReader::binaryResend()
+{
+  if(bt_nak || bt_mode == BT_DISCARD)
+    return;
+  bt_nak = true;
+  SERIAL_PROTOCOLPGM(MSG_BT_RESEND);
+  SERIAL_PROTOCOLLN((int)bt_seq);
+}
+
+// Called from get_command() after the bytes of the port are taken: when the host has gone quiet
+// the frame or the ack it waits for got lost, ask again. A host that doesn't answer at all ends
+// the transfer, with the file closed at what has arrived. After a failed transfer the same quiet
+// gives the port back to the command lines.
+void CardReader::binaryIdle()
+{
+  if(!binaryActive() || millis() - bt_millis < BINARY_TIMEOUT)
+    return;
+  bt_millis = millis();
+  bt_state = BT_SYNC;
+  if(bt_mode == BT_DISCARD)
+  {
+    binaryMode(BT_OFF);
+    return;
+  }
+  if(++bt_timeouts >= 10)
+  {
+    SERIAL_ERROR_START;
+    SERIAL_ERRORLNPGM(MSG_BT_TIMEOUT);
+    binaryDiscard();
+    return;
+  }
+  bt_nak = false;
+  binaryResend();
+}
+#endif //SD_BINARY_TRANSFER
 
 void CardReader::printingHasFinished()
 {
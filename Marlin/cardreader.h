@@ -4,6 +4,38 @@
 #ifdef SDSUPPORT
 
 #include "SdFile.h"
+
+#if defined(SD_FAST_UPLOAD) && !defined(SD_READAHEAD)
+  #error SD_FAST_UPLOAD collects the upload in the SD_READAHEAD buffers
+#endif
+#if defined(SD_BINARY_TRANSFER) && !defined(SD_FAST_UPLOAD)
+  #error SD_BINARY_TRANSFER writes through SD_FAST_UPLOAD
+#endif
+#if defined(SD_READ_BENCHMARK) && !defined(SD_READAHEAD)
+  #error SD_READ_BENCHMARK reads into the SD_READAHEAD buffers
+#endif
+
+#ifdef SD_GCB
+// Records of a .gcb file, after the "GCB\1" header. Values are little endian.
+#define GCB_LINE  0x01  // a G-code line follows, 0 terminated
+#define GCB_SYNC  0x02  // the absolute X, Y, Z and E word values follow, long each
+#define GCB_MOVE_OP 0x80  // G0/G1: bits 0-3 X Y Z E present as a change from the last value of that word,
+#define GCB_F     0x10  //   then F present as unsigned int mm/min,
+#define GCB_WIDE  0x20  //   the changes are long instead of int
+#define GCB_XYZ_UNIT 0.001   // mm per unit of X, Y and Z
+#define GCB_E_UNIT   0.0001  // mm per unit of E
+
+// A decoded move in the command queue, where process_commands() would find the text of a command
+#define GCB_MOVE  0x01  // the first byte, gcbNext() drops control bytes in front of a line
+struct gcb_move_t
+{
+  char marker;            // GCB_MOVE
+  uint8_t seen;           // bit i: axis i has a value, GCB_F: the feedrate has
+  float value[NUM_AXIS];  // what code_value() would give for the axis word
+  float feedrate;
+};
+#endif
+
 enum LsAction {LS_SerialPrint,LS_Count,LS_GetFilename};
 class CardReader
 {
@@ -36,8 +68,45 @@ public:
 
 
   FORCE_INLINE bool eof() { return sdpos>=filesize ;};
+#ifdef SD_READAHEAD
+  // sdpos is the position of the byte returned last, as with file.read()
+  FORCE_INLINE int16_t get() {
+    sdpos = ra_pos;
+    if(ra_idx >= ra_len[ra_cur] && !nextBuffer())
+      return -1;
+    ra_pos++;
+    return ra_buf[ra_cur][ra_idx++];
+  };
+  FORCE_INLINE void setIndex(long index) {sdpos = ra_pos = index;file.seekSet(index);readaheadClear();};
+  void readahead();
+  uint8_t getCommand(char *cmd);
+#else
   FORCE_INLINE int16_t get() {  sdpos = file.curPosition();return (int16_t)file.read();};
   FORCE_INLINE void setIndex(long index) {sdpos = index;file.seekSet(index);};
+#endif
+#ifdef SD_BINARY_TRANSFER
+  void binaryStart(char* name,uint8_t port);
+  void binaryByte(uint8_t c);
+  void binaryIdle();
+  FORCE_INLINE bool binaryActive() {return bt_mode==BT_FRAMES || bt_mode==BT_DISCARD;};
+  FORCE_INLINE bool binaryDone() {return bt_mode==BT_DONE;};
+  FORCE_INLINE uint8_t binaryPort() {return bt_port;};
+#endif
+#ifdef SD_GCB
+  FORCE_INLINE bool isGcb() {return gcb;};
+  bool gcbNext(char *cmd);
+#endif
+#ifdef SD_INDEX
+  enum {IX_LAYER,IX_Z,IX_LINE}; // what indexSeek() looks for: a layer number, a height in 1/1000 mm, a line
+  void indexStart();
+  void indexIdle();
+  void indexSeek(uint8_t by,long target);
+#endif
+#ifdef SD_READ_BENCHMARK
+  void readBenchmark(uint32_t limit);
+#endif
+  FORCE_INLINE uint32_t getIndex() {return sdpos;};
+  FORCE_INLINE uint32_t getFileSize() {return filesize;};
   FORCE_INLINE uint8_t percentDone(){if(!sdprinting) return 0; if(filesize) return sdpos*100/filesize; else return 0;};
   FORCE_INLINE char* getWorkDirName(){workDir.getFilename(filename);return filename;};
 
@@ -53,6 +122,7 @@ private:
   Sd2Card card;
   SdVolume volume;
   SdFile file;
+  SdExtentMap extents; //cluster map of the file being printed, so reads and M26 don't go through the FAT
   uint32_t filesize;
   //int16_t n;
   unsigned long autostart_atmillis;
@@ -63,7 +133,126 @@ private:
   LsAction lsAction; //stored for recursion.
   int16_t nrFiles; //counter for the files in the current directory and recycled as position counter for getting the nrFiles'th name in the directory.
   char* diveDirName;
-  void lsDive(const char *prepend,SdFile parent);
+  void lsDive(const char *prepend,SdFile &parent);
+  void lsSubdir(const char *prepend,SdFile &parent,const uint8_t *name);
+#ifdef SD_DIR_CACHE
+  // The entries of workDir that getnrfilenames(), getfilename() and, when it is the root, ls() show.
+  // Read on first use and dropped by anything that changes the directory or the card. A directory
+  // with more than SD_DIR_CACHE entries is read from the card as before.
+  enum {DC_EMPTY,DC_FILLED,DC_TOO_BIG};
+  enum {DC_MENU=1,DC_DIR=2}; // listed in the menu, subdirectory (ls() goes into all of those)
+  struct DirCacheEntry
+  {
+    uint8_t name[11]; // blank padded, as in dir_t
+    uint8_t flags;
+  };
+  DirCacheEntry dircache[SD_DIR_CACHE];
+  uint8_t dircacheCount;
+  uint8_t dircacheState;
+  bool dircacheUsable();
+  FORCE_INLINE void dircacheClear() {dircacheState=DC_EMPTY;};
+#endif
+
+#ifdef SD_READAHEAD
+  // The printed file is read a block at a time into two buffers: get() takes bytes out of
+  // ra_buf[ra_cur] while readahead() loads the other one from the card.
+  uint8_t ra_buf[2][512];
+  uint16_t ra_len[2];   // bytes in each buffer, 0 when it is empty
+  uint8_t ra_cur;       // the buffer get() reads from
+  uint16_t ra_idx;      // next byte in it
+  uint32_t ra_pos;      // file position of that byte
+  void fillBuffer(uint8_t i);
+  bool nextBuffer();
+  FORCE_INLINE void readaheadClear() {ra_len[0]=ra_len[1]=0;ra_idx=0;};
+#endif
+#ifdef SD_GCB
+  bool gcb;                  // the file open for printing is a .gcb, get_command() takes it with gcbNext()
+  long gcb_last[NUM_AXIS];   // last value of each axis word, in GCB units
+  uint32_t gcb_sync;         // position of the last sync record read
+  int16_t gcbInt();
+  long gcbLong();
+#endif
+#ifdef SD_INDEX
+  // M561 reads the file from the start in indexIdle() and appends an IndexEntry to ixFile for every
+  // layer start and every SD_INDEX_LINES lines. The header gets the file's size, first cluster and
+  // line count only when the end is reached, so an index that wasn't finished never matches.
+  struct IndexHeader
+  {
+    char magic[4];      // "GIX\1"
+    uint32_t size;
+    uint32_t cluster;
+    uint32_t lines;
+  };
+  struct IndexEntry
+  {
+    uint32_t pos;       // file position of the line, in a .gcb file of the sync record
+    uint32_t line;      // its line number, in a .gcb file the number of the command
+    uint16_t layer;     // 0 before the first layer
+    long z;             // in 1/1000 mm
+  };
+  SdFile fileDir;       // the directory of the file open for printing, where the index goes
+  SdFile ixFile;
+  bool ix_active;
+  bool ix_pending;      // Z has changed since the last layer start, ix_cand is where
+  IndexEntry ix_cand;
+  uint32_t ix_resume;   // where the print goes on when the index is done
+#ifdef SD_GCB
+  long ix_gcb_last[NUM_AXIS];
+#endif
+  uint32_t ix_line;     // lines read
+  uint32_t ix_next;     // the next line that gets an entry without being a layer start
+  uint32_t ix_entries;
+  uint16_t ix_layer;
+  long ix_z;            // the last Z, in 1/1000 mm
+  long ix_layer_z;      // Z of the last layer start
+  FORCE_INLINE uint32_t indexFileStart() {
+#ifdef SD_GCB
+    if(gcb) return 4;
+#endif
+    return 0;
+  };
+  void indexName(char *name);
+  bool indexOpen(SdFile &ix,IndexHeader &header);
+  void indexMove(uint32_t pos,bool zSeen,long z,bool eSeen);
+  void indexCommand(uint32_t pos,const char *line);
+  bool indexEntry(uint32_t pos,uint32_t line);
+  void indexFinish();
+  void indexDrop();
+#endif
+#ifdef SD_FAST_UPLOAD
+  // While uploading, write_command() fills ra_buf[0] and sends every full block on to the
+  // clusters reserved for the file, up_block to up_end, as one multiple block write.
+  bool uploading;
+  uint16_t up_len;      // bytes in ra_buf[0]
+  uint32_t up_block;    // card block ra_buf[0] goes to
+  uint32_t up_end;      // end of the reserved blocks
+  uint32_t up_size;     // bytes written to the reserved blocks
+  void uploadWrite(const char *buf, uint16_t n);
+  void uploadEnd();
+#endif
+#ifdef SD_BINARY_TRANSFER
+  // M560: frames from bt_port are collected in ra_buf[1] and written through uploadWrite()
+  enum {BT_OFF,BT_FRAMES,BT_DONE,BT_DISCARD};  // bt_mode, BT_DONE is the end frame received and M29 not yet,
+                                               // BT_DISCARD the transfer failed and the frames still coming are dropped
+  enum {BT_SYNC,BT_SEQ,BT_LEN0,BT_LEN1,BT_DATA,BT_CRC0,BT_CRC1};  // bt_state, the next byte of a frame
+  uint8_t bt_mode;
+  uint8_t bt_port;
+  uint8_t bt_state;
+  uint8_t bt_seq;       // the frame expected next
+  uint8_t bt_fseq;      // sequence number of the frame coming in
+  bool bt_nak;          // a resend for bt_seq is out, the frames behind it are dropped silently
+  uint8_t bt_timeouts;
+  uint16_t bt_len;
+  uint16_t bt_idx;
+  uint16_t bt_crc;      // over the frame so far
+  uint16_t bt_rxcrc;    // the frame's own
+  unsigned long bt_millis;
+  void binaryMode(uint8_t mode);
+  void binaryFrame();
+  void binaryResend();
+  void binaryEnd();
+  void binaryDiscard();
+#endif
 };
 #define IS_SD_PRINTING (card.sdprinting)
 
@@ -0,0 +1,194 @@
+/*
+  fixedpoint.cpp - decimal number parsing and formatting without soft-float
+  Part of Marlin
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "Marlin.h"
+#include "fixedpoint.h"
+
+#define FIXP_MAX_DIGITS 9 // significant digits that always fit a long
+
+static const long pow10_table[FIXP_MAX_DIGITS+1] PROGMEM = {
+  1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000
+};
+
+// largest |value| that still fits a long after scaling by 10^decimals
+static const float fits_table[FIXP_MAX_DECIMALS+1] PROGMEM = {
+  2.0e9, 2.0e8, 2.0e7, 2.0e6, 2.0e5, 2.0e4, 2.0e3
+};
+
+FORCE_INLINE long pow10l(uint8_t n)
+{
+  return (long)pgm_read_dword(&pow10_table[n]);
+}
+
+// the same set as isspace(), which strtod() and strtol() skip in front of the number
+FORCE_INLINE bool is_space(char c)
+{
+  return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+// Collects up to FIXP_MAX_DIGITS significant digits of [+-]digits[.digits] into *mantissa.
+// Returns the power of ten the mantissa has to be scaled by: negative for the collected fraction
+// digits, positive for integer digits that were dropped. On no digits *endptr is str, like strtod.
+static int8_t parse_digits(const char *str, long *mantissa, const char **endptr)
+{
+  const char *p = str;
+  unsigned long m = 0;
+  uint8_t significant = 0;
+  int8_t exponent = 0;
+  bool negative = false;
+  bool fraction = false;
+  bool any = false;
+
+  while(is_space(*p))
+    p++;
+  if(*p == '-' || *p == '+') {
+    negative = (*p == '-');
+    p++;
+  }
+  for(;; p++) {
+    char c = *p;
+    if(c == '.' && !fraction) {
+      fraction = true;
+      continue;
+    }
+    if(c < '0' || c > '9')
+      break;
+    any = true;
+    if(significant < FIXP_MAX_DIGITS) {
+      m = m*10 + (c - '0');
+      if(m != 0)
+        significant++;
+      if(fraction)
+        exponent--;
+    }
+    else if(!fraction) {
+      exponent++;
+    }
+  }
+  if(endptr)
+    *endptr = any ? p : str;
+  *mantissa = negative ? -(long)m : (long)m;
+  return exponent;
+}
+
+long fixp_parse(const char *str, uint8_t decimals, const char **endptr)
+{
+  long m;
+  int8_t exponent = parse_digits(str, &m, endptr) + decimals;
+  while(exponent > 0) {
+    m *= 10;
+    exponent--;
+  }
+  while(exponent < -FIXP_MAX_DIGITS) {
+    m /= 10;
+    exponent++;
+  }
+  if(exponent < 0)
+    m /= pow10l(-exponent);
+  return m;
+}
+
+float fixp_parse_float(const char *str, const char **endptr)
+{
+  long m;
+  int8_t exponent = parse_digits(str, &m, endptr);
+  if(exponent == 0)
+    return (float)m;
+  if(exponent > 0)
+    return (float)m * (float)pow10l(exponent);
+  while(exponent < -FIXP_MAX_DIGITS) {
+    m /= 10;
+    exponent++;
+  }
+  return (float)m / (float)pow10l(-exponent);
+}
+
+long fixp_parse_long(const char *str, const char **endptr)
+{
+  const char *p = str;
+  long v = 0;
+  bool negative = false;
+
+  while(is_space(*p))
+    p++;
+  if(*p == '-' || *p == '+') {
+    negative = (*p == '-');
+    p++;
+  }
+  const char *digits = p;
+  while(*p >= '0' && *p <= '9') {
+    v = v*10 + (*p - '0');
+    p++;
+  }
+  if(endptr)
+    *endptr = (p == digits) ? str : p;
+  return negative ? -v : v;
+}
+
+bool fixp_fits(float value, uint8_t decimals)
+{
+  if(decimals > FIXP_MAX_DECIMALS)
+    return false;
+  if(value < 0)
+    value = -value;
+  return value < pgm_read_float(&fits_table[decimals]);
+}
+
+long fixp_from_float(float value, uint8_t decimals)
+{
+  value *= (float)pow10l(decimals);
+  return (long)(value < 0 ? value - 0.5 : value + 0.5);
+}
+
+char *fixp_format(char *buf, long value, uint8_t decimals)
+{
+  char tmp[10];
+  uint8_t n = 0;
+  unsigned long v;
+
+  if(value < 0) {
+    *buf++ = '-';
+    v = -(unsigned long)value;
+  }
+  else {
+    v = value;
+  }
+  // digits come out lowest first, and there is always one in front of the point
+  do {
+    tmp[n++] = '0' + v % 10;
+    v /= 10;
+  } while(v != 0 || n <= decimals);
+  while(n > 0) {
+    if(n == decimals)
+      *buf++ = '.';
+    *buf++ = tmp[--n];
+  }
+  *buf = 0;
+  return buf;
+}
+
+void fixp_digits(char *buf, unsigned long value, uint8_t width, uint8_t decimals)
+{
+  char *p = buf + width + (decimals ? 1 : 0);
+  for(uint8_t i = 0; i < width; i++) {
+    if(decimals && i == decimals)
+      *--p = '.';
+    *--p = '0' + value % 10;
+    value /= 10;
+  }
+}
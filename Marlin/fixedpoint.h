@@ -0,0 +1,53 @@
+/*
+  fixedpoint.h - decimal number parsing and formatting without soft-float
+  Part of Marlin
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef fixedpoint_h
+#define fixedpoint_h
+
+#include <inttypes.h>
+#include <stddef.h>
+
+// Numbers are carried as a long holding value*10^decimals. The G-code parser, the serial
+// replies and the LCD all go through these, so a float is touched at most once per number.
+
+#define FIXP_MAX_DECIMALS 6
+#define FIXP_BUFSIZE 13   // "-2147483648" plus the point and the terminator
+
+// Parses [+-]digits[.digits] after optional whitespace (as isspace) and returns it scaled by 10^decimals.
+// Fraction digits beyond decimals are truncated. There is no exponent form, 'E' is an axis word.
+long fixp_parse(const char *str, uint8_t decimals, const char **endptr = NULL);
+
+// The same number as a float, with a single divide. Replaces strtod() on G-code words.
+float fixp_parse_float(const char *str, const char **endptr = NULL);
+
+// Integer part only. Replaces strtol(str, NULL, 10).
+long fixp_parse_long(const char *str, const char **endptr = NULL);
+
+// Rounds value*10^decimals to a long. Check fixp_fits() first if the range is not known.
+long fixp_from_float(float value, uint8_t decimals);
+bool fixp_fits(float value, uint8_t decimals);
+
+// Writes value/10^decimals as "-12.05" into buf (FIXP_BUFSIZE bytes) and terminates it.
+// Returns a pointer to the terminator.
+char *fixp_format(char *buf, long value, uint8_t decimals);
+
+// Writes exactly width digits of value with leading zeros, with a '.' in front of the last
+// decimals digits (so width+1 chars when decimals>0). Not terminated. Used for fixed LCD fields.
+void fixp_digits(char *buf, unsigned long value, uint8_t width, uint8_t decimals);
+
+#endif
@@ -0,0 +1,194 @@
+#!/usr/bin/python
+#
+# Converts G-code into the pre-parsed .gcb format the firmware prints from SD (SD_GCB)
+"""G-code to .gcb converter
+
+Turns a G-code file into .gcb: G0/G1 moves become an opcode and the change of each X, Y, Z and E
+word against its last value, in fixed point, so the printer queues them without parsing any text.
+Every other command stays a G-code line, without comments. The files come out at less than half
+the size of the G-code.
+
+Usage: python gcodeToGcb.py [options] input [output]
+
+Options:
+  -h, --help        show this help
+  --decode          turn a .gcb file back into G-code, to check what the printer will run
+
+The output defaults to the input with .gcb (or .gcode when decoding) as the extension.
+
+Format, all values little endian (see cardreader.h):
+  "GCB\\1"                            header
+  0x01 text 0x00                     a G-code line
+  0x02 X Y Z E (long each)           absolute word values the following changes continue from,
+                                     in front of each layer so the printer can start there (M26)
+  0x80|bits changes [F]              G0/G1: bits 0-3 X Y Z E present, 0x10 F present as unsigned
+                                     int mm/min, 0x20 the changes are long instead of int
+X, Y and Z count in 1/1000 mm, E in 1/10000 mm.
+"""
+
+from __future__ import print_function
+import getopt
+import os
+import re
+import struct
+import sys
+
+HEADER = b"GCB\x01"
+GCB_LINE = 0x01
+GCB_SYNC = 0x02
+GCB_MOVE_OP = 0x80
+GCB_F = 0x10
+GCB_WIDE = 0x20
+AXES = "XYZE"
+SCALE = [1000, 1000, 1000, 10000]
+
+MOVE = re.compile(r'G0*[01](?![0-9.])\s*(.*)$')
+WORD = re.compile(r'([A-Z])\s*([-+]?[0-9]*\.?[0-9]*)\s*')
+
+def commands(text):
+    "The commands of a G-code file the way the firmware's SD reader splits them, comments removed"
+    for line in text.splitlines():
+        for command in line.split(";", 1)[0].split(":"):
+            command = command.strip()
+            if command:
+                yield command
+
+def parse_move(command):
+    "The X Y Z E F words of a G0/G1 as a dict, None if it has anything else or isn't one"
+    m = MOVE.match(command)
+    if not m:
+        return None
+    words = {}
+    rest = m.group(1)
+    pos = 0
+    while pos < len(rest):
+        w = WORD.match(rest, pos)
+        if not w or w.group(1) not in "XYZEF" or w.group(1) in words:
+            return None
+        try:
+            words[w.group(1)] = float(w.group(2))
+        except ValueError:
+            return None
+        pos = w.end()
+    if "F" in words and not 0 <= words["F"] < 65535.5:
+        return None
+    return words
+
+class Encoder:
+    def __init__(self):
+        self.out = bytearray(HEADER)
+        self.last = [0, 0, 0, 0]
+        self.moves = 0
+        self.lines = 0
+        self.layers = []    # offsets of the sync records
+
+    def sync(self):
+        self.layers.append(len(self.out))
+        self.out += struct.pack("<B4l", GCB_SYNC, *self.last)
+
+    def line(self, command):
+        self.out += struct.pack("<B", GCB_LINE) + command.encode("ascii") + b"\0"
+        self.lines += 1
+
+    def move(self, words):
+        values = {}
+        for i, axis in enumerate(AXES):
+            if axis in words:
+                values[i] = int(round(words[axis] * SCALE[i]))
+        if not self.layers or (2 in values and values[2] != self.last[2]):
+            self.sync()
+        deltas = {}
+        for i in values:
+            deltas[i] = values[i] - self.last[i]
+            self.last[i] = values[i]
+        op = GCB_MOVE_OP
+        for i in deltas:
+            op |= 1 << i
+        wide = any(not -32768 <= d <= 32767 for d in deltas.values())
+        if wide:
+            op |= GCB_WIDE
+        if "F" in words:
+            op |= GCB_F
+        record = struct.pack("<B", op)
+        for i in sorted(deltas):
+            record += struct.pack("<l" if wide else "<h", deltas[i])
+        if "F" in words:
+            record += struct.pack("<H", int(round(words["F"])))
+        self.out += record
+        self.moves += 1
+
+def encode(text):
+    enc = Encoder()
+    for command in commands(text):
+        words = parse_move(command)
+        if words is None:
+            enc.line(command)
+        else:
+            enc.move(words)
+    return enc
+
+def decode(data):
+    "G-code text of a .gcb file, moves with the values the printer gets"
+    if data[:4] != HEADER:
+        raise SystemExit("no GCB header")
+    out = []
+    last = [0, 0, 0, 0]
+    pos = 4
+    while pos < len(data):
+        op = data[pos]
+        pos += 1
+        if op == GCB_SYNC:
+            last = list(struct.unpack_from("<4l", data, pos))
+            pos += 16
+        elif op == GCB_LINE:
+            end = data.index(b"\0", pos)
+            out.append(data[pos:end].decode("ascii"))
+            pos = end + 1
+        elif op & GCB_MOVE_OP:
+            words = ["G1"]
+            fmt, size = ("<l", 4) if op & GCB_WIDE else ("<h", 2)
+            for i, axis in enumerate(AXES):
+                if op & (1 << i):
+                    last[i] += struct.unpack_from(fmt, data, pos)[0]
+                    pos += size
+                    words.append("%s%.*f" % (axis, 4 if i == 3 else 3, last[i] / float(SCALE[i])))
+            if op & GCB_F:
+                words.append("F%d" % struct.unpack_from("<H", data, pos)[0])
+                pos += 2
+            out.append(" ".join(words))
+        else:
+            raise SystemExit("bad record 0x%02x at byte %d" % (op, pos - 1))
+    return "\n".join(out) + "\n"
+
+def main(argv):
+    decoding = False
+    try:
+        opts, args = getopt.getopt(argv, "h", ["help", "decode"])
+    except getopt.GetoptError:
+        usage()
+        sys.exit(2)
+    for opt, arg in opts:
+        if opt in ("-h", "--help"):
+            usage()
+            sys.exit()
+        elif opt == "--decode":
+            decoding = True
+    if len(args) not in (1, 2):
+        usage()
+        sys.exit(2)
+    output = args[1] if len(args) == 2 else os.path.splitext(args[0])[0] + (".gcode" if decoding else ".gcb")
+
+    data = open(args[0], "rb").read()
+    if decoding:
+        open(output, "w").write(decode(bytearray(data)))
+        return
+    enc = encode(data.decode("ascii", "replace"))
+    open(output, "wb").write(enc.out)
+    print("%d moves, %d other commands, %d layers: %d bytes of G-code to %d bytes (%.0f%%)" %
+          (enc.moves, enc.lines, len(enc.layers), len(data), len(enc.out), 100.0 * len(enc.out) / max(len(data), 1)))
+
+def usage():
+    print(__doc__)
+
+if __name__ == "__main__":
+    main(sys.argv[1:])
@@ -99,6 +99,8 @@
 	#define MSG_PREHEAT_PLA " Preheat PLA"
 	#define MSG_PREHEAT_ABS " Preheat ABS"
 	#define MSG_STEPPER_RELEASED "Released."
+	#define MSG_FEED_HOLD "Feed hold."
+	#define MSG_FEED_RESUMED "Resumed."
   #define MSG_CONTROL_RETRACT  " Retract mm:"
   #define MSG_CONTROL_RETRACTF " Retract  F:"
   #define MSG_CONTROL_RETRACT_ZLIFT " Hop mm:"
@@ -165,7 +167,29 @@
 	#define MSG_SD_PRINTING_BYTE "SD printing byte "
 	#define MSG_SD_NOT_PRINTING "Not SD printing"
 	#define MSG_SD_ERR_WRITE_TO_FILE "error writing to file"
+	#define MSG_SD_ERR_READ "error reading from file"
 	#define MSG_SD_CANT_ENTER_SUBDIR "Cannot enter subdir:"
+	#define MSG_BT_READY "Binary transfer, frame:"
+	#define MSG_BT_WINDOW " window:"
+	#define MSG_BT_ACK "ack:"
+	#define MSG_BT_RESEND "resend:"
+	#define MSG_BT_TIMEOUT "binary transfer timed out"
+	#define MSG_GCB_BAD_RECORD "bad record in .gcb file at byte "
+	#define MSG_SD_INDEX_BUSY "SD index: no file selected, or printing or writing"
+	#define MSG_SD_INDEX_DONE "SD index: layers:"
+	#define MSG_SD_INDEX_ENTRIES " entries:"
+	#define MSG_SD_INDEX_DROPPED "SD index dropped"
+	#define MSG_SD_INDEX_MISSING "SD index missing or out of date, run M561"
+	#define MSG_SD_INDEX_NOT_FOUND "SD index: no such layer or line"
+	#define MSG_SD_INDEX_SEEK "SD index: layer:"
+	#define MSG_SD_INDEX_Z " Z:"
+	#define MSG_SD_INDEX_LINE " line:"
+	#define MSG_SD_INDEX_BYTE " byte:"
+	#define MSG_SD_BENCH_BUSY "SD read benchmark: no file selected, or printing or writing"
+	#define MSG_SD_BENCH_READ "SD read: "
+	#define MSG_SD_BENCH_BYTES " bytes in "
+	#define MSG_SD_BENCH_MS " ms, "
+	#define MSG_SD_BENCH_RATE " bytes/s"
 
 	#define MSG_STEPPER_TO_HIGH "Steprate to high : "
 	#define MSG_ENDSTOPS_HIT "endstops hit: "
@@ -252,6 +276,8 @@
 	#define MSG_PREHEAT_PLA " Preheat PLA"
 	#define MSG_PREHEAT_ABS " Preheat ABS"
 	#define MSG_STEPPER_RELEASED "Released."
+	#define MSG_FEED_HOLD "Feed hold."
+	#define MSG_FEED_RESUMED "Resumed."
 	
 
 
@@ -314,7 +340,29 @@
 	#define MSG_SD_PRINTING_BYTE "SD printing byte "
 	#define MSG_SD_NOT_PRINTING "Not SD printing"
 	#define MSG_SD_ERR_WRITE_TO_FILE "error writing to file"
+	#define MSG_SD_ERR_READ "error reading from file"
 	#define MSG_SD_CANT_ENTER_SUBDIR "Cannot enter subdir:"
+	#define MSG_BT_READY "Binary transfer, frame:"
+	#define MSG_BT_WINDOW " window:"
+	#define MSG_BT_ACK "ack:"
+	#define MSG_BT_RESEND "resend:"
+	#define MSG_BT_TIMEOUT "binary transfer timed out"
+	#define MSG_GCB_BAD_RECORD "bad record in .gcb file at byte "
+	#define MSG_SD_INDEX_BUSY "SD index: no file selected, or printing or writing"
+	#define MSG_SD_INDEX_DONE "SD index: layers:"
+	#define MSG_SD_INDEX_ENTRIES " entries:"
+	#define MSG_SD_INDEX_DROPPED "SD index dropped"
+	#define MSG_SD_INDEX_MISSING "SD index missing or out of date, run M561"
+	#define MSG_SD_INDEX_NOT_FOUND "SD index: no such layer or line"
+	#define MSG_SD_INDEX_SEEK "SD index: layer:"
+	#define MSG_SD_INDEX_Z " Z:"
+	#define MSG_SD_INDEX_LINE " line:"
+	#define MSG_SD_INDEX_BYTE " byte:"
+	#define MSG_SD_BENCH_BUSY "SD read benchmark: no file selected, or printing or writing"
+	#define MSG_SD_BENCH_READ "SD read: "
+	#define MSG_SD_BENCH_BYTES " bytes in "
+	#define MSG_SD_BENCH_MS " ms, "
+	#define MSG_SD_BENCH_RATE " bytes/s"
 
 	#define MSG_STEPPER_TO_HIGH "Steprate to high : "
 	#define MSG_ENDSTOPS_HIT "endstops hit: "
@@ -413,6 +413,31 @@ void getHighESpeed()
 }
 #endif
 
+#ifdef PID_ADD_EXTRUSION_RATE
+// Highest filament speed (mm/s) among the queued moves of this extruder that also move X, Y or Z,
+// for the extrusion feed-forward of the hotend PID. Retracts and primes on their own don't count.
+float plan_e_speed(uint8_t extruder)
+{
+  float high=0.0;
+  uint8_t block_index = block_buffer_tail;
+  
+  while(block_index != block_buffer_head) {
+    block_t *block = &block_buffer[block_index];
+    if((block->active_extruder == extruder) && (block->steps_e != 0) &&
+       ((block->steps_x != 0) || (block->steps_y != 0) || (block->steps_z != 0))) {
+      float se=float(block->steps_e)*block->nominal_speed/block->millimeters;
+      //se; steps/sec;
+      if(se>high)
+      {
+        high=se;
+      }
+    }
+    block_index = (block_index+1) & (BLOCK_BUFFER_SIZE - 1);
+  }
+  return high/axis_steps_per_unit[E_AXIS];
+}
+#endif
+
 void check_axes_activity() {
   unsigned char x_active = 0;
   unsigned char y_active = 0;  
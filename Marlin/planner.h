@@ -78,6 +78,9 @@ void plan_set_e_position(const float &e);
 
 void check_axes_activity();
 uint8_t movesplanned(); //return the nr of buffered moves
+#ifdef PID_ADD_EXTRUSION_RATE
+float plan_e_speed(uint8_t extruder); // highest queued filament speed in mm/s
+#endif
 
 extern unsigned long minsegmenttime;
 extern float max_feedrate[4]; // set the max speeds
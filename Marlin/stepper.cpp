@@ -287,6 +287,12 @@ ISR(TIMER1_COMPA_vect)
   // If there is no current block, attempt to pop one from the buffer
   if (current_block == NULL) {
     // Anything in the buffer?
+    #ifdef REALTIME_COMMANDS
+      if(rt_feed_hold) {
+        OCR1A=2000; // 1kHz, keep the queued moves until the hold is released
+        return;
+      }
+    #endif
     current_block = plan_get_current_block();
     if (current_block != NULL) {
       current_block->busy = true;
@@ -32,7 +32,9 @@
 #include "Marlin.h"
 #include "ultralcd.h"
 #include "temperature.h"
+#include "planner.h"
 #include "watchdog.h"
+#include "EEPROMwrite.h"
 
 //===========================================================================
 //=============================public variables============================
@@ -48,7 +50,7 @@ int current_raw_bed = 0;
 
 #ifdef PIDTEMP
   // used external
-  float pid_setpoint[EXTRUDERS] = { 0.0 };
+  long pid_setpoint[EXTRUDERS] = { 0 }; // 1/256 degC
   
   float Kp=DEFAULT_Kp;
   float Ki=(DEFAULT_Ki*PID_dT);
@@ -56,7 +58,19 @@ int current_raw_bed = 0;
   #ifdef PID_ADD_EXTRUSION_RATE
     float Kc=DEFAULT_Kc;
   #endif
+  #ifdef PID_ADD_FAN_LOAD
+    float Kf=DEFAULT_Kf;
+  #endif
 #endif //PIDTEMP
+
+#ifdef PIDTEMPBED
+  // used external
+  long bed_pid_setpoint = 0; // 1/256 degC
+
+  float bedKp=DEFAULT_bedKp;
+  float bedKi=(DEFAULT_bedKi*PID_dT);
+  float bedKd=(DEFAULT_bedKd/PID_dT);
+#endif //PIDTEMPBED
   
   
 //===========================================================================
@@ -67,22 +81,62 @@ static volatile bool temp_meas_ready = false;
 static unsigned long  previous_millis_bed_heater;
 //static unsigned long previous_millis_heater;
 
+#if defined(PIDTEMP) || defined(PIDTEMPBED)
+  // The PID loops run in fixed point. Temperatures are in 1/256 degC, the terms in
+  // output units << PID_SHIFT. Kp, Ki and Kd stay floats for M301/M304, the LCD and the
+  // EEPROM; updatePID() makes the scaled copies the loops use.
+  #define PID_SHIFT 12
+  #define PID_D_LIMIT (1L<<21)                      // |Kd term| limit, twice full output, keeps the filter math in a long
+  #define K2_FX ((long)((1.0-K1)*256.0+0.5))        // K1 defined in Configuration.h in the PID settings
+  #define PID_FUNCTIONAL_RANGE (10L<<8)             // further than 10 degC from the target the heater is just on or off
+
+  struct pid_gains_t {
+    long Kp, Ki, Kd;                                // Kp*16, Ki*32768, Kd*16
+    long dInput_max;                                // input step that takes the Kd term to PID_D_LIMIT
+    long iState_max;                                // integral limit, Ki*iState_max is the drive max
+  };
+
+  struct pid_state_t {
+    long iState;                                    // 1/256 degC * samples
+    long dState;                                    // last input, 1/256 degC
+    long dTerm;
+    bool reset;
+    #ifdef TEMP_TELEMETRY
+      long pTerm, iTerm;                            // kept for the telemetry ring
+    #endif
+  };
+#endif
 #ifdef PIDTEMP
   //static cannot be external:
-  static float temp_iState[EXTRUDERS] = { 0 };
-  static float temp_dState[EXTRUDERS] = { 0 };
-  static float pTerm[EXTRUDERS];
-  static float iTerm[EXTRUDERS];
-  static float dTerm[EXTRUDERS];
-  //int output;
-  static float pid_error[EXTRUDERS];
-  static float temp_iState_min[EXTRUDERS];
-  static float temp_iState_max[EXTRUDERS];
-  // static float pid_input[EXTRUDERS];
-  // static float pid_output[EXTRUDERS];
-  static bool pid_reset[EXTRUDERS];
+  static pid_gains_t pid_gains;
+  static pid_state_t pid_state[EXTRUDERS];
 #endif //PIDTEMP
+#ifdef PIDTEMPBED
+  static pid_gains_t bed_pid_gains;
+  static pid_state_t bed_pid_state;
+  static unsigned char soft_pwm_bed;
+#endif //PIDTEMPBED
   static unsigned char soft_pwm[EXTRUDERS];
+
+#ifdef TEMP_TELEMETRY
+  // One heater in a telemetry record. Temperatures in 1/16 degC, PID terms in output/16.
+  struct telemetry_heater_t {
+    int raw;                                        // ADC reading, OVERSAMPLENR scale
+    int temp;
+    int pTerm, iTerm, dTerm;
+    unsigned char pwm;
+  };
+
+  // One record per temperature reading, the hotends and then the bed.
+  struct telemetry_record_t {
+    unsigned int time;                              // millis(), low 16 bits
+    telemetry_heater_t heater[EXTRUDERS+1];
+  };
+
+  static telemetry_record_t telemetry[TEMP_TELEMETRY_SIZE];
+  static unsigned char telemetry_head;              // next record to write
+  static unsigned char telemetry_count;
+#endif //TEMP_TELEMETRY
   
 #ifdef WATCHPERIOD
   int watch_raw[EXTRUDERS] = { -1000 }; // the first value used for all
@@ -122,187 +176,475 @@ static unsigned long  previous_millis_bed_heater;
 //=============================   functions      ============================
 //===========================================================================
 
-void PID_autotune(float temp)
-{
-  float input;
-  int cycles=0;
-  bool heating = true;
+static long analog2temp_fx(int raw, uint8_t e);
+#ifdef PIDTEMPBED
+static long analog2tempBed_fx(int raw);
+#endif
+static void adc_start();
 
-  unsigned long temp_millis = millis();
-  unsigned long t1=temp_millis;
-  unsigned long t2=temp_millis;
-  long t_high;
-  long t_low;
+// extruder -1 is the bed
+static void set_heater_pwm(int extruder, unsigned char pwm)
+{
+  #ifdef PIDTEMPBED
+    if(extruder < 0) {
+      soft_pwm_bed = pwm;
+      return;
+    }
+  #endif
+  soft_pwm[extruder] = pwm;
+}
 
-  long bias=PID_MAX/2;
-  long d = PID_MAX/2;
-  float Ku, Tu;
-  float Kp, Ki, Kd;
+// State of the running M303 relay autotune. PID_autotune() starts it, manage_heater()
+// advances it once per new temperature reading.
+static struct {
+  bool active;
+  bool heating;
+  bool apply;                 // take the gains and store them in the EEPROM when done
+  int extruder;               // -1 is the bed
+  int cycles;
+  int ncycles;
+  float temp;
   float max, min;
-  
+  unsigned long temp_millis;
+  unsigned long t1, t2;
+  long t_high, t_low;
+  long bias, d;
+  long pid_max;
+  #ifdef SERIAL_PORT_2
+    uint8_t port;             // the port that sent the M303 gets the progress lines
+  #endif
+} autotune;
+
+void PID_autotune(float temp, int extruder, int ncycles, bool apply)
+{
+  #ifdef PIDTEMPBED
+    if(extruder >= EXTRUDERS || extruder < -1)
+  #else
+    if(extruder >= EXTRUDERS || extruder < 0)
+  #endif
+  {
+    SERIAL_ECHOLN("PID Autotune failed. Bad extruder number.");
+    return;
+  }
+  if(autotune.active)
+    set_heater_pwm(autotune.extruder, 0);
+
+  autotune.extruder = extruder;
+  autotune.temp = temp;
+  autotune.ncycles = constrain(ncycles, 3, 20);
+  autotune.apply = apply;
+  autotune.cycles = 0;
+  autotune.heating = true;
+  autotune.max = 0;
+  autotune.min = 10000;
+  autotune.temp_millis = millis();
+  autotune.t1 = autotune.temp_millis;
+  autotune.t2 = autotune.temp_millis;
+  #ifdef PIDTEMPBED
+    autotune.pid_max = (extruder < 0) ? MAX_BED_POWER : PID_MAX;
+  #else
+    autotune.pid_max = PID_MAX;
+  #endif
+  autotune.bias = autotune.pid_max/2;
+  autotune.d = autotune.pid_max/2;
+  #ifdef SERIAL_PORT_2
+    autotune.port = serial_reply_port;
+  #endif
+
   SERIAL_ECHOLN("PID Autotune start");
-  
-  disable_heater(); // switch off all heaters.
-  
-  soft_pwm[0] = PID_MAX/2;
-    
-  for(;;) {
 
-    if(temp_meas_ready == true) { // temp sample ready
-      CRITICAL_SECTION_START;
-      temp_meas_ready = false;
-      CRITICAL_SECTION_END;
-      input = analog2temp(current_raw[0], 0);
-      
-      max=max(max,input);
-      min=min(min,input);
-      if(heating == true && input > temp) {
-        if(millis() - t2 > 5000) { 
-          heating=false;
-          soft_pwm[0] = (bias - d) >> 1;
-          t1=millis();
-          t_high=t1 - t2;
-          max=temp;
-        }
-      }
-      if(heating == false && input < temp) {
-        if(millis() - t1 > 5000) {
-          heating=true;
-          t2=millis();
-          t_low=t2 - t1;
-          if(cycles > 0) {
-            bias += (d*(t_high - t_low))/(t_low + t_high);
-            bias = constrain(bias, 20 ,PID_MAX-20);
-            if(bias > PID_MAX/2) d = PID_MAX - 1 - bias;
-            else d = bias;
-
-            SERIAL_PROTOCOLPGM(" bias: "); SERIAL_PROTOCOL(bias);
-            SERIAL_PROTOCOLPGM(" d: "); SERIAL_PROTOCOL(d);
-            SERIAL_PROTOCOLPGM(" min: "); SERIAL_PROTOCOL(min);
-            SERIAL_PROTOCOLPGM(" max: "); SERIAL_PROTOCOLLN(max);
-            if(cycles > 2) {
-              Ku = (4.0*d)/(3.14159*(max-min)/2.0);
-              Tu = ((float)(t_low + t_high)/1000.0);
-              SERIAL_PROTOCOLPGM(" Ku: "); SERIAL_PROTOCOL(Ku);
-              SERIAL_PROTOCOLPGM(" Tu: "); SERIAL_PROTOCOLLN(Tu);
-              Kp = 0.6*Ku;
-              Ki = 2*Kp/Tu;
-              Kd = Kp*Tu/8;
-              SERIAL_PROTOCOLLNPGM(" Clasic PID ")
-              SERIAL_PROTOCOLPGM(" Kp: "); SERIAL_PROTOCOLLN(Kp);
-              SERIAL_PROTOCOLPGM(" Ki: "); SERIAL_PROTOCOLLN(Ki);
-              SERIAL_PROTOCOLPGM(" Kd: "); SERIAL_PROTOCOLLN(Kd);
-              /*
-              Kp = 0.33*Ku;
-              Ki = Kp/Tu;
-              Kd = Kp*Tu/3;
-              SERIAL_PROTOCOLLNPGM(" Some overshoot ")
-              SERIAL_PROTOCOLPGM(" Kp: "); SERIAL_PROTOCOLLN(Kp);
-              SERIAL_PROTOCOLPGM(" Ki: "); SERIAL_PROTOCOLLN(Ki);
-              SERIAL_PROTOCOLPGM(" Kd: "); SERIAL_PROTOCOLLN(Kd);
-              Kp = 0.2*Ku;
-              Ki = 2*Kp/Tu;
-              Kd = Kp*Tu/3;
-              SERIAL_PROTOCOLLNPGM(" No overshoot ")
-              SERIAL_PROTOCOLPGM(" Kp: "); SERIAL_PROTOCOLLN(Kp);
-              SERIAL_PROTOCOLPGM(" Ki: "); SERIAL_PROTOCOLLN(Ki);
-              SERIAL_PROTOCOLPGM(" Kd: "); SERIAL_PROTOCOLLN(Kd);
-              */
-            }
-          }
-          soft_pwm[0] = (bias + d) >> 1;
-          cycles++;
-          min=temp;
-        }
-      } 
+  // only the heater being tuned is switched off, the others keep their targets
+  if(extruder < 0)
+    setTargetBed(0);
+  else
+    setTargetHotend(0, extruder);
+  autotune.active = true;
+  set_heater_pwm(extruder, autotune.pid_max/2);
+}
+
+static void autotune_finish(float Kp_t, float Ki_t, float Kd_t)
+{
+  autotune.active = false;
+  set_heater_pwm(autotune.extruder, 0);
+  if(autotune.apply == false) {
+    SERIAL_PROTOCOLLNPGM("PID Autotune finished ! Place the Kp, Ki and Kd constants in the configuration.h");
+    return;
+  }
+  #ifdef PIDTEMPBED
+    if(autotune.extruder < 0) {
+      bedKp = Kp_t;
+      bedKi = Ki_t*PID_dT;
+      bedKd = Kd_t/PID_dT;
     }
-    if(input > (temp + 20)) {
-      SERIAL_PROTOCOLLNPGM("PID Autotune failed! Temperature to high");
-      return;
+  #endif
+  #ifdef PIDTEMP
+    if(autotune.extruder >= 0) {
+      Kp = Kp_t;
+      Ki = Ki_t*PID_dT;
+      Kd = Kd_t/PID_dT;
     }
-    if(millis() - temp_millis > 2000) {
-      temp_millis = millis();
-      SERIAL_PROTOCOLPGM("ok T:");
-      SERIAL_PROTOCOL(degHotend(0));   
-      SERIAL_PROTOCOLPGM(" @:");
-      SERIAL_PROTOCOLLN(getHeaterPower(0));       
+  #endif
+  updatePID();
+  EEPROM_StoreSettings();
+  SERIAL_PROTOCOLLNPGM("PID Autotune finished ! The new constants are in use and stored");
+}
+
+// One step of the relay test, called with each new temperature reading.
+static void autotune_step()
+{
+  float Ku, Tu;
+  float Kp_t, Ki_t, Kd_t;
+  float input;
+
+  #ifdef SERIAL_PORT_2
+    uint8_t saved_port = serial_reply_port;
+    serial_reply_port = autotune.port;
+  #endif
+
+  if(autotune.extruder < 0)
+    input = analog2tempBed(current_raw_bed);
+  else
+    input = analog2temp(current_raw[autotune.extruder], autotune.extruder);
+
+  autotune.max=max(autotune.max,input);
+  autotune.min=min(autotune.min,input);
+  if(autotune.heating == true && input > autotune.temp) {
+    if(millis() - autotune.t2 > 5000) { 
+      autotune.heating=false;
+      set_heater_pwm(autotune.extruder, (autotune.bias - autotune.d) >> 1);
+      autotune.t1=millis();
+      autotune.t_high=autotune.t1 - autotune.t2;
+      autotune.max=autotune.temp;
     }
-    if(((millis() - t1) + (millis() - t2)) > (10L*60L*1000L*2L)) {
-      SERIAL_PROTOCOLLNPGM("PID Autotune failed! timeout");
-      return;
+  }
+  if(autotune.heating == false && input < autotune.temp) {
+    if(millis() - autotune.t1 > 5000) {
+      autotune.heating=true;
+      autotune.t2=millis();
+      autotune.t_low=autotune.t2 - autotune.t1;
+      if(autotune.cycles > 0) {
+        autotune.bias += (autotune.d*(autotune.t_high - autotune.t_low))/(autotune.t_low + autotune.t_high);
+        autotune.bias = constrain(autotune.bias, 20 ,autotune.pid_max-20);
+        if(autotune.bias > autotune.pid_max/2) autotune.d = autotune.pid_max - 1 - autotune.bias;
+        else autotune.d = autotune.bias;
+
+        SERIAL_PROTOCOLPGM(" bias: "); SERIAL_PROTOCOL(autotune.bias);
+        SERIAL_PROTOCOLPGM(" d: "); SERIAL_PROTOCOL(autotune.d);
+        SERIAL_PROTOCOLPGM(" min: "); SERIAL_PROTOCOL(autotune.min);
+        SERIAL_PROTOCOLPGM(" max: "); SERIAL_PROTOCOLLN(autotune.max);
+        if(autotune.cycles > 2) {
+          Ku = (4.0*autotune.d)/(3.14159*(autotune.max-autotune.min)/2.0);
+          Tu = ((float)(autotune.t_low + autotune.t_high)/1000.0);
+          SERIAL_PROTOCOLPGM(" Ku: "); SERIAL_PROTOCOL(Ku);
+          SERIAL_PROTOCOLPGM(" Tu: "); SERIAL_PROTOCOLLN(Tu);
+          Kp_t = 0.6*Ku;
+          Ki_t = 2*Kp_t/Tu;
+          Kd_t = Kp_t*Tu/8;
+          SERIAL_PROTOCOLLNPGM(" Clasic PID ")
+          SERIAL_PROTOCOLPGM(" Kp: "); SERIAL_PROTOCOLLN(Kp_t);
+          SERIAL_PROTOCOLPGM(" Ki: "); SERIAL_PROTOCOLLN(Ki_t);
+          SERIAL_PROTOCOLPGM(" Kd: "); SERIAL_PROTOCOLLN(Kd_t);
+          if(autotune.cycles >= autotune.ncycles) {
+            autotune_finish(Kp_t, Ki_t, Kd_t);
+            #ifdef SERIAL_PORT_2
+              serial_reply_port = saved_port;
+            #endif
+            return;
+          }
+        }
+      }
+      set_heater_pwm(autotune.extruder, (autotune.bias + autotune.d) >> 1);
+      autotune.cycles++;
+      autotune.min=autotune.temp;
     }
-    if(cycles > 5) {
-      SERIAL_PROTOCOLLNPGM("PID Autotune finished ! Place the Kp, Ki and Kd constants in the configuration.h");
-      return;
+  } 
+  if(input > (autotune.temp + 20)) {
+    SERIAL_PROTOCOLLNPGM("PID Autotune failed! Temperature to high");
+    autotune.active = false;
+    set_heater_pwm(autotune.extruder, 0);
+  }
+  else if(((millis() - autotune.t1) + (millis() - autotune.t2)) > (10L*60L*1000L*2L)) {
+    SERIAL_PROTOCOLLNPGM("PID Autotune failed! timeout");
+    autotune.active = false;
+    set_heater_pwm(autotune.extruder, 0);
+  }
+  else if(millis() - autotune.temp_millis > 2000) { // no "ok" in front, M303 has been answered already
+    autotune.temp_millis = millis();
+    if(autotune.extruder < 0) {
+      SERIAL_PROTOCOLPGM("B:");
+    } else {
+      SERIAL_PROTOCOLPGM("T:");
     }
-    LCD_STATUS;
+    SERIAL_PROTOCOL(input);
+    SERIAL_PROTOCOLPGM(" @:");
+    SERIAL_PROTOCOLLN(getHeaterPower(autotune.extruder));       
   }
+  #ifdef SERIAL_PORT_2
+    serial_reply_port = saved_port;
+  #endif
+}
+
+#if defined(PIDTEMP) || defined(PIDTEMPBED)
+static void pid_scale(pid_gains_t &g, float p, float i, float d, int drive_max)
+{
+  g.Kp = lround(p * 16);
+  g.Ki = lround(i * 32768);
+  g.Kd = lround(d * 16);
+  g.dInput_max = PID_D_LIMIT / (labs(g.Kd) + 1) + 1;
+  g.iState_max = (g.Ki > 0) ? ((long)drive_max << 23) / g.Ki : 0;
 }
 
+// One PID step, setpoint and input in 1/256 degC, ff is added to the output (same scale as the terms).
+// Returns the heater power, 0..max_output. Ki*iState is at most drive_max << 23 less what ff takes,
+// which still fits a long.
+static int pid_step(pid_state_t &st, const pid_gains_t &g, long setpoint, long input, int max_output, long ff)
+{
+  long error = setpoint - input;
+  #ifdef TEMP_TELEMETRY
+    if(error > PID_FUNCTIONAL_RANGE || error < -PID_FUNCTIONAL_RANGE)
+      st.pTerm = st.iTerm = 0;
+  #endif
+  if(error > PID_FUNCTIONAL_RANGE) {
+    st.reset = true;
+    return max_output;
+  }
+  if(error < -PID_FUNCTIONAL_RANGE) {
+    st.reset = true;
+    return 0;
+  }
+  if(st.reset == true) {
+    st.iState = 0;
+    st.reset = false;
+  }
+  long pTerm = g.Kp * error;
+  // the feed-forward takes its part of the drive first, the integral only gets what is left of it,
+  // so it doesn't wind up behind an output that the feed-forward already holds at the limit
+  long iState_max = g.iState_max;
+  if(ff > 0 && g.Ki > 0)
+    iState_max -= ((min(ff, (long)max_output << PID_SHIFT) << 7) / g.Ki) << 4;
+  st.iState += error;
+  st.iState = constrain(st.iState, 0, max(iState_max, 0L));
+  long iTerm = (g.Ki * st.iState) >> 11;
+  // dTerm = Kd*dInput*K2 + K1*dTerm, written as a step towards the new value
+  long dInput = constrain(input - st.dState, -g.dInput_max, g.dInput_max);
+  st.dTerm += ((g.Kd * dInput - st.dTerm) * K2_FX) >> 8;
+  st.dState = input;
+  #ifdef TEMP_TELEMETRY
+    st.pTerm = pTerm;
+    st.iTerm = iTerm;
+  #endif
+  #ifdef PID_DEBUG
+    SERIAL_ECHO_START;
+    SERIAL_ECHOPAIR(" PIDDEBUG Input ", input / 256.0);
+    SERIAL_ECHOPAIR(" pTerm ", pTerm >> PID_SHIFT);
+    SERIAL_ECHOPAIR(" iTerm ", iTerm >> PID_SHIFT);
+    SERIAL_ECHOPAIR(" dTerm ", st.dTerm >> PID_SHIFT);
+    SERIAL_ECHOLN("");
+  #endif //PID_DEBUG
+  return constrain(pTerm + iTerm - st.dTerm + ff, 0, (long)max_output << PID_SHIFT) >> PID_SHIFT;
+}
+#endif
+
+#ifdef PIDTEMP
+// Heater power the extrusion and the part fan will take from hotend e, ahead of the temperature
+// dropping. In PID output << PID_SHIFT.
+static long pid_feedforward(uint8_t e)
+{
+  float power = 0;
+  #ifdef PID_ADD_EXTRUSION_RATE
+    power += Kc * plan_e_speed(e);
+  #endif
+  #ifdef PID_ADD_FAN_LOAD
+    if(e == active_extruder)
+      power += Kf * FanSpeed * (1.0/255.0);
+  #endif
+  return (long)(power * (1L << PID_SHIFT));
+}
+#endif
+
 void updatePID()
 {
 #ifdef PIDTEMP
-  for(int e = 0; e < EXTRUDERS; e++) { 
-     temp_iState_max[e] = PID_INTEGRAL_DRIVE_MAX / Ki;  
-  }
+  pid_scale(pid_gains, Kp, Ki, Kd, PID_INTEGRAL_DRIVE_MAX);
+#endif
+#ifdef PIDTEMPBED
+  pid_scale(bed_pid_gains, bedKp, bedKi, bedKd, MAX_BED_POWER);
 #endif
 }
   
+// heater -1 is the bed
 int getHeaterPower(int heater) {
+#ifdef PIDTEMPBED
+  if(heater < 0)
+    return soft_pwm_bed;
+#endif
   return soft_pwm[heater];
 }
 
-void manage_heater()
+#ifdef HEATER_0_USES_MAX6675
+#define HEAT_INTERVAL 250 // ms, a MAX6675 conversion takes up to 220ms
+static volatile int max6675_temp = 2000;
+static unsigned long max6675_previous_millis;
+
+// Reads the thermocouple from the main loop, which also drives the SD card, so the two never
+// use the SPI bus at the same time and the temperature interrupt never waits for it. The
+// interrupt only copies max6675_temp. Two bytes at F_CPU/16, about 20us.
+static void max6675_poll()
 {
-  #ifdef USE_WATCHDOG
-    wd_reset();
+  if (millis() - max6675_previous_millis < HEAT_INTERVAL) 
+    return;
+  #if defined(SDSUPPORT) && (SDSS > -1)
+    if (READ(SDSS) == 0) // the card is selected in the middle of a transfer, try again next time
+      return;
+  #endif
+  max6675_previous_millis = millis();
+    
+  #ifdef	PRR
+    PRR &= ~(1<<PRSPI);
+  #elif defined PRR0
+    PRR0 &= ~(1<<PRSPI);
   #endif
   
-  float pid_input;
-  float pid_output;
+  // the SD card keeps its own clock rate
+  unsigned char spcr = SPCR;
+  unsigned char spsr = SPSR;
+  SPCR = (1<<MSTR) | (1<<SPE) | (1<<SPR0);
+  SPSR = 0;
+  
+  // enable TT_MAX6675. The 100ns before the first clock are covered by the instructions in between.
+  WRITE(MAX6675_SS, 0);
+  
+  // read MSB
+  SPDR = 0;
+  for (;(SPSR & (1<<SPIF)) == 0;);
+  int temp = SPDR;
+  temp <<= 8;
+  
+  // read LSB
+  SPDR = 0;
+  for (;(SPSR & (1<<SPIF)) == 0;);
+  temp |= SPDR;
+  
+  // disable TT_MAX6675
+  WRITE(MAX6675_SS, 1);
+  SPCR = spcr;
+  SPSR = spsr;
 
-  if(temp_meas_ready != true)   //better readability
-    return; 
+  if (temp & 4) 
+  {
+    // thermocouple open
+    temp = 2000;
+  }
+  else 
+  {
+    temp = temp >> 3;
+  }
 
   CRITICAL_SECTION_START;
-  temp_meas_ready = false;
+  max6675_temp = temp;
   CRITICAL_SECTION_END;
+}
+#endif
+
+#ifdef TEMP_TELEMETRY
+// Stores the reading just handled by heater_update() in the telemetry ring. The ring stops
+// while the printer is stopped, so the samples before a thermal error stay in it.
+static void telemetry_record()
+{
+  if(IsStopped())
+    return;
+  telemetry_record_t &r = telemetry[telemetry_head];
+  r.time = millis();
+  for(uint8_t e = 0; e < EXTRUDERS; e++) {
+    r.heater[e].raw = current_raw[e];
+    r.heater[e].temp = analog2temp_fx(current_raw[e], e) >> 4;
+    #ifdef PIDTEMP
+      r.heater[e].pTerm = pid_state[e].pTerm >> (PID_SHIFT-4);
+      r.heater[e].iTerm = pid_state[e].iTerm >> (PID_SHIFT-4);
+      r.heater[e].dTerm = pid_state[e].dTerm >> (PID_SHIFT-4);
+    #else
+      r.heater[e].pTerm = r.heater[e].iTerm = r.heater[e].dTerm = 0;
+    #endif
+    r.heater[e].pwm = soft_pwm[e];
+  }
+  telemetry_heater_t &b = r.heater[EXTRUDERS];
+  b.raw = current_raw_bed;
+  #ifdef PIDTEMPBED
+    b.temp = analog2tempBed_fx(current_raw_bed) >> 4;
+    b.pTerm = bed_pid_state.pTerm >> (PID_SHIFT-4);
+    b.iTerm = bed_pid_state.iTerm >> (PID_SHIFT-4);
+    b.dTerm = bed_pid_state.dTerm >> (PID_SHIFT-4);
+    b.pwm = soft_pwm_bed;
+  #else
+    b.temp = analog2tempBed(current_raw_bed) * 16;
+    b.pTerm = b.iTerm = b.dTerm = 0;
+    #if HEATER_BED_PIN > -1
+      b.pwm = READ(HEATER_BED_PIN) ? 255 : 0;
+    #else
+      b.pwm = 0;
+    #endif
+  #endif
+  telemetry_head = (telemetry_head + 1) % TEMP_TELEMETRY_SIZE;
+  if(telemetry_count < TEMP_TELEMETRY_SIZE)
+    telemetry_count++;
+}
+
+void temp_telemetry_dump()
+{
+  uint8_t i = (telemetry_head + TEMP_TELEMETRY_SIZE - telemetry_count) % TEMP_TELEMETRY_SIZE;
+  SERIAL_PROTOCOLPGM("TL: n:");
+  SERIAL_PROTOCOL((int)telemetry_count);
+  SERIAL_PROTOCOLLNPGM(" ms raw,temp*16,p*16,i*16,d*16,pwm for T0.. then B");
+  for(uint8_t n = 0; n < telemetry_count; n++) {
+    const telemetry_record_t &r = telemetry[i];
+    SERIAL_PROTOCOLPGM("TL:");
+    SERIAL_PROTOCOL(r.time);
+    for(uint8_t h = 0; h < EXTRUDERS+1; h++) {
+      SERIAL_PROTOCOLPGM(" ");
+      SERIAL_PROTOCOL(r.heater[h].raw);
+      SERIAL_PROTOCOLPGM(",");
+      SERIAL_PROTOCOL(r.heater[h].temp);
+      SERIAL_PROTOCOLPGM(",");
+      SERIAL_PROTOCOL(r.heater[h].pTerm);
+      SERIAL_PROTOCOLPGM(",");
+      SERIAL_PROTOCOL(r.heater[h].iTerm);
+      SERIAL_PROTOCOLPGM(",");
+      SERIAL_PROTOCOL(r.heater[h].dTerm);
+      SERIAL_PROTOCOLPGM(",");
+      SERIAL_PROTOCOL((int)r.heater[h].pwm);
+    }
+    SERIAL_PROTOCOLLN("");
+    i = (i + 1) % TEMP_TELEMETRY_SIZE;
+  }
+}
+
+void temp_telemetry_clear()
+{
+  telemetry_head = 0;
+  telemetry_count = 0;
+}
+#endif //TEMP_TELEMETRY
+
+// Runs the heater control on a new reading
+static void heater_update()
+{
+  long pid_input;
+  long pid_output;
+
+  if(autotune.active)
+    autotune_step();
 
   for(int e = 0; e < EXTRUDERS; e++) 
   {
+    if(autotune.active && autotune.extruder == e)
+      continue; // the relay test drives this heater
 
   #ifdef PIDTEMP
-    pid_input = analog2temp(current_raw[e], e);
+    pid_input = analog2temp_fx(current_raw[e], e);
 
     #ifndef PID_OPENLOOP
-        pid_error[e] = pid_setpoint[e] - pid_input;
-        if(pid_error[e] > 10) {
-          pid_output = PID_MAX;
-          pid_reset[e] = true;
-        }
-        else if(pid_error[e] < -10) {
-          pid_output = 0;
-          pid_reset[e] = true;
-        }
-        else {
-          if(pid_reset[e] == true) {
-            temp_iState[e] = 0.0;
-            pid_reset[e] = false;
-          }
-          pTerm[e] = Kp * pid_error[e];
-          temp_iState[e] += pid_error[e];
-          temp_iState[e] = constrain(temp_iState[e], temp_iState_min[e], temp_iState_max[e]);
-          iTerm[e] = Ki * temp_iState[e];
-          //K1 defined in Configuration.h in the PID settings
-          #define K2 (1.0-K1)
-          dTerm[e] = (Kd * (pid_input - temp_dState[e]))*K2 + (K1 * dTerm[e]);
-          temp_dState[e] = pid_input;
-          pid_output = constrain(pTerm[e] + iTerm[e] - dTerm[e], 0, PID_MAX);
-        }
+        pid_output = pid_step(pid_state[e], pid_gains, pid_setpoint[e], pid_input, PID_MAX, pid_feedforward(e));
     #endif //PID_OPENLOOP
-    #ifdef PID_DEBUG
-    SERIAL_ECHOLN(" PIDDEBUG "<<e<<": Input "<<pid_input<<" Output "<<pid_output" pTerm "<<pTerm[e]<<" iTerm "<<iTerm[e]<<" dTerm "<<dTerm[e]);  
-    #endif //PID_DEBUG
   #else /* PID off */
     pid_output = 0;
     if(current_raw[e] < target_raw[e]) {
@@ -333,6 +675,23 @@ void manage_heater()
     }
   #endif
   
+  #ifdef PIDTEMPBED
+    #if TEMP_BED_PIN > -1
+      pid_output = pid_step(bed_pid_state, bed_pid_gains, bed_pid_setpoint, analog2tempBed_fx(current_raw_bed), MAX_BED_POWER, 0);
+
+      if(autotune.active == false || autotune.extruder >= 0) { // else the relay test drives the bed
+        // Check if temperature is within the correct range
+        if((current_raw_bed > bed_minttemp) && (current_raw_bed < bed_maxttemp)) {
+          soft_pwm_bed = (int)pid_output >> 1;
+        }
+        else {
+          soft_pwm_bed = 0;
+        }
+      }
+    #endif
+    return;
+  #endif //PIDTEMPBED
+
   if(millis() - previous_millis_bed_heater < BED_CHECK_INTERVAL)
     return;
   previous_millis_bed_heater = millis();
@@ -374,7 +733,99 @@ void manage_heater()
   #endif
 }
 
+void manage_heater()
+{
+  #ifdef USE_WATCHDOG
+    wd_reset();
+  #endif
+
+  #ifdef HEATER_0_USES_MAX6675
+    max6675_poll();
+  #endif
+
+  if(temp_meas_ready != true)   //better readability
+    return; 
+
+  CRITICAL_SECTION_START;
+  temp_meas_ready = false;
+  CRITICAL_SECTION_END;
+
+  heater_update();
+  #ifdef TEMP_TELEMETRY
+    telemetry_record();
+  #endif
+}
+
 #define PGM_RD_W(x)   (short)pgm_read_word(&x)
+
+// The thermistor tables are sorted by raw value, ascending, so by temperature descending.
+// Lookups are a binary search for the segment and a fixed point interpolation inside it,
+// so the cost doesn't depend on where in the table the temperature is.
+
+// Returns the first i>0 with tt[i][0] > raw, or len if there is none.
+static byte tt_find_raw(const short (*tt)[2], byte len, int raw)
+{
+  byte lo = 1, hi = len;
+  while(lo < hi) {
+    byte mid = (lo + hi) >> 1;
+    if(PGM_RD_W(tt[mid][0]) > raw)
+      hi = mid;
+    else
+      lo = mid + 1;
+  }
+  return lo;
+}
+
+// Returns the first i>0 with tt[i][1] < celsius, or len if there is none.
+static byte tt_find_celsius(const short (*tt)[2], byte len, int celsius)
+{
+  byte lo = 1, hi = len;
+  while(lo < hi) {
+    byte mid = (lo + hi) >> 1;
+    if(PGM_RD_W(tt[mid][1]) < celsius)
+      hi = mid;
+    else
+      lo = mid + 1;
+  }
+  return lo;
+}
+
+// Raw ADC sum to temperature in 1/256 degC.
+static long tt_raw2temp(const short (*tt)[2], byte len, int raw)
+{
+  raw = (1023 * OVERSAMPLENR) - raw;
+  byte i = tt_find_raw(tt, len, raw);
+
+  // Overflow: Set to last value in the table
+  if (i == len) return (long)PGM_RD_W(tt[len-1][1]) << 8;
+
+  short r0 = PGM_RD_W(tt[i-1][0]);
+  short t0 = PGM_RD_W(tt[i-1][1]);
+  return ((long)t0 << 8) + 
+    ((long)(raw - r0) * (PGM_RD_W(tt[i][1]) - t0) * 256) / 
+    (PGM_RD_W(tt[i][0]) - r0);
+}
+
+// Temperature to raw ADC sum.
+static int tt_temp2raw(const short (*tt)[2], byte len, int celsius)
+{
+  int raw;
+  byte i = tt_find_celsius(tt, len, celsius);
+
+  // Overflow: Set to last value in the table
+  if (i == len) {
+    raw = PGM_RD_W(tt[len-1][0]);
+  }
+  else {
+    short r0 = PGM_RD_W(tt[i-1][0]);
+    short t0 = PGM_RD_W(tt[i-1][1]);
+    raw = r0 + 
+      ((long)(celsius - t0) * (PGM_RD_W(tt[i][0]) - r0)) / 
+      (PGM_RD_W(tt[i][1]) - t0);
+  }
+  return (1023 * OVERSAMPLENR) - raw;
+}
+
 // Takes hot end temperature value as input and returns corresponding raw value. 
 // For a thermistor, it uses the RepRap thermistor temp table.
 // This is needed because PID in hydra firmware hovers around a given analog value, not a temp value.
@@ -395,26 +846,7 @@ int temp2analog(int celsius, uint8_t e) {
   #endif
   if(heater_ttbl_map[e] != 0)
   {
-    int raw = 0;
-    byte i;
-    short (*tt)[][2] = (short (*)[][2])(heater_ttbl_map[e]);
-
-    for (i=1; i<heater_ttbllen_map[e]; i++)
-    {
-      if (PGM_RD_W((*tt)[i][1]) < celsius)
-      {
-        raw = PGM_RD_W((*tt)[i-1][0]) + 
-          (celsius - PGM_RD_W((*tt)[i-1][1])) * 
-          (PGM_RD_W((*tt)[i][0]) - PGM_RD_W((*tt)[i-1][0])) /
-          (PGM_RD_W((*tt)[i][1]) - PGM_RD_W((*tt)[i-1][1]));  
-        break;
-      }
-    }
-
-    // Overflow: Set to last value in the table
-    if (i == heater_ttbllen_map[e]) raw = PGM_RD_W((*tt)[i-1][0]);
-
-    return (1023 * OVERSAMPLENR) - raw;
+    return tt_temp2raw((const short (*)[2])heater_ttbl_map[e], heater_ttbllen_map[e], celsius);
   }
   return ((celsius-TEMP_SENSOR_AD595_OFFSET)/TEMP_SENSOR_AD595_GAIN) * (1024.0 / (5.0 * 100.0) ) * OVERSAMPLENR;
 }
@@ -425,26 +857,7 @@ int temp2analog(int celsius, uint8_t e) {
 // This function is derived from inversing the logic from a portion of getTemperature() in FiveD RepRap firmware.
 int temp2analogBed(int celsius) {
 #ifdef BED_USES_THERMISTOR
-    int raw = 0;
-    byte i;
-    
-    for (i=1; i<bedtemptable_len; i++)
-    {
-      if (PGM_RD_W(bedtemptable[i][1]) < celsius)
-      {
-        raw = PGM_RD_W(bedtemptable[i-1][0]) + 
-          (celsius - PGM_RD_W(bedtemptable[i-1][1])) * 
-          (PGM_RD_W(bedtemptable[i][0]) - PGM_RD_W(bedtemptable[i-1][0])) /
-          (PGM_RD_W(bedtemptable[i][1]) - PGM_RD_W(bedtemptable[i-1][1]));
-      
-        break;
-      }
-    }
-
-    // Overflow: Set to last value in the table
-    if (i == bedtemptable_len) raw = PGM_RD_W(bedtemptable[i-1][0]);
-
-    return (1023 * OVERSAMPLENR) - raw;
+    return tt_temp2raw(bedtemptable, bedtemptable_len, celsius);
 #elif defined BED_USES_AD595
     return lround(((celsius-TEMP_SENSOR_AD595_OFFSET)/TEMP_SENSOR_AD595_GAIN) * (1024.0 * OVERSAMPLENR/ (5.0 * 100.0) ) );
 #else
@@ -472,56 +885,42 @@ float analog2temp(int raw, uint8_t e) {
 
   if(heater_ttbl_map[e] != 0)
   {
-    float celsius = 0;
-    byte i;  
-    short (*tt)[][2] = (short (*)[][2])(heater_ttbl_map[e]);
+    return tt_raw2temp((const short (*)[2])heater_ttbl_map[e], heater_ttbllen_map[e], raw) * (1.0 / 256.0);
+  }
+  return ((raw * ((5.0 * 100.0) / 1024.0) / OVERSAMPLENR) * TEMP_SENSOR_AD595_GAIN) + TEMP_SENSOR_AD595_OFFSET;
+}
 
-    raw = (1023 * OVERSAMPLENR) - raw;
-    for (i=1; i<heater_ttbllen_map[e]; i++)
+// analog2temp() in 1/256 degC without going through float, for the PID loop.
+static long analog2temp_fx(int raw, uint8_t e) {
+  #ifdef HEATER_0_USES_MAX6675
+    if (e == 0)
     {
-      if (PGM_RD_W((*tt)[i][0]) > raw)
-      {
-        celsius = PGM_RD_W((*tt)[i-1][1]) + 
-          (raw - PGM_RD_W((*tt)[i-1][0])) * 
-          (float)(PGM_RD_W((*tt)[i][1]) - PGM_RD_W((*tt)[i-1][1])) /
-          (float)(PGM_RD_W((*tt)[i][0]) - PGM_RD_W((*tt)[i-1][0]));
-        break;
-      }
+      return (long)raw << 6;
     }
-
-    // Overflow: Set to last value in the table
-    if (i == heater_ttbllen_map[e]) celsius = PGM_RD_W((*tt)[i-1][1]);
-
-    return celsius;
+  #endif
+  if(heater_ttbl_map[e] != 0)
+  {
+    return tt_raw2temp((const short (*)[2])heater_ttbl_map[e], heater_ttbllen_map[e], raw);
   }
-  return ((raw * ((5.0 * 100.0) / 1024.0) / OVERSAMPLENR) * TEMP_SENSOR_AD595_GAIN) + TEMP_SENSOR_AD595_OFFSET;
+  return analog2temp(raw, e) * 256;
 }
 
+#ifdef PIDTEMPBED
+// analog2tempBed() in 1/256 degC, for the bed PID loop.
+static long analog2tempBed_fx(int raw) {
+  #ifdef BED_USES_THERMISTOR
+    return tt_raw2temp(bedtemptable, bedtemptable_len, raw);
+  #else
+    return analog2tempBed(raw) * 256;
+  #endif
+}
+#endif
+
 // Derived from RepRap FiveD extruder::getTemperature()
 // For bed temperature measurement.
 float analog2tempBed(int raw) {
   #ifdef BED_USES_THERMISTOR
-    float celsius = 0;
-    byte i;
-
-    raw = (1023 * OVERSAMPLENR) - raw;
-
-    for (i=1; i<bedtemptable_len; i++)
-    {
-      if (PGM_RD_W(bedtemptable[i][0]) > raw)
-      {
-        celsius  = PGM_RD_W(bedtemptable[i-1][1]) + 
-          (raw - PGM_RD_W(bedtemptable[i-1][0])) * 
-          (float)(PGM_RD_W(bedtemptable[i][1]) - PGM_RD_W(bedtemptable[i-1][1])) /
-          (float)(PGM_RD_W(bedtemptable[i][0]) - PGM_RD_W(bedtemptable[i-1][0]));
-        break;
-      }
-    }
-
-    // Overflow: Set to last value in the table
-    if (i == bedtemptable_len) celsius = PGM_RD_W(bedtemptable[i-1][1]);
-
-    return celsius;
+    return tt_raw2temp(bedtemptable, bedtemptable_len, raw) * (1.0 / 256.0);
   #elif defined BED_USES_AD595
     return ((raw * ((5.0 * 100.0) / 1024.0) / OVERSAMPLENR) * TEMP_SENSOR_AD595_GAIN) + TEMP_SENSOR_AD595_OFFSET;
   #else
@@ -539,11 +938,8 @@ void tp_init()
     watch_raw[e] = watch_raw[0];
 #endif
     maxttemp[e] = maxttemp[0];
-#ifdef PIDTEMP
-    temp_iState_min[e] = 0.0;
-    temp_iState_max[e] = PID_INTEGRAL_DRIVE_MAX / Ki;
-#endif //PIDTEMP
   }
+  updatePID();
 
   #if (HEATER_0_PIN > -1) 
     SET_OUTPUT(HEATER_0_PIN);
@@ -565,23 +961,29 @@ void tp_init()
   #endif  
 
   #ifdef HEATER_0_USES_MAX6675
-    #ifndef SDSUPPORT
-      SET_OUTPUT(MAX_SCK_PIN);
-      WRITE(MAX_SCK_PIN,0);
+    // set up here as well, the SD card is only initialized a few seconds later
+    SET_OUTPUT(MAX_SCK_PIN);
+    WRITE(MAX_SCK_PIN,0);
     
-      SET_OUTPUT(MAX_MOSI_PIN);
-      WRITE(MAX_MOSI_PIN,1);
+    SET_OUTPUT(MAX_MOSI_PIN);
+    WRITE(MAX_MOSI_PIN,1);
     
-      SET_INPUT(MAX_MISO_PIN);
-      WRITE(MAX_MISO_PIN,1);
+    SET_INPUT(MAX_MISO_PIN);
+    WRITE(MAX_MISO_PIN,1);
+
+    #if defined(SDSUPPORT) && (SDSS > -1)
+      SET_OUTPUT(SDSS);
+      WRITE(SDSS,1);
     #endif
     
     SET_OUTPUT(MAX6675_SS);
     WRITE(MAX6675_SS,1);
+
+    max6675_previous_millis = millis() - HEAT_INTERVAL;
+    max6675_poll(); // the first reading, before the maxtemp check starts
   #endif
 
   // Set analog inputs
-  ADCSRA = 1<<ADEN | 1<<ADSC | 1<<ADIF | 0x07;
   DIDR0 = 0;
   #ifdef DIDR2
     DIDR2 = 0;
@@ -615,7 +1017,9 @@ void tp_init()
     #endif
   #endif
   
-  // Use timer0 for temperature measurement
+  adc_start();
+
+  // Use timer0 for the heater PWM and to hand out the readings
   // Interleave temperature interrupt with millies interrupt
   OCR0B = 128;
   TIMSK0 |= (1<<OCIE0B);  
@@ -674,6 +1078,7 @@ void setWatch()
 
 void disable_heater()
 {
+  autotune.active = false;
   for(int i=0;i<EXTRUDERS;i++)
     setTargetHotend(0,i);
   setTargetBed(0);
@@ -703,6 +1108,9 @@ void disable_heater()
 
   #if TEMP_BED_PIN > -1
     target_raw_bed=0;
+    #ifdef PIDTEMPBED
+      soft_pwm_bed=0;
+    #endif
     #if HEATER_BED_PIN > -1  
       WRITE(HEATER_BED_PIN,LOW);
     #endif
@@ -728,6 +1136,10 @@ void min_temp_error(uint8_t e) {
 }
 
 void bed_max_temp_error(void) {
+#ifdef PIDTEMPBED
+  bed_pid_setpoint = 0;
+  soft_pwm_bed = 0;
+#endif
 #if HEATER_BED_PIN > -1
   WRITE(HEATER_BED_PIN, 0);
 #endif
@@ -737,76 +1149,126 @@ void bed_max_temp_error(void) {
   }
 }
 
-#define HEAT_INTERVAL 250
-#ifdef HEATER_0_USES_MAX6675
-long max6675_previous_millis = -HEAT_INTERVAL;
-int max6675_temp = 2000;
 
-int read_max6675()
+
+// The ADC is run from the timer 0 tick below, one conversion per tick (~976/s, no ADC interrupt). In every
+// PID step each channel gets its turn: the first conversion after the mux change only lets the input settle
+// and is thrown away, the next OVERSAMPLENR are summed, which is the scale of the thermistor tables. So every
+// heater, the bed too, gets a fresh reading for every PID step.
+enum {
+#if (TEMP_0_PIN > -1) && !defined(HEATER_0_USES_MAX6675)
+  ADC_CH_0,
+#endif
+#if (EXTRUDERS > 1) && (TEMP_1_PIN > -1)
+  ADC_CH_1,
+#endif
+#if (EXTRUDERS > 2) && (TEMP_2_PIN > -1)
+  ADC_CH_2,
+#endif
+#if (TEMP_BED_PIN > -1)
+  ADC_CH_BED,
+#endif
+  ADC_CHANNELS
+};
+
+// the same count for the preprocessor
+#if (TEMP_0_PIN > -1) && !defined(HEATER_0_USES_MAX6675)
+  #define ADC_USES_0 1
+#else
+  #define ADC_USES_0 0
+#endif
+#if (EXTRUDERS > 1) && (TEMP_1_PIN > -1)
+  #define ADC_USES_1 1
+#else
+  #define ADC_USES_1 0
+#endif
+#if (EXTRUDERS > 2) && (TEMP_2_PIN > -1)
+  #define ADC_USES_2 1
+#else
+  #define ADC_USES_2 0
+#endif
+#if (TEMP_BED_PIN > -1)
+  #define ADC_USES_BED 1
+#else
+  #define ADC_USES_BED 0
+#endif
+// the first channel takes one tick more, the tick of the handout starts no conversion
+#define ADC_STEP_TICKS ((ADC_USES_0 + ADC_USES_1 + ADC_USES_2 + ADC_USES_BED) * (OVERSAMPLENR + 1) + 1)
+#if ADC_STEP_TICKS > TEMP_SAMPLE_TICKS
+  #error TEMP_SAMPLE_TICKS is too short to convert every temperature input once, raise it to 128
+#endif
+
+static const unsigned char adc_pin[] = {
+#if (TEMP_0_PIN > -1) && !defined(HEATER_0_USES_MAX6675)
+  TEMP_0_PIN,
+#endif
+#if (EXTRUDERS > 1) && (TEMP_1_PIN > -1)
+  TEMP_1_PIN,
+#endif
+#if (EXTRUDERS > 2) && (TEMP_2_PIN > -1)
+  TEMP_2_PIN,
+#endif
+#if (TEMP_BED_PIN > -1)
+  TEMP_BED_PIN,
+#endif
+  0
+};
+
+static unsigned int adc_result[ADC_CHANNELS + 1];
+static unsigned char adc_ch = 0;    // channel being converted, ADC_CHANNELS when all are done for this step
+static unsigned char adc_count = 0; // conversions of it started so far
+static unsigned int adc_sum = 0;
+
+FORCE_INLINE void adc_select(unsigned char pin)
 {
-  if (millis() - max6675_previous_millis < HEAT_INTERVAL) 
-    return max6675_temp;
-  
-  max6675_previous_millis = millis();
-  max6675_temp = 0;
-    
-  #ifdef	PRR
-    PRR &= ~(1<<PRSPI);
-  #elif defined PRR0
-    PRR0 &= ~(1<<PRSPI);
+  #ifdef MUX5
+    if(pin > 7)
+      ADCSRB = 1<<MUX5;
+    else
+      ADCSRB = 0;
   #endif
-  
-  SPCR = (1<<MSTR) | (1<<SPE) | (1<<SPR0);
-  
-  // enable TT_MAX6675
-  WRITE(MAX6675_SS, 0);
-  
-  // ensure 100ns delay - a bit extra is fine
-  delay(1);
-  
-  // read MSB
-  SPDR = 0;
-  for (;(SPSR & (1<<SPIF)) == 0;);
-  max6675_temp = SPDR;
-  max6675_temp <<= 8;
-  
-  // read LSB
-  SPDR = 0;
-  for (;(SPSR & (1<<SPIF)) == 0;);
-  max6675_temp |= SPDR;
-  
-  // disable TT_MAX6675
-  WRITE(MAX6675_SS, 1);
-
-  if (max6675_temp & 4) 
-  {
-    // thermocouple open
-    max6675_temp = 2000;
-  }
-  else 
-  {
-    max6675_temp = max6675_temp >> 3;
-  }
+  ADMUX = ((1 << REFS0) | (pin & 0x07));
+}
 
-  return max6675_temp;
+static void adc_start()
+{
+  adc_select(adc_pin[0]);
+  ADCSRA = 1<<ADEN | 1<<ADIF | 0x07; // 125kHz ADC clock, a conversion takes 104us
 }
-#endif
 
+// Called every tick. A conversion started on the last tick is long done.
+FORCE_INLINE void adc_tick()
+{
+  if(adc_ch >= ADC_CHANNELS)
+    return;
+  if(adc_count > 1) // the first one after the mux change is not used
+    adc_sum += ADC;
+  if(adc_count > OVERSAMPLENR) {
+    adc_result[adc_ch] = adc_sum;
+    adc_sum = 0;
+    adc_count = 0;
+    if(++adc_ch >= ADC_CHANNELS) {
+      adc_select(adc_pin[0]); // ready for the next step
+      return;
+    }
+    adc_select(adc_pin[adc_ch]);
+  }
+  adc_count++;
+  ADCSRA |= 1<<ADSC;
+}
 
 // Timer 0 is shared with millies
 ISR(TIMER0_COMPB_vect)
 {
   //these variables are only accesible from the ISR, but static, so they don't loose their value
   static unsigned char temp_count = 0;
-  static unsigned long raw_temp_0_value = 0;
-  static unsigned long raw_temp_1_value = 0;
-  static unsigned long raw_temp_2_value = 0;
-  static unsigned long raw_temp_bed_value = 0;
-  static unsigned char temp_state = 0;
   static unsigned char pwm_count = 1;
   static unsigned char soft_pwm_0;
   static unsigned char soft_pwm_1;
   static unsigned char soft_pwm_2;
+  #if defined(PIDTEMPBED) && (HEATER_BED_PIN > -1)
+  static unsigned char soft_pwm_b;
+  #endif
   
   if(pwm_count == 0){
     soft_pwm_0 = soft_pwm[0];
@@ -819,6 +1281,10 @@ ISR(TIMER0_COMPB_vect)
     soft_pwm_2 = soft_pwm[2];
     if(soft_pwm_2 > 0) WRITE(HEATER_2_PIN,1);
     #endif
+    #if defined(PIDTEMPBED) && (HEATER_BED_PIN > -1)
+    soft_pwm_b = soft_pwm_bed;
+    if(soft_pwm_b > 0) WRITE(HEATER_BED_PIN,1);
+    #endif
   }
   if(soft_pwm_0 <= pwm_count) WRITE(HEATER_0_PIN,0);
   #if EXTRUDERS > 1
@@ -827,139 +1293,62 @@ ISR(TIMER0_COMPB_vect)
   #if EXTRUDERS > 2
   if(soft_pwm_2 <= pwm_count) WRITE(HEATER_2_PIN,0);
   #endif
+  #if defined(PIDTEMPBED) && (HEATER_BED_PIN > -1)
+  if(soft_pwm_b <= pwm_count) WRITE(HEATER_BED_PIN,0);
+  #endif
   
   pwm_count++;
   pwm_count &= 0x7f;
   
-  switch(temp_state) {
-    case 0: // Prepare TEMP_0
-      #if (TEMP_0_PIN > -1)
-        #if TEMP_0_PIN > 7
-          ADCSRB = 1<<MUX5;
-        #else
-          ADCSRB = 0;
-        #endif
-        ADMUX = ((1 << REFS0) | (TEMP_0_PIN & 0x07));
-        ADCSRA |= 1<<ADSC; // Start conversion
-      #endif
-      #ifdef ULTIPANEL
-        buttons_check();
-      #endif
-      temp_state = 1;
-      break;
-    case 1: // Measure TEMP_0
-      #if (TEMP_0_PIN > -1)
-        raw_temp_0_value += ADC;
-      #endif
-      #ifdef HEATER_0_USES_MAX6675 // TODO remove the blocking
-        raw_temp_0_value = read_max6675();
-      #endif
-      temp_state = 2;
-      break;
-    case 2: // Prepare TEMP_BED
-      #if (TEMP_BED_PIN > -1)
-        #if TEMP_BED_PIN > 7
-          ADCSRB = 1<<MUX5;
-        #endif
-        ADMUX = ((1 << REFS0) | (TEMP_BED_PIN & 0x07));
-        ADCSRA |= 1<<ADSC; // Start conversion
-      #endif
-      #ifdef ULTIPANEL
-        buttons_check();
-      #endif
-      temp_state = 3;
-      break;
-    case 3: // Measure TEMP_BED
-      #if (TEMP_BED_PIN > -1)
-        raw_temp_bed_value += ADC;
-      #endif
-      temp_state = 4;
-      break;
-    case 4: // Prepare TEMP_1
-      #if (TEMP_1_PIN > -1)
-        #if TEMP_1_PIN > 7
-          ADCSRB = 1<<MUX5;
-        #else
-          ADCSRB = 0;
-        #endif
-        ADMUX = ((1 << REFS0) | (TEMP_1_PIN & 0x07));
-        ADCSRA |= 1<<ADSC; // Start conversion
-      #endif
-      #ifdef ULTIPANEL
-        buttons_check();
-      #endif
-      temp_state = 5;
-      break;
-    case 5: // Measure TEMP_1
-      #if (TEMP_1_PIN > -1)
-        raw_temp_1_value += ADC;
-      #endif
-      temp_state = 6;
-      break;
-    case 6: // Prepare TEMP_2
-      #if (TEMP_2_PIN > -1)
-        #if TEMP_2_PIN > 7
-          ADCSRB = 1<<MUX5;
-        #else
-          ADCSRB = 0;
-        #endif
-        ADMUX = ((1 << REFS0) | (TEMP_2_PIN & 0x07));
-        ADCSRA |= 1<<ADSC; // Start conversion
-      #endif
-      #ifdef ULTIPANEL
-        buttons_check();
-      #endif
-      temp_state = 7;
-      break;
-    case 7: // Measure TEMP_2
-      #if (TEMP_2_PIN > -1)
-        raw_temp_2_value += ADC;
-      #endif
-      temp_state = 0;
-      temp_count++;
-      break;
-//    default:
-//      SERIAL_ERROR_START;
-//      SERIAL_ERRORLNPGM("Temp measurement error!");
-//      break;
-  }
-    
-  if(temp_count >= 16) // 8 ms * 16 = 128ms.
-  {
-    #if defined(HEATER_0_USES_AD595) || defined(HEATER_0_USES_MAX6675)
-      current_raw[0] = raw_temp_0_value;
-    #else
-      current_raw[0] = 16383 - raw_temp_0_value;
-    #endif
+  #ifdef ULTIPANEL
+    if((pwm_count & 1) == 0)
+      buttons_check();
+  #endif
+
+  adc_tick();
+
+  // Hand the readings to manage_heater() every TEMP_SAMPLE_TICKS, which PID_dT is based on.
+  // ADC_STEP_TICKS <= TEMP_SAMPLE_TICKS, so all channels are done by now.
+  if(++temp_count < TEMP_SAMPLE_TICKS)
+    return;
+  temp_count = 0;
+  adc_ch = 0;
+  adc_count = 0;
+  adc_sum = 0;
+
+  #ifdef HEATER_0_USES_MAX6675
+    current_raw[0] = max6675_temp;
+  #elif defined(HEATER_0_USES_AD595) && (TEMP_0_PIN > -1)
+    current_raw[0] = adc_result[ADC_CH_0];
+  #elif (TEMP_0_PIN > -1)
+    current_raw[0] = 16383 - adc_result[ADC_CH_0];
+  #endif
 
-#if EXTRUDERS > 1    
+#if EXTRUDERS > 1 && (TEMP_1_PIN > -1)
     #ifdef HEATER_1_USES_AD595
-      current_raw[1] = raw_temp_1_value;
+      current_raw[1] = adc_result[ADC_CH_1];
     #else
-      current_raw[1] = 16383 - raw_temp_1_value;
+      current_raw[1] = 16383 - adc_result[ADC_CH_1];
     #endif
 #endif
     
-#if EXTRUDERS > 2
+#if EXTRUDERS > 2 && (TEMP_2_PIN > -1)
     #ifdef HEATER_2_USES_AD595
-      current_raw[2] = raw_temp_2_value;
+      current_raw[2] = adc_result[ADC_CH_2];
     #else
-      current_raw[2] = 16383 - raw_temp_2_value;
+      current_raw[2] = 16383 - adc_result[ADC_CH_2];
     #endif
 #endif
     
+#if (TEMP_BED_PIN > -1)
     #ifdef BED_USES_AD595
-      current_raw_bed = raw_temp_bed_value;
+      current_raw_bed = adc_result[ADC_CH_BED];
     #else
-      current_raw_bed = 16383 - raw_temp_bed_value;
+      current_raw_bed = 16383 - adc_result[ADC_CH_BED];
     #endif
+#endif
     
     temp_meas_ready = true;
-    temp_count = 0;
-    raw_temp_0_value = 0;
-    raw_temp_1_value = 0;
-    raw_temp_2_value = 0;
-    raw_temp_bed_value = 0;
 
     for(unsigned char e = 0; e < EXTRUDERS; e++) {
        if(current_raw[e] >= maxttemp[e]) {
@@ -989,6 +1378,5 @@ ISR(TIMER0_COMPB_vect)
        Stop();
     }
 #endif
-  }
 }
 
@@ -46,10 +46,14 @@ extern int current_raw_bed;
   extern int target_bed_low_temp ;  
   extern int target_bed_high_temp ;
 #endif
-extern float Kp,Ki,Kd,Kc;
+extern float Kp,Ki,Kd,Kc,Kf;
 
 #ifdef PIDTEMP
-  extern float pid_setpoint[EXTRUDERS];
+  extern long pid_setpoint[EXTRUDERS]; // 1/256 degC
+#endif
+#ifdef PIDTEMPBED
+  extern long bed_pid_setpoint; // 1/256 degC
+  extern float bedKp,bedKi,bedKd;
 #endif
   
 // #ifdef WATCHPERIOD
@@ -81,13 +85,16 @@ FORCE_INLINE float degTargetBed() {
 FORCE_INLINE void setTargetHotend(const float &celsius, uint8_t extruder) {  
   target_raw[extruder] = temp2analog(celsius, extruder);
 #ifdef PIDTEMP
-  pid_setpoint[extruder] = celsius;
+  pid_setpoint[extruder] = celsius * 256;
 #endif //PIDTEMP
 };
 
 FORCE_INLINE void setTargetBed(const float &celsius) {  
   
   target_raw_bed = temp2analogBed(celsius);
+  #ifdef PIDTEMPBED
+    bed_pid_setpoint = celsius * 256;
+  #endif
   #ifdef BED_LIMIT_SWITCHING
     if(celsius>BED_HYSTERESIS)
     {
@@ -147,7 +154,7 @@ FORCE_INLINE bool isCoolingBed() {
 
 
 
-int getHeaterPower(int heater);
+int getHeaterPower(int heater); // heater -1 is the bed
 void disable_heater();
 void setWatch();
 void updatePID();
@@ -163,7 +170,15 @@ FORCE_INLINE void autotempShutdown(){
  #endif
 }
 
-void PID_autotune(float temp);
+// Starts the M303 relay test, manage_heater() runs it. extruder -1 is the bed. With apply the
+// gains are put to use and stored in the EEPROM after ncycles oscillations.
+void PID_autotune(float temp, int extruder, int ncycles, bool apply);
+
+#ifdef TEMP_TELEMETRY
+  // M305: writes the telemetry ring to the serial port, oldest record first, or empties it
+  void temp_telemetry_dump();
+  void temp_telemetry_clear();
+#endif
 
 #endif
 
@@ -0,0 +1,40 @@
+// The parts of Marlin.pde, the planner and the LCD that the tested sources call, as plain
+// definitions a test can look at or set. Included once, after the firmware sources.
+#ifndef MARLIN_STUBS_H
+#define MARLIN_STUBS_H
+
+inline bool host_stopped = false;
+inline int host_kills = 0;
+inline float host_e_speed = 0;
+inline char host_enqueued[1024];  // enquecommand() lines, '\n' terminated
+
+void kill() { host_kills++; }
+void Stop() { host_stopped = true; }
+bool IsStopped() { return host_stopped; }
+
+uint8_t active_extruder = 0;
+unsigned char FanSpeed = 0;
+
+void enquecommand(const char *cmd)
+{
+  size_t n = strlen(host_enqueued);
+  snprintf(host_enqueued + n, sizeof(host_enqueued) - n, "%s\n", cmd);
+}
+
+float plan_e_speed(uint8_t) { return host_e_speed; }
+void st_synchronize() {}
+void quickStop() {}
+#ifdef AUTOTEMP
+bool autotemp_enabled = false;
+float autotemp_min = 210;
+#endif
+
+#ifdef ULTRA_LCD
+void lcd_status(const char *) {}
+#endif
+
+#ifdef ULTIPANEL
+void buttons_check() {}
+#endif
+
+#endif
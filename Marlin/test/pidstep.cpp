@@ -0,0 +1,59 @@
+// Harness for thermalSimulator.py: tt_raw2temp(), pid_scale() and pid_step() of temperature.cpp,
+// built for the host, stepped over stdin and stdout so the simulator runs the firmware's own code.
+//
+// Usage: pidstep Kp Ki Kd drive_max max_output
+//   The gains as the firmware stores them (Ki*PID_dT, Kd/PID_dT), like updatePID() passes them.
+// stdin: "table <rows>" and the rows as "raw celsius", raw in the OVERSAMPLENR scale of
+//   thermistortables.h, then one line per sample: "current_raw setpoint ff", the setpoint in
+//   1/256 degC, ff in PID output << PID_SHIFT.
+// stdout: "input output" per sample, the input in 1/256 degC. At the end of the input
+//   "time <ns>", the host time pid_step() took per sample.
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+
+#include "../MarlinSerial.cpp"
+#include "../fixedpoint.cpp"
+#include "../temperature.cpp"
+#include "marlin_stubs.h"
+
+static short table[255][2];
+
+int main(int argc, char **argv)
+{
+  if(argc != 6) {
+    fprintf(stderr, "usage: pidstep Kp Ki Kd drive_max max_output\n");
+    return 2;
+  }
+  pid_gains_t g;
+  pid_scale(g, atof(argv[1]), atof(argv[2]), atof(argv[3]), atoi(argv[4]));
+  int max_output = atoi(argv[5]);
+
+  int len;
+  if(scanf(" table %d", &len) != 1 || len < 2 || len > 255) {
+    fprintf(stderr, "pidstep: expected \"table <rows>\" with 2 to 255 rows\n");
+    return 2;
+  }
+  for(int i = 0; i < len; i++)
+    if(scanf("%hd %hd", &table[i][0], &table[i][1]) != 2) {
+      fprintf(stderr, "pidstep: table row %d missing\n", i);
+      return 2;
+    }
+
+  pid_state_t st = {};
+  int raw;
+  long setpoint, ff;
+  long samples = 0;
+  std::chrono::nanoseconds pid_time(0);
+  while(scanf("%d %ld %ld", &raw, &setpoint, &ff) == 3) {
+    auto start = std::chrono::steady_clock::now();
+    long input = tt_raw2temp(table, len, raw);
+    int output = pid_step(st, g, setpoint, input, max_output, ff);
+    pid_time += std::chrono::steady_clock::now() - start;
+    samples++;
+    printf("%ld %d\n", input, output);
+    fflush(stdout);
+  }
+  printf("time %ld\n", samples ? (long)(pid_time.count() / samples) : 0L);
+  return 0;
+}
@@ -0,0 +1,412 @@
+// An SD card on the other end of SPDR: the SPI mode commands Sd2Card.cpp sends, answered out of an
+// image in memory, and a FAT16 formatter that puts files straight into the image, so the firmware
+// reads them through its own volume and file code. SDHC, block addressed. The card checks the
+// CRC7 of the commands and the CRC16 of the data blocks once CMD59 has turned CRC on. Included
+// before the firmware sources, the standard headers don't get along with the min and max of Arduino.h.
+#ifndef SDCARD_MODEL_H
+#define SDCARD_MODEL_H
+
+#include <stdint.h>
+#include <string.h>
+#include <deque>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include "Marlin.h"
+
+// the structures on the card, without the padding the host compiler would put in where avr-gcc doesn't
+#pragma pack(push, 1)
+#include "SdFatStructs.h"
+#pragma pack(pop)
+
+// CRCs as the SD specification defines them, bit by bit
+inline uint8_t sd_crc7(const uint8_t *buf, int n)
+{
+  uint8_t crc = 0;
+  for(int i = 0; i < n; i++)
+    for(int j = 7; j >= 0; j--)
+    {
+      uint8_t in = ((buf[i] >> j) & 1) ^ ((crc >> 6) & 1);
+      crc = (crc << 1) & 0x7F;
+      if(in)
+        crc ^= 0x09;
+    }
+  return (crc << 1) | 1;
+}
+
+inline uint16_t sd_crc16(uint16_t crc, uint8_t b)
+{
+  crc ^= (uint16_t)b << 8;
+  for(int j = 0; j < 8; j++)
+    crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+  return crc;
+}
+
+struct SdCardModel
+{
+  enum {CMD_IDLE, CMD_BYTES, WAIT_TOKEN, DATA};
+  std::vector<uint8_t> image;
+  std::deque<uint8_t> out;     // MISO bytes still to go
+  int state = CMD_IDLE;
+  uint8_t cmd[6];
+  int cmd_len = 0;
+  bool idle = true, app = false, crc_on = false;
+  int acmd41_polls = 0;        // ACMD41 answers busy a few times first
+  bool reading = false;        // in a CMD18, the next block goes out when out is empty
+  bool multi = false;          // in a CMD25
+  uint32_t block = 0;          // next block of the CMD18 or CMD24/25
+  uint8_t data[514];
+  int data_len = 0;
+  bool corrupt = false;       // flip a bit in the next block sent, after its CRC
+  bool write_fail = false;    // answer every data block with a write error
+  // what the firmware did
+  uint32_t transfers = 0;
+  uint32_t commands[64] = {};
+  uint32_t blocks_read = 0, blocks_written = 0;
+  uint32_t cmd_crc_errors = 0, data_crc_errors = 0, bad_commands = 0;
+
+  explicit SdCardModel(uint32_t blocks) : image(blocks * 512, 0) {}
+  uint32_t blocks() const { return image.size() / 512; }
+
+  void sendBlock(uint32_t n, uint16_t len = 512, const uint8_t *src = 0)
+  {
+    if(!src)
+      src = &image[n * 512];
+    uint16_t crc = 0;
+    for(int i = 0; i < len; i++)
+      crc = sd_crc16(crc, src[i]);
+    out.push_back(0xFF);
+    out.push_back(0xFE);
+    for(int i = 0; i < len; i++)
+      out.push_back(src[i] ^ (corrupt && i == len / 2 ? 0x10 : 0));
+    corrupt = false;
+    out.push_back(crc >> 8);
+    out.push_back(crc & 0xFF);
+  }
+
+  void r1(uint8_t status)
+  {
+    out.push_back(0xFF);  // one byte of Ncr
+    out.push_back(status);
+  }
+
+  void command()
+  {
+    uint8_t c = cmd[0] & 0x3F;
+    uint32_t arg = (uint32_t)cmd[1] << 24 | (uint32_t)cmd[2] << 16 | cmd[3] << 8 | cmd[4];
+    bool acmd = app;
+    app = false;
+    out.clear();
+    commands[c]++;
+    if(c == 12)
+    {
+      reading = false;
+      out.push_back(0xFF);  // the stuff byte
+      out.push_back(0x00);
+      return;
+    }
+    if((crc_on || c == 0 || c == 8) && sd_crc7(cmd, 5) != cmd[5])
+    {
+      cmd_crc_errors++;
+      r1((idle ? 0x01 : 0) | 0x08);
+      return;
+    }
+    uint8_t st = idle ? 0x01 : 0;
+    switch(c)
+    {
+      case 0:
+        idle = true; crc_on = false; reading = false; acmd41_polls = 0;
+        r1(0x01);
+        break;
+      case 8:
+        r1(st);
+        out.push_back(0); out.push_back(0); out.push_back((arg >> 8) & 0x0F); out.push_back(arg & 0xFF);
+        break;
+      case 55:
+        app = true;
+        r1(st);
+        break;
+      case 41:
+        if(!acmd)
+          goto illegal;
+        if(++acmd41_polls > 3)
+          idle = false;
+        r1(idle ? 0x01 : 0);
+        break;
+      case 58:
+        r1(st);
+        out.push_back(idle ? 0x40 : 0xC0); out.push_back(0xFF); out.push_back(0x80); out.push_back(0);
+        break;
+      case 59:
+        crc_on = arg & 1;
+        r1(st);
+        break;
+      case 9:
+      {
+        uint8_t csd[16] = {0x40, 0x0E, 0x00, 0x32, 0x5B, 0x59, 0x00, 0, 0, 0, 0x7F, 0x80, 0x0A, 0x40, 0x00, 0x01};
+        uint32_t c_size = blocks() / 1024 - 1;
+        csd[7] = c_size >> 16; csd[8] = c_size >> 8; csd[9] = c_size;
+        r1(st);
+        sendBlock(0, 16, csd);
+        break;
+      }
+      case 13:
+        r1(st);
+        out.push_back(0);
+        break;
+      case 23:
+        if(!acmd)
+          goto illegal;
+        r1(st);
+        break;
+      case 17: case 18: case 24: case 25:
+        if(idle)
+          goto illegal;
+        if(arg >= blocks())
+        {
+          r1(0x40);
+          break;
+        }
+        r1(0);
+        block = arg;
+        if(c == 17)
+        {
+          sendBlock(block);
+          blocks_read++;
+        }
+        else if(c == 18)
+          reading = true;
+        else
+        {
+          multi = c == 25;
+          state = WAIT_TOKEN;
+        }
+        break;
+      default:
+      illegal:
+        bad_commands++;
+        r1(st | 0x04);
+    }
+  }
+
+  void dataBlock()
+  {
+    uint16_t crc = 0;
+    for(int i = 0; i < 512; i++)
+      crc = sd_crc16(crc, data[i]);
+    if(crc_on && crc != (data[512] << 8 | data[513]))
+    {
+      data_crc_errors++;
+      out.push_back(0x0B);
+    }
+    else if(write_fail)
+      out.push_back(0x0D);
+    else
+    {
+      memcpy(&image[block * 512], data, 512);
+      blocks_written++;
+      block++;
+      out.push_back(0x05);
+    }
+    out.push_back(0x00);  // busy while programming
+    out.push_back(0x00);
+    state = multi && block < blocks() ? WAIT_TOKEN : CMD_IDLE;
+  }
+
+  uint8_t transfer(uint8_t mosi)
+  {
+    // every transfer takes time, a firmware loop waiting for the card can't hang the test
+    if(++transfers % 1000 == 0)
+      host_millis++;
+    if(out.empty() && reading)
+    {
+      if(block < blocks())
+      {
+        sendBlock(block++);
+        blocks_read++;
+      }
+      else
+        reading = false;
+    }
+    uint8_t miso = 0xFF;
+    if(!out.empty())
+    {
+      miso = out.front();
+      out.pop_front();
+    }
+    switch(state)
+    {
+      case CMD_IDLE:
+        if((mosi & 0xC0) == 0x40)
+        {
+          cmd[0] = mosi;
+          cmd_len = 1;
+          state = CMD_BYTES;
+        }
+        break;
+      case CMD_BYTES:
+        cmd[cmd_len++] = mosi;
+        if(cmd_len == 6)
+        {
+          state = CMD_IDLE;
+          command();
+        }
+        break;
+      case WAIT_TOKEN:
+        if(mosi == (multi ? 0xFC : 0xFE))
+        {
+          data_len = 0;
+          state = DATA;
+        }
+        else if(multi && mosi == 0xFD)
+        {
+          out.push_back(0xFF);
+          out.push_back(0x00);
+          state = CMD_IDLE;
+        }
+        else if(!multi && (mosi & 0xC0) == 0x40)
+        {
+          cmd[0] = mosi;
+          cmd_len = 1;
+          state = CMD_BYTES;
+        }
+        break;
+      case DATA:
+        data[data_len++] = mosi;
+        if(data_len == 514)
+          dataBlock();
+        break;
+    }
+    return miso;
+  }
+
+  // A FAT16 volume over the whole card without a partition table, as SdVolume::init() takes it
+  // for part 0: 2 blocks a cluster, 2 FATs, 512 root entries.
+  enum {RESERVED = 1, FATS = 2, ROOT_ENTRIES = 512, SPC = 2};
+  uint32_t fat_blocks = 0, root_start = 0, data_start = 0, clusters = 0;
+  int root_used = 0;
+  std::vector<bool> cluster_used;
+
+  static void put16(uint8_t *p, uint16_t v) { p[0] = v; p[1] = v >> 8; }
+  static void put32(uint8_t *p, uint32_t v) { put16(p, v); put16(p + 2, v >> 16); }
+
+  void format()
+  {
+    std::fill(image.begin(), image.end(), 0);
+    uint32_t total = blocks();
+    fat_blocks = ((total / SPC + 2) * 2 + 511) / 512;
+    root_start = RESERVED + FATS * fat_blocks;
+    data_start = root_start + ROOT_ENTRIES * 32 / 512;
+    clusters = (total - data_start) / SPC;
+    uint8_t *b = &image[0];
+    b[0] = 0xEB; b[1] = 0x3C; b[2] = 0x90;
+    memcpy(b + 3, "MSWIN4.1", 8);
+    put16(b + 11, 512);
+    b[13] = SPC;
+    put16(b + 14, RESERVED);
+    b[16] = FATS;
+    put16(b + 17, ROOT_ENTRIES);
+    if(total < 0x10000)
+      put16(b + 19, total);
+    else
+      put32(b + 32, total);
+    b[21] = 0xF8;
+    put16(b + 22, fat_blocks);
+    b[38] = 0x29;
+    memcpy(b + 54, "FAT16   ", 8);
+    b[510] = 0x55; b[511] = 0xAA;
+    cluster_used.assign(clusters + 2, false);
+    cluster_used[0] = cluster_used[1] = true;
+    setFat(0, 0xFFF8);
+    setFat(1, 0xFFFF);
+    root_used = 0;
+  }
+
+  void setFat(uint32_t cluster, uint16_t next)
+  {
+    for(int f = 0; f < FATS; f++)
+      put16(&image[(RESERVED + f * fat_blocks) * 512 + cluster * 2], next);
+  }
+
+  // Writes a file into the root directory, name as in a directory entry ("TEST    G  "). Spread
+  // puts the clusters in random free places instead of one after the other. Returns the first
+  // cluster, 0 when the card is full.
+  uint32_t addFile(const char *name83, const std::vector<uint8_t> &content, bool spread = false, unsigned seed = 1)
+  {
+    std::mt19937 rng(seed);
+    uint32_t n = (content.size() + SPC * 512 - 1) / (SPC * 512);
+    std::vector<uint32_t> chain;
+    for(uint32_t c = 2; c < clusters + 2 && chain.size() < n; c++)
+      if(!cluster_used[c])
+        chain.push_back(c);
+    if(chain.size() < n || root_used == ROOT_ENTRIES)
+      return 0;
+    if(spread)
+    {
+      std::vector<uint32_t> all;
+      for(uint32_t c = 2; c < clusters + 2; c++)
+        if(!cluster_used[c])
+          all.push_back(c);
+      std::shuffle(all.begin(), all.end(), rng);
+      // mostly runs of a few clusters, which is what a used card looks like
+      chain.clear();
+      for(size_t i = 0; chain.size() < n; i++)
+        for(uint32_t c = all[i], k = rng() % 4 + 1; k && chain.size() < n && c < clusters + 2 && !cluster_used[c]; c++, k--)
+        {
+          if(std::find(chain.begin(), chain.end(), c) != chain.end())
+            break;
+          chain.push_back(c);
+        }
+    }
+    for(uint32_t i = 0; i < n; i++)
+    {
+      cluster_used[chain[i]] = true;
+      setFat(chain[i], i + 1 < n ? chain[i + 1] : 0xFFFF);
+      size_t off = i * SPC * 512;
+      size_t len = std::min<size_t>(content.size() - off, SPC * 512);
+      memcpy(&image[(data_start + (chain[i] - 2) * SPC) * 512], &content[off], len);
+    }
+    uint8_t *d = &image[root_start * 512 + root_used++ * 32];
+    memcpy(d, name83, 11);
+    d[11] = 0x20;  // archive
+    put16(d + 26, n ? chain[0] : 0);
+    put32(d + 28, content.size());
+    return n ? chain[0] : 0;
+  }
+
+  // The content of a file the firmware wrote into the root directory, empty if there is none
+  std::vector<uint8_t> readFile(const char *name83)
+  {
+    std::vector<uint8_t> content;
+    for(int e = 0; e < ROOT_ENTRIES; e++)
+    {
+      const uint8_t *d = &image[root_start * 512 + e * 32];
+      if(d[0] == 0)
+        break;
+      if(d[0] == 0xE5 || memcmp(d, name83, 11))
+        continue;
+      uint32_t size = d[28] | d[29] << 8 | d[30] << 16 | (uint32_t)d[31] << 24;
+      uint32_t c = d[26] | d[27] << 8;
+      while(content.size() < size && c >= 2 && c < clusters + 2)
+      {
+        const uint8_t *p = &image[(data_start + (c - 2) * SPC) * 512];
+        content.insert(content.end(), p, p + std::min<size_t>(size - content.size(), SPC * 512));
+        c = image[(RESERVED * 512) + c * 2] | image[(RESERVED * 512) + c * 2 + 1] << 8;
+      }
+      break;
+    }
+    return content;
+  }
+};
+
+inline SdCardModel *host_card;
+inline uint8_t host_card_transfer(uint8_t mosi) { return host_card->transfer(mosi); }
+
+// Puts a card into the slot, SPDR talks to it from now on
+inline void host_insert_card(SdCardModel *card)
+{
+  host_card = card;
+  host_spi_transfer = card ? host_card_transfer : 0;
+}
+
+#endif
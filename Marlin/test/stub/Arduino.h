@@ -0,0 +1,44 @@
+// Host stand-in for the Arduino core: time comes from host_millis, which the tests advance
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <math.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include "WString.h"
+
+// avr-libc has no fpos_t, SdBaseFile.h declares its own
+#define fpos_t sd_fpos_t
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+
+#define min(a,b) ((a)<(b)?(a):(b))
+#define max(a,b) ((a)>(b)?(a):(b))
+#define constrain(amt,low,high) ((amt)<(low)?(low):((amt)>(high)?(high):(amt)))
+#define sq(x) ((x)*(x))
+#define radians(deg) ((deg)*M_PI/180.0)
+#define degrees(rad) ((rad)*180.0/M_PI)
+
+inline unsigned long host_millis = 0;
+inline unsigned long millis() { return host_millis; }
+inline unsigned long micros() { return host_millis * 1000; }
+inline void delay(unsigned long ms) { host_millis += ms; }
+inline void delayMicroseconds(unsigned int) {}
+
+inline void pinMode(uint8_t, uint8_t) {}
+inline void digitalWrite(uint8_t, uint8_t) {}
+inline int digitalRead(uint8_t) { return LOW; }
+inline void analogWrite(uint8_t, int) {}
+inline int analogRead(uint8_t) { return 0; }
+
+#endif
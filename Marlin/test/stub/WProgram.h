@@ -0,0 +1,2 @@
+// Host stand-in for the pre-1.0 Arduino core header
+#include "Arduino.h"
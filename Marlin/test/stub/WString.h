@@ -0,0 +1,17 @@
+// Host stand-in for the Arduino String class, only what MarlinSerial uses
+#ifndef HOST_WSTRING_H
+#define HOST_WSTRING_H
+
+#include <string.h>
+
+class String
+{
+  public:
+    String(const char *s = "") : s_(s) {}
+    unsigned int length() const { return strlen(s_); }
+    char operator[](unsigned int i) const { return s_[i]; }
+  private:
+    const char *s_;
+};
+
+#endif
@@ -0,0 +1,11 @@
+// Host stand-in for <avr/eeprom.h>: 4 KB of EEPROM in RAM
+#ifndef HOST_AVR_EEPROM_H
+#define HOST_AVR_EEPROM_H
+
+#include <stdint.h>
+
+inline uint8_t host_eeprom[4096];
+inline uint8_t eeprom_read_byte(const uint8_t *p) { return host_eeprom[(uintptr_t)p % sizeof(host_eeprom)]; }
+inline void eeprom_write_byte(uint8_t *p, uint8_t v) { host_eeprom[(uintptr_t)p % sizeof(host_eeprom)] = v; }
+
+#endif
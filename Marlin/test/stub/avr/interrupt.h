@@ -0,0 +1,15 @@
+// Host stand-in for <avr/interrupt.h>: interrupt handlers are functions a test calls itself
+#ifndef HOST_AVR_INTERRUPT_H
+#define HOST_AVR_INTERRUPT_H
+#include "io.h"
+#define ISR(vector) void vector(void)
+#define SIGNAL(vector) void vector(void)
+#define cli() (SREG &= ~(1 << SREG_I))
+#define sei() (SREG |= (1 << SREG_I))
+#define USART0_RX_vect host_usart0_rx
+#define USART1_RX_vect host_usart1_rx
+#define USART1_UDRE_vect host_usart1_udre
+#define TIMER0_COMPB_vect host_timer0_compb
+#define TIMER1_COMPA_vect host_timer1_compa
+#define ADC_vect host_adc
+#endif
@@ -0,0 +1,110 @@
+// Host stand-in for <avr/io.h>: the registers the firmware touches are plain variables, so the
+// sources compile with g++ and a test can set what the hardware would return. Bit numbers are the
+// ATmega2560's.
+#ifndef HOST_AVR_IO_H
+#define HOST_AVR_IO_H
+
+#include <stdint.h>
+
+#define HOST_REG8(name) inline volatile uint8_t name;
+#define HOST_REG16(name) inline volatile uint16_t name;
+
+#define _BV(bit) (1 << (bit))
+#define _SFR_BYTE(sfr) (sfr)
+
+#include "io_ports.h"
+
+HOST_REG8(SREG)
+#define SREG_I 7
+
+// USART0, UDR0 is a queue both ways so a test can feed and read the serial port
+struct host_udr {
+  uint8_t rx[1024];
+  unsigned rx_head, rx_tail;
+  char tx[16384];
+  unsigned tx_len;
+  host_udr &operator=(uint8_t c) { if(tx_len < sizeof(tx) - 1) tx[tx_len++] = c; tx[tx_len] = 0; return *this; }
+  operator uint8_t() { return rx_head != rx_tail ? rx[rx_tail++ % sizeof(rx)] : 0; }
+};
+inline host_udr UDR0;
+#define UDR0 UDR0
+// the transmitter is always ready, a byte is received while the test has queued one
+struct host_ucsra {
+  uint8_t value;
+  host_ucsra &operator=(uint8_t c) { value = c; return *this; }
+  operator uint8_t() const { return value | 1 << 5 | (UDR0.rx_head != UDR0.rx_tail) << 7; }
+};
+inline host_ucsra UCSR0A;
+HOST_REG8(UCSR0B) HOST_REG8(UBRR0H) HOST_REG8(UBRR0L)
+#define UBRR0H UBRR0H
+#define RXC0 7
+#define UDRE0 5
+#define U2X0 1
+#define RXEN0 4
+#define TXEN0 3
+#define RXCIE0 7
+#define UDRIE0 5
+HOST_REG8(UDR1) HOST_REG8(UCSR1A) HOST_REG8(UCSR1B) HOST_REG8(UBRR1H) HOST_REG8(UBRR1L)
+#define RXC1 7
+#define UDRE1 5
+#define U2X1 1
+#define RXEN1 4
+#define TXEN1 3
+#define RXCIE1 7
+#define UDRIE1 5
+
+// ADC
+HOST_REG8(ADMUX) HOST_REG8(ADCSRA) HOST_REG8(ADCSRB) HOST_REG8(DIDR0) HOST_REG8(DIDR2)
+HOST_REG16(ADC)
+#define REFS0 6
+#define ADEN 7
+#define ADSC 6
+#define ADIF 4
+#define ADIE 3
+#define MUX5 3
+
+// timers
+HOST_REG8(TCCR0A) HOST_REG8(TCCR0B) HOST_REG8(OCR0A) HOST_REG8(OCR0B) HOST_REG8(TIMSK0) HOST_REG8(TCNT0)
+HOST_REG8(TCCR1A) HOST_REG8(TCCR1B) HOST_REG8(TIMSK1) HOST_REG16(OCR1A) HOST_REG16(TCNT1)
+HOST_REG8(TCCR2A) HOST_REG8(TCCR2B) HOST_REG8(OCR2A) HOST_REG8(OCR2B)
+#define OCIE0B 2
+#define OCIE1A 1
+#define WGM12 3
+#define WGM13 4
+#define CS10 0
+#define CS11 1
+#define CS12 2
+
+// SPI, SPDR answers from the card model of the test. A write starts a transfer that the next
+// read of SPSR finds done; writing or reading SPDR before that is what WCOL and a stale byte are
+// on the chip, and is counted.
+inline uint8_t (*host_spi_transfer)(uint8_t) = 0;
+inline bool host_spi_busy = false;
+inline uint32_t host_spi_collisions = 0, host_spi_early_reads = 0;
+struct host_spdr {
+  uint8_t last;
+  host_spdr &operator=(uint8_t c) {
+    if(host_spi_busy) host_spi_collisions++;
+    host_spi_busy = true;
+    last = host_spi_transfer ? host_spi_transfer(c) : 0xFF;
+    return *this;
+  }
+  operator uint8_t() const { if(host_spi_busy) host_spi_early_reads++; return last; }
+};
+inline host_spdr SPDR;
+HOST_REG8(SPCR)
+// SPIF reads as set whatever spiInit() writes
+struct host_spsr {
+  uint8_t value;
+  host_spsr &operator=(uint8_t c) { value = c; return *this; }
+  operator uint8_t() const { host_spi_busy = false; return value | 1 << 7; }
+};
+inline host_spsr SPSR;
+#define SPIF 7
+#define SPI2X 0
+#define SPE 6
+#define MSTR 4
+#define SPR0 0
+#define SPR1 1
+
+#endif
@@ -0,0 +1,276 @@
+// The GPIO registers of the ATmega2560 and their bit names, for fastio.h and pins.h
+HOST_REG8(PORTA) HOST_REG8(PINA) HOST_REG8(DDRA)
+HOST_REG8(PORTB) HOST_REG8(PINB) HOST_REG8(DDRB)
+HOST_REG8(PORTC) HOST_REG8(PINC) HOST_REG8(DDRC)
+HOST_REG8(PORTD) HOST_REG8(PIND) HOST_REG8(DDRD)
+HOST_REG8(PORTE) HOST_REG8(PINE) HOST_REG8(DDRE)
+HOST_REG8(PORTF) HOST_REG8(PINF) HOST_REG8(DDRF)
+HOST_REG8(PORTG) HOST_REG8(PING) HOST_REG8(DDRG)
+HOST_REG8(PORTH) HOST_REG8(PINH) HOST_REG8(DDRH)
+HOST_REG8(PORTJ) HOST_REG8(PINJ) HOST_REG8(DDRJ)
+HOST_REG8(PORTK) HOST_REG8(PINK) HOST_REG8(DDRK)
+HOST_REG8(PORTL) HOST_REG8(PINL) HOST_REG8(DDRL)
+#define PA0 0
+#define PA1 1
+#define PA2 2
+#define PA3 3
+#define PA4 4
+#define PA5 5
+#define PA6 6
+#define PA7 7
+#define PINA0 0
+#define PINA1 1
+#define PINA2 2
+#define PINA3 3
+#define PINA4 4
+#define PINA5 5
+#define PINA6 6
+#define PINA7 7
+#define DDA0 0
+#define DDA1 1
+#define DDA2 2
+#define DDA3 3
+#define DDA4 4
+#define DDA5 5
+#define DDA6 6
+#define DDA7 7
+#define PB0 0
+#define PB1 1
+#define PB2 2
+#define PB3 3
+#define PB4 4
+#define PB5 5
+#define PB6 6
+#define PB7 7
+#define PINB0 0
+#define PINB1 1
+#define PINB2 2
+#define PINB3 3
+#define PINB4 4
+#define PINB5 5
+#define PINB6 6
+#define PINB7 7
+#define DDB0 0
+#define DDB1 1
+#define DDB2 2
+#define DDB3 3
+#define DDB4 4
+#define DDB5 5
+#define DDB6 6
+#define DDB7 7
+#define PC0 0
+#define PC1 1
+#define PC2 2
+#define PC3 3
+#define PC4 4
+#define PC5 5
+#define PC6 6
+#define PC7 7
+#define PINC0 0
+#define PINC1 1
+#define PINC2 2
+#define PINC3 3
+#define PINC4 4
+#define PINC5 5
+#define PINC6 6
+#define PINC7 7
+#define DDC0 0
+#define DDC1 1
+#define DDC2 2
+#define DDC3 3
+#define DDC4 4
+#define DDC5 5
+#define DDC6 6
+#define DDC7 7
+#define PD0 0
+#define PD1 1
+#define PD2 2
+#define PD3 3
+#define PD4 4
+#define PD5 5
+#define PD6 6
+#define PD7 7
+#define PIND0 0
+#define PIND1 1
+#define PIND2 2
+#define PIND3 3
+#define PIND4 4
+#define PIND5 5
+#define PIND6 6
+#define PIND7 7
+#define DDD0 0
+#define DDD1 1
+#define DDD2 2
+#define DDD3 3
+#define DDD4 4
+#define DDD5 5
+#define DDD6 6
+#define DDD7 7
+#define PE0 0
+#define PE1 1
+#define PE2 2
+#define PE3 3
+#define PE4 4
+#define PE5 5
+#define PE6 6
+#define PE7 7
+#define PINE0 0
+#define PINE1 1
+#define PINE2 2
+#define PINE3 3
+#define PINE4 4
+#define PINE5 5
+#define PINE6 6
+#define PINE7 7
+#define DDE0 0
+#define DDE1 1
+#define DDE2 2
+#define DDE3 3
+#define DDE4 4
+#define DDE5 5
+#define DDE6 6
+#define DDE7 7
+#define PF0 0
+#define PF1 1
+#define PF2 2
+#define PF3 3
+#define PF4 4
+#define PF5 5
+#define PF6 6
+#define PF7 7
+#define PINF0 0
+#define PINF1 1
+#define PINF2 2
+#define PINF3 3
+#define PINF4 4
+#define PINF5 5
+#define PINF6 6
+#define PINF7 7
+#define DDF0 0
+#define DDF1 1
+#define DDF2 2
+#define DDF3 3
+#define DDF4 4
+#define DDF5 5
+#define DDF6 6
+#define DDF7 7
+#define PG0 0
+#define PG1 1
+#define PG2 2
+#define PG3 3
+#define PG4 4
+#define PG5 5
+#define PG6 6
+#define PG7 7
+#define PING0 0
+#define PING1 1
+#define PING2 2
+#define PING3 3
+#define PING4 4
+#define PING5 5
+#define PING6 6
+#define PING7 7
+#define DDG0 0
+#define DDG1 1
+#define DDG2 2
+#define DDG3 3
+#define DDG4 4
+#define DDG5 5
+#define DDG6 6
+#define DDG7 7
+#define PH0 0
+#define PH1 1
+#define PH2 2
+#define PH3 3
+#define PH4 4
+#define PH5 5
+#define PH6 6
+#define PH7 7
+#define PINH0 0
+#define PINH1 1
+#define PINH2 2
+#define PINH3 3
+#define PINH4 4
+#define PINH5 5
+#define PINH6 6
+#define PINH7 7
+#define DDH0 0
+#define DDH1 1
+#define DDH2 2
+#define DDH3 3
+#define DDH4 4
+#define DDH5 5
+#define DDH6 6
+#define DDH7 7
+#define PJ0 0
+#define PJ1 1
+#define PJ2 2
+#define PJ3 3
+#define PJ4 4
+#define PJ5 5
+#define PJ6 6
+#define PJ7 7
+#define PINJ0 0
+#define PINJ1 1
+#define PINJ2 2
+#define PINJ3 3
+#define PINJ4 4
+#define PINJ5 5
+#define PINJ6 6
+#define PINJ7 7
+#define DDJ0 0
+#define DDJ1 1
+#define DDJ2 2
+#define DDJ3 3
+#define DDJ4 4
+#define DDJ5 5
+#define DDJ6 6
+#define DDJ7 7
+#define PK0 0
+#define PK1 1
+#define PK2 2
+#define PK3 3
+#define PK4 4
+#define PK5 5
+#define PK6 6
+#define PK7 7
+#define PINK0 0
+#define PINK1 1
+#define PINK2 2
+#define PINK3 3
+#define PINK4 4
+#define PINK5 5
+#define PINK6 6
+#define PINK7 7
+#define DDK0 0
+#define DDK1 1
+#define DDK2 2
+#define DDK3 3
+#define DDK4 4
+#define DDK5 5
+#define DDK6 6
+#define DDK7 7
+#define PL0 0
+#define PL1 1
+#define PL2 2
+#define PL3 3
+#define PL4 4
+#define PL5 5
+#define PL6 6
+#define PL7 7
+#define PINL0 0
+#define PINL1 1
+#define PINL2 2
+#define PINL3 3
+#define PINL4 4
+#define PINL5 5
+#define PINL6 6
+#define PINL7 7
+#define DDL0 0
+#define DDL1 1
+#define DDL2 2
+#define DDL3 3
+#define DDL4 4
+#define DDL5 5
+#define DDL6 6
+#define DDL7 7
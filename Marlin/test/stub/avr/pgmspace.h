@@ -0,0 +1,28 @@
+// Host stand-in for <avr/pgmspace.h>: flash is ordinary memory
+#ifndef HOST_AVR_PGMSPACE_H
+#define HOST_AVR_PGMSPACE_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define PROGMEM
+#define PGM_P const char *
+#define PSTR(s) (s)
+typedef char prog_char;
+inline uint8_t host_pgm_byte(const void *p) { uint8_t v; memcpy(&v, p, 1); return v; }
+inline uint16_t host_pgm_word(const void *p) { uint16_t v; memcpy(&v, p, 2); return v; }
+inline uint32_t host_pgm_dword(const void *p) { uint32_t v; memcpy(&v, p, 4); return v; }
+inline float host_pgm_float(const void *p) { float v; memcpy(&v, p, 4); return v; }
+#define pgm_read_byte(p) host_pgm_byte(p)
+#define pgm_read_word(p) host_pgm_word(p)
+#define pgm_read_dword(p) host_pgm_dword(p)
+#define pgm_read_float(p) host_pgm_float(p)
+#define pgm_read_byte_near(p) host_pgm_byte(p)
+#define pgm_read_word_near(p) host_pgm_word(p)
+#define strcpy_P strcpy
+#define strncpy_P strncpy
+#define strcmp_P strcmp
+#define strlen_P strlen
+#define memcpy_P memcpy
+
+#endif
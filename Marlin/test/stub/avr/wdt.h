@@ -0,0 +1,8 @@
+// Host stand-in for <avr/wdt.h>
+#ifndef HOST_AVR_WDT_H
+#define HOST_AVR_WDT_H
+#define wdt_reset()
+#define wdt_enable(t)
+#define wdt_disable()
+#define WDTO_4S 8
+#endif
@@ -0,0 +1,28 @@
+// Minimal checks for the host tests: a failed CHECK prints where and what, the program then
+// exits non-zero from test_result().
+#ifndef TEST_H
+#define TEST_H
+
+#include <stdio.h>
+
+inline int test_failures = 0;
+inline int test_checks = 0;
+
+#define CHECK(cond, ...) do { \
+    test_checks++; \
+    if(!(cond)) { \
+      if(++test_failures <= 20) { \
+        printf("%s:%d: CHECK(%s) failed: ", __FILE__, __LINE__, #cond); \
+        printf(__VA_ARGS__); \
+        printf("\n"); \
+      } \
+    } \
+  } while(0)
+
+inline int test_result(const char *name)
+{
+  printf("%s: %d checks, %d failed\n", name, test_checks, test_failures);
+  return test_failures ? 1 : 0;
+}
+
+#endif
@@ -0,0 +1,334 @@
+// An M560 upload from the UART to a file on a simulated card: frames full of the bytes the real-time
+// commands react to (0x18 kill, '!' feed hold, '?' status, '~' resume) in the sequence number, the
+// length, the data and the CRC go through the RX interrupt and checkRx() into the ring while the
+// transfer is on, and from there through binaryByte(), as get_binary_frames() in Marlin.pde does.
+// None of them may raise a real-time flag or get lost, a damaged frame is asked for again, and
+// the file on the card ends up as sent. After the transfer the real-time commands work again.
+// A transfer that fails, on a write error or a host gone quiet, keeps the frames still coming, which
+// hold G-code text, away from the line parser until the abort frame or BINARY_TIMEOUT of quiet.
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include "test.h"
+#include "sdcard_model.h"
+
+#include "../MarlinSerial.cpp"
+#include "../fixedpoint.cpp"
+#include "../temperature.cpp"
+#include "../Sd2Card.cpp"
+#include "../SdVolume.cpp"
+#include "../SdBaseFile.cpp"
+#include "../SdFile.cpp"
+#include "../cardreader.cpp"
+#include "marlin_stubs.h"
+
+CardReader card;
+
+static std::mt19937 rng(45);
+static const uint8_t special[] = {RT_CMD_KILL, RT_CMD_FEED_HOLD, RT_CMD_STATUS, RT_CMD_RESUME};
+
+static std::vector<uint8_t> frame(uint8_t seq, const uint8_t *data, uint16_t len)
+{
+  std::vector<uint8_t> f = {0xA5, seq, (uint8_t)len, (uint8_t)(len >> 8)};
+  f.insert(f.end(), data, data + len);
+  uint16_t crc = 0;
+  for(size_t i = 1; i < f.size(); i++)
+    crc = _crc_xmodem_update(crc, f[i]);
+  f.push_back(crc & 0xFF);
+  f.push_back(crc >> 8);
+  return f;
+}
+
+// the bytes arrive on the wire: half of them taken by the RX interrupt, half by checkRx() from the stepper interrupt
+static void receive(const std::vector<uint8_t> &bytes)
+{
+  for(uint8_t c : bytes)
+  {
+    UDR0.rx[UDR0.rx_head++ % sizeof(UDR0.rx)] = c;
+    if(rng() & 1)
+      host_usart0_rx();
+    else
+      MSerial.checkRx();
+  }
+}
+
+// get_binary_frames()
+static void main_loop()
+{
+  while(MYSERIAL.available() > 0 && card.binaryActive())
+    card.binaryByte(MYSERIAL.read());
+  card.binaryIdle();
+}
+
+// get_command(): the frames first, then the bytes of a port that isn't binary go to the line parser
+static std::vector<std::string> queued;
+
+static void command_loop()
+{
+  static std::string line;
+  main_loop();
+  while(!card.binaryActive() && MYSERIAL.available() > 0)
+  {
+    char c = MYSERIAL.read();
+    if(c == '\n' || c == '\r')
+    {
+      if(!line.empty())
+        queued.push_back(line);
+      line.clear();
+    }
+    else
+      line += c;
+  }
+}
+
+static std::string replies()
+{
+  std::string s(UDR0.tx, UDR0.tx_len);
+  UDR0.tx_len = 0;
+  UDR0.tx[0] = 0;
+  return s;
+}
+
+static void test_upload()
+{
+  SdCardModel sd(16384);
+  sd.format();
+  host_insert_card(&sd);
+  card.initsd();
+  CHECK(card.cardOK, "card not initialised");
+  replies();
+
+  char name[] = "up.bin";
+  card.binaryStart(name, 0);
+  std::string r = replies();
+  CHECK(card.binaryActive() && (rt_binary_ports & 1), "M560 didn't start: %s", r.c_str());
+  char want_ready[64];
+  snprintf(want_ready, sizeof(want_ready), MSG_BT_READY "%d" MSG_BT_WINDOW "%d\n", BINARY_FRAME_SIZE, (int)BINARY_WINDOW);
+  CHECK(r.find(want_ready) != std::string::npos, "M560 answered \"%s\"", r.c_str());
+
+  // mostly the real-time bytes, some line ends and 0xA5 as well; frame 24 has the sequence number 0x18,
+  // full frames come two in a row, to fill the ring
+  std::vector<uint8_t> content;
+  int frames = 300;
+  int seen[4][4] = {}; // special byte x where: sequence, length, data, CRC
+  std::vector<std::vector<uint8_t> > sent;
+  for(int k = 0; k < frames; k++)
+  {
+    uint8_t data[BINARY_FRAME_SIZE];
+    uint16_t len = k % 7 == 0 ? RT_CMD_KILL : k % 7 == 1 ? RT_CMD_FEED_HOLD : k % 7 <= 3 ? BINARY_FRAME_SIZE : rng() % BINARY_FRAME_SIZE + 1;
+    for(int i = 0; i < len; i++)
+      data[i] = rng() % 3 ? special[rng() % 4] : rng() % 2 ? "\n\r\xA5"[rng() % 3] : rng();
+    std::vector<uint8_t> f = frame(k, data, len);
+    // and one of them in the CRC, by trying the last two data bytes
+    for(int t = 0; k % 5 == 0 && len >= 2 && t < 65536; t++)
+    {
+      uint8_t c = special[k / 5 % 4];
+      if(f[f.size() - 2] == c || f[f.size() - 1] == c)
+        break;
+      data[len - 2] = t;
+      data[len - 1] = t >> 8;
+      f = frame(k, data, len);
+    }
+    for(int x = 0; x < 4; x++)
+    {
+      seen[x][0] += f[1] == special[x];
+      seen[x][1] += f[2] == special[x] || f[3] == special[x];
+      seen[x][2] += memchr(data, special[x], len) != 0;
+      seen[x][3] += f[f.size() - 2] == special[x] || f[f.size() - 1] == special[x];
+    }
+    content.insert(content.end(), data, data + len);
+    sent.push_back(f);
+  }
+  for(int x = 0; x < 4; x++)
+    CHECK(seen[x][0] && (seen[x][1] || special[x] > BINARY_FRAME_SIZE) && seen[x][2] && seen[x][3],
+          "0x%02x wasn't in every part of a frame: %d %d %d %d", special[x], seen[x][0], seen[x][1], seen[x][2], seen[x][3]);
+  sent.push_back(frame(frames, 0, 0));  // the end
+
+  // a window of frames at a time, all in the ring before the main loop gets to them
+  size_t next = 0;
+  int damaged = 0, resends = 0;
+  for(int round = 0; next < sent.size() && card.binaryActive() && round < 10000; round++)
+  {
+    size_t n = std::min<size_t>(BINARY_WINDOW, sent.size() - next), bytes = 0;
+    for(size_t i = 0; i < n; i++)
+    {
+      std::vector<uint8_t> f = sent[next + i];
+      if(rng() % 20 == 0)
+      {
+        f[rng() % f.size()] ^= 1 << rng() % 8;  // damaged on the wire
+        damaged++;
+      }
+      receive(f);
+      bytes += f.size();
+    }
+    CHECK(MYSERIAL.available() == (int)bytes, "%d bytes of %d in the ring", MYSERIAL.available(), (int)bytes);
+    main_loop();
+    CHECK(rt_command_flags == 0 && !rt_feed_hold, "real-time flags %d, hold %d after frame %d", rt_command_flags, rt_feed_hold, (int)next);
+    rt_command_flags = 0;
+    rt_feed_hold = false;
+    // the host goes on after the last ack; without one it waits for the printer to ask again
+    r = replies();
+    size_t acked = next, p = 0;
+    while((p = r.find(MSG_BT_ACK, p)) != std::string::npos)
+    {
+      p += strlen(MSG_BT_ACK);
+      CHECK(atoi(r.c_str() + p) == (int)(next & 0xFF), "ack %d, expected %d", atoi(r.c_str() + p), (int)(next & 0xFF));
+      next++;
+    }
+    if(next == acked && card.binaryActive())
+    {
+      host_millis += BINARY_TIMEOUT;
+      main_loop();
+      r += replies();
+    }
+    if((p = r.find(MSG_BT_RESEND)) != std::string::npos)
+    {
+      CHECK(atoi(r.c_str() + p + strlen(MSG_BT_RESEND)) == (int)(next & 0xFF), "resend %d, expected %d",
+            atoi(r.c_str() + p + strlen(MSG_BT_RESEND)), (int)(next & 0xFF));
+      resends++;
+    }
+  }
+  CHECK(next == sent.size(), "transfer stopped at frame %d of %d", (int)next, (int)sent.size());
+  CHECK(damaged > 0 && resends > 0, "no frame was damaged (%d) or asked for again (%d)", damaged, resends);
+  CHECK(card.binaryDone() && rt_binary_ports == 0, "the end frame didn't end the transfer");
+  card.closefile();  // M29
+  std::vector<uint8_t> got = sd.readFile("UP      BIN");
+  CHECK(got == content, "the file has %d bytes, %d were sent%s", (int)got.size(), (int)content.size(),
+        got.size() == content.size() ? ", they differ" : "");
+
+  // the real-time commands are back on the port
+  receive({'\n', RT_CMD_STATUS});
+  CHECK(rt_command_flags == RT_FLAG_STATUS, "'?' after the transfer gave flags %d", rt_command_flags);
+  receive({RT_CMD_FEED_HOLD});
+  CHECK(rt_feed_hold, "'!' after the transfer didn't hold");
+  receive({RT_CMD_RESUME});
+  CHECK(!rt_feed_hold, "'~' after the transfer didn't resume");
+  receive({'G', RT_CMD_KILL});
+  CHECK(rt_command_flags & RT_FLAG_KILL, "ctrl-x after the transfer gave flags %d", rt_command_flags);
+  CHECK(MYSERIAL.available() == 2 && MYSERIAL.read() == '\n' && MYSERIAL.read() == 'G', "only the line bytes go to the ring");
+  rt_command_flags = 0;
+  host_insert_card(0);
+}
+
+static std::vector<std::vector<uint8_t> > gcode_frames(int n)
+{
+  std::string text;
+  for(int i = 0; text.size() < (size_t)n * BINARY_FRAME_SIZE; i++)
+    text += "G1 X" + std::to_string(i % 200) + " Y" + std::to_string(i * 7 % 200) + " E" + std::to_string(i) + "\n";
+  std::vector<std::vector<uint8_t> > frames;
+  for(int k = 0; k < n; k++)
+    frames.push_back(frame(k, (const uint8_t*)text.data() + k * BINARY_FRAME_SIZE, BINARY_FRAME_SIZE));
+  return frames;
+}
+
+static uint8_t abort_frame[] = {0xA5, 0, 0xFF, 0xFF, 0, 0};
+
+// the card stops taking blocks in the middle of an upload of G-code, with a window of frames in flight
+static void test_write_error(bool abort)
+{
+  SdCardModel sd(16384);
+  sd.format();
+  host_insert_card(&sd);
+  card.initsd();
+  CHECK(card.cardOK, "card not initialised");
+  char name[] = "fail.g";
+  card.binaryStart(name, 0);
+  replies();
+  queued.clear();
+  sd.write_fail = true;
+
+  std::vector<std::vector<uint8_t> > sent = gcode_frames(40);
+  size_t next = 0;
+  std::string r;
+  for(int round = 0; next < sent.size() && r.find("Error") == std::string::npos && round < 1000; round++)
+  {
+    for(size_t i = next; i < next + BINARY_WINDOW && i < sent.size(); i++)
+      receive(sent[i]);
+    command_loop();
+    r = replies();
+    for(size_t p = 0; (p = r.find(MSG_BT_ACK, p)) != std::string::npos; p++)
+      next++;
+  }
+  CHECK(r.find(MSG_SD_ERR_WRITE_TO_FILE) != std::string::npos, "no write error after %d frames: %s", (int)next, r.c_str());
+  CHECK(next < sent.size() - BINARY_WINDOW, "the write error came too late, at frame %d", (int)next);
+  CHECK(card.binaryActive() && (rt_binary_ports & 1), "the port isn't dropping frames after the error");
+
+  // the host hasn't seen the error yet and sends the next window, then stops
+  for(size_t i = next + 1; i < next + 1 + BINARY_WINDOW && i < sent.size(); i++)
+    receive(sent[i]);
+  command_loop();
+  if(abort)
+  {
+    uint16_t crc = 0;
+    for(int i = 1; i < 4; i++)
+      crc = _crc_xmodem_update(crc, abort_frame[i]);
+    abort_frame[4] = crc;
+    abort_frame[5] = crc >> 8;
+    receive(std::vector<uint8_t>(abort_frame, abort_frame + sizeof(abort_frame)));
+  }
+  for(int i = 0; i < 5; i++)
+  {
+    host_millis += BINARY_TIMEOUT / 10;
+    command_loop();
+  }
+  CHECK(queued.empty(), "%d commands from the frames were queued, the first \"%s\"", (int)queued.size(), queued.empty() ? "" : queued[0].c_str());
+  CHECK(MYSERIAL.available() == 0, "%d bytes left in the ring", MYSERIAL.available());
+  r = replies();
+  CHECK(r.find(MSG_BT_ACK) == std::string::npos && r.find(MSG_BT_RESEND) == std::string::npos, "frames answered after the error: %s", r.c_str());
+  CHECK(card.binaryActive() != abort, abort ? "the abort frame didn't end the discard" : "the discard ended before the host was quiet");
+  if(!abort)
+  {
+    host_millis += BINARY_TIMEOUT;
+    command_loop();
+    CHECK(!card.binaryActive() && rt_binary_ports == 0, "BINARY_TIMEOUT of quiet didn't end the discard");
+  }
+
+  // lines again
+  receive({'M', '1', '0', '5', '\n'});
+  command_loop();
+  CHECK(queued.size() == 1 && queued[0] == "M105", "M105 after the failed transfer gave %d commands", (int)queued.size());
+  queued.clear();
+  host_insert_card(0);
+}
+
+// a host that doesn't answer at all: after the tenth timeout the frames it may still send are dropped
+static void test_timeout()
+{
+  SdCardModel sd(16384);
+  sd.format();
+  host_insert_card(&sd);
+  card.initsd();
+  char name[] = "quiet.g";
+  card.binaryStart(name, 0);
+  replies();
+  queued.clear();
+  for(int i = 0; i < 10; i++)
+  {
+    host_millis += BINARY_TIMEOUT;
+    command_loop();
+  }
+  std::string r = replies();
+  CHECK(r.find(MSG_BT_TIMEOUT) != std::string::npos, "no timeout after 10 x BINARY_TIMEOUT: %s", r.c_str());
+  CHECK(card.binaryActive(), "the port isn't dropping frames after the timeout");
+  std::vector<std::vector<uint8_t> > sent = gcode_frames(BINARY_WINDOW);
+  for(size_t i = 0; i < sent.size(); i++)
+    receive(sent[i]);
+  command_loop();
+  CHECK(queued.empty(), "%d commands from the frames were queued after the timeout", (int)queued.size());
+  host_millis += BINARY_TIMEOUT;
+  command_loop();
+  receive({'M', '1', '0', '5', '\n'});
+  command_loop();
+  CHECK(!card.binaryActive() && queued.size() == 1, "no lines after the timeout and the quiet");
+  queued.clear();
+  host_insert_card(0);
+}
+
+int main()
+{
+  test_upload();
+  test_write_error(false);
+  test_write_error(true);
+  test_timeout();
+  return test_result("test_binary");
+}
@@ -0,0 +1,219 @@
+// fixp_parse_*() against strtod()/strtol(), which they replace in the G-code parser, and
+// fixp_format()/fixp_digits() against printf(). Then the time both take on the words of G-code
+// lines and on the numbers of the M105/M114 replies, against the old float printFloat() loop.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <chrono>
+#include <random>
+#include "test.h"
+
+#include "../fixedpoint.cpp"
+
+static const char *prefixes[] = {"", " ", "  ", "\t", " \t ", "+", "-", " -", "\t+"};
+static const char *suffixes[] = {"", " Y2", "*71", " E3", "\tF100", ":"};
+
+// one number in the G-code forms: 12, 12., 12.5, .5, with the fraction digits given
+static void format_number(char *buf, long ip, long frac, int decimals, int style)
+{
+  if(decimals == 0)
+    sprintf(buf, style ? "%ld." : "%ld", ip);
+  else if(ip == 0 && style)
+    sprintf(buf, ".%0*ld", decimals, frac);
+  else
+    sprintf(buf, "%ld.%0*ld", ip, decimals, frac);
+}
+
+static void check_parse(const char *text)
+{
+  char *end_ref;
+  const char *end;
+  double ref = strtod(text, &end_ref);
+  float f = fixp_parse_float(text, &end);
+  CHECK(end == end_ref, "fixp_parse_float(\"%s\") ends at %d, strtod at %d", text, (int)(end - text), (int)(end_ref - text));
+  CHECK(fabs(f - ref) <= fabs(ref) * 2e-7 + 1e-9, "fixp_parse_float(\"%s\") = %.9g, strtod %.9g", text, f, ref);
+
+  for(uint8_t decimals = 0; decimals <= 3; decimals++) {
+    long v = fixp_parse(text, decimals, &end);
+    double scaled = ref * pow(10, decimals);
+    CHECK(labs(v - (long)scaled) <= 1, "fixp_parse(\"%s\", %d) = %ld, strtod gives %.3f", text, decimals, v, scaled);
+  }
+
+  long l = fixp_parse_long(text, &end);
+  long l_ref = strtol(text, &end_ref, 10);
+  CHECK(l == l_ref, "fixp_parse_long(\"%s\") = %ld, strtol %ld", text, l, l_ref);
+  CHECK(end == end_ref, "fixp_parse_long(\"%s\") ends at %d, strtol at %d", text, (int)(end - text), (int)(end_ref - text));
+}
+
+static void test_parse()
+{
+  std::mt19937 rng(1);
+  char number[40], text[60];
+  for(int n = 0; n < 200000; n++) {
+    int magnitude = rng() % 7;
+    long ip = magnitude ? rng() % (long)pow(10, magnitude) : 0;
+    int decimals = rng() % 6;
+    long frac = decimals ? rng() % (long)pow(10, decimals) : 0;
+    format_number(number, ip, frac, decimals, rng() % 2);
+    snprintf(text, sizeof(text), "%s%s%s", prefixes[rng() % 9], number, suffixes[rng() % 6]);
+    check_parse(text);
+  }
+  // no digits: nothing is taken, like strtod
+  const char *empty[] = {"", " ", "X", "-", "+.", ".", " \tY", "-X1"};
+  for(unsigned i = 0; i < sizeof(empty) / sizeof(empty[0]); i++) {
+    const char *end;
+    fixp_parse_float(empty[i], &end);
+    CHECK(end == empty[i], "fixp_parse_float(\"%s\") took characters", empty[i]);
+    fixp_parse_long(empty[i], &end);
+    CHECK(end == empty[i], "fixp_parse_long(\"%s\") took characters", empty[i]);
+  }
+  // 'E' right after the number is the next axis word, not an exponent
+  const char *end;
+  CHECK(fixp_parse_float("10.5E3", &end) == 10.5f && *end == 'E', "10.5E3 took the E");
+  CHECK(fixp_parse("2E1", 1, &end) == 20 && *end == 'E', "2E1 took the E");
+  // whitespace isspace() skips, the G1<tab>X10 case
+  CHECK(fixp_parse_float("\t10") == 10.0f, "tab");
+  CHECK(fixp_parse_float("\n\v\f\r 7.5") == 7.5f, "other whitespace");
+  CHECK(fixp_parse_long("\t-42") == -42, "tab before an integer");
+}
+
+static void test_format()
+{
+  std::mt19937 rng(2);
+  char buf[FIXP_BUFSIZE], ref[40];
+  for(int n = 0; n < 100000; n++) {
+    long v = (long)(rng() % 2000000001u) - 1000000000L;
+    uint8_t decimals = rng() % (FIXP_MAX_DECIMALS + 1);
+    char *end = fixp_format(buf, v, decimals);
+    long div = (long)pow(10, decimals);
+    if(decimals)
+      sprintf(ref, "%s%ld.%0*ld", v < 0 ? "-" : "", labs(v) / div, decimals, labs(v) % div);
+    else
+      sprintf(ref, "%ld", v);
+    CHECK(strcmp(buf, ref) == 0, "fixp_format(%ld, %d) = \"%s\", expected \"%s\"", v, decimals, buf, ref);
+    CHECK(*end == 0 && end == buf + strlen(buf), "fixp_format(%ld, %d) returns no terminator", v, decimals);
+  }
+  fixp_format(buf, -2147483647L - 1, 0);
+  CHECK(strcmp(buf, "-2147483648") == 0, "LONG_MIN gives \"%s\"", buf);
+
+  for(unsigned long v = 0; v < 100000; v += 7) {
+    char digits[8] = {0};
+    fixp_digits(digits, v, 5, 1);
+    sprintf(ref, "%04lu.%lu", (v / 10) % 10000, v % 10);
+    CHECK(strcmp(digits, ref) == 0, "fixp_digits(%lu, 5, 1) = \"%s\", expected \"%s\"", v, digits, ref);
+  }
+}
+
+static void test_from_float()
+{
+  std::mt19937 rng(3);
+  for(int n = 0; n < 100000; n++) {
+    float f = ((int)(rng() % 2000001) - 1000000) / 997.0f;
+    uint8_t decimals = rng() % 4;
+    CHECK(fixp_fits(f, decimals), "%f doesn't fit %d decimals", f, decimals);
+    long v = fixp_from_float(f, decimals);
+    CHECK(labs(v - lround(f * pow(10, decimals))) <= 1, "fixp_from_float(%f, %d) = %ld", f, decimals, v);
+  }
+  CHECK(!fixp_fits(3.0e9, 0) && !fixp_fits(2.5e3, 6) && !fixp_fits(1, 7), "fixp_fits() limits");
+}
+
+// MarlinSerial::printFloat() before fixp_format(), into a buffer, in float as double is on the AVR
+static char *old_print_float(char *p, float number, uint8_t digits)
+{
+  if(number < 0.0) {
+    *p++ = '-';
+    number = -number;
+  }
+  float rounding = 0.5;
+  for(uint8_t i = 0; i < digits; ++i)
+    rounding /= 10.0;
+  number += rounding;
+  unsigned long int_part = (unsigned long)number;
+  float remainder = number - (float)int_part;
+  unsigned char buf[8 * sizeof(long)];
+  unsigned long i = 0;
+  if(int_part == 0)
+    *p++ = '0';
+  while(int_part > 0) {
+    buf[i++] = int_part % 10;
+    int_part /= 10;
+  }
+  for(; i > 0; i--)
+    *p++ = '0' + buf[i - 1];
+  if(digits > 0)
+    *p++ = '.';
+  while(digits-- > 0) {
+    remainder *= 10.0;
+    int toPrint = int(remainder);
+    *p++ = '0' + toPrint;
+    remainder -= toPrint;
+  }
+  *p = 0;
+  return p;
+}
+
+static volatile long sink;
+
+// nanoseconds per call of f over n calls, the best of 5 runs
+template<class F> static double time_ns(int n, F f)
+{
+  double best = 1e30;
+  for(int run = 0; run < 5; run++) {
+    auto start = std::chrono::steady_clock::now();
+    for(int i = 0; i < n; i++)
+      f(i);
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / n;
+    best = ns < best ? ns : best;
+  }
+  return best;
+}
+
+// The host has an FPU and the AVR doesn't, so the float side does much worse on the printer than
+// here. The parsers are faster even so. The old printFloat() loop is about as fast as fixp_format()
+// here, its float divides and multiplies per digit are what costs on the AVR, so that one is only
+// reported; the AVR numbers need the printer.
+static void test_speed()
+{
+  // the numbers behind the letters of typical slicer output
+  static const char *words[] = {"1", "12.345", "-3.2", "0.04562", "1800", "0.3", "200", "12345",
+                                "71", "150.125", "-0.8", "4800", "103.47", "1.5", "98.66201", "0"};
+  const int nwords = sizeof(words) / sizeof(words[0]), n = 400000;
+  double t_strtod = time_ns(n, [&](int i) { sink += (long)strtod(words[i % nwords], NULL); });
+  double t_float = time_ns(n, [&](int i) { sink += (long)fixp_parse_float(words[i % nwords]); });
+  double t_fixp = time_ns(n, [&](int i) { sink += fixp_parse(words[i % nwords], 3); });
+  double t_strtol = time_ns(n, [&](int i) { sink += strtol(words[i % nwords], NULL, 10); });
+  double t_long = time_ns(n, [&](int i) { sink += fixp_parse_long(words[i % nwords]); });
+  printf("  parse: strtod %.1fns, fixp_parse_float %.1fns (%.1fx), fixp_parse %.1fns (%.1fx), strtol %.1fns, fixp_parse_long %.1fns (%.1fx)\n",
+         t_strtod, t_float, t_strtod / t_float, t_fixp, t_strtod / t_fixp, t_strtol, t_long, t_strtol / t_long);
+  CHECK(t_float * 2 < t_strtod && t_fixp * 2 < t_strtod, "fixp_parse_float %.1fns, fixp_parse %.1fns, strtod %.1fns", t_float, t_fixp, t_strtod);
+  CHECK(t_long < t_strtol, "fixp_parse_long %.1fns, strtol %.1fns", t_long, t_strtol);
+
+  // temperatures with one decimal and positions with two, as M105 and M114 send them
+  static const float values[] = {21.3f, 200.0f, 199.7f, 60.2f, 12.35f, -3.2f, 150.13f, 0.3f, 98.66f, 250.5f};
+  const int nvalues = sizeof(values) / sizeof(values[0]);
+  char buf[FIXP_BUFSIZE + 20];
+  double t_old = time_ns(n, [&](int i) { sink += old_print_float(buf, values[i % nvalues], 1 + i % 2) - buf; });
+  double t_new = time_ns(n, [&](int i) {
+    uint8_t digits = 1 + i % 2;
+    sink += fixp_format(buf, fixp_from_float(values[i % nvalues], digits), digits) - buf;
+  });
+  printf("  format: old printFloat loop %.1fns, fixp_format %.1fns (%.1fx)\n", t_old, t_new, t_old / t_new);
+  // and they print the same
+  for(int i = 0; i < nvalues * 2; i++) {
+    char ref[40];
+    uint8_t digits = 1 + i % 2;
+    old_print_float(ref, values[i % nvalues], digits);
+    fixp_format(buf, fixp_from_float(values[i % nvalues], digits), digits);
+    CHECK(strcmp(buf, ref) == 0, "%g with %d digits: fixp_format \"%s\", old printFloat \"%s\"", values[i % nvalues], digits, buf, ref);
+  }
+}
+
+int main()
+{
+  test_parse();
+  test_format();
+  test_from_float();
+  test_speed();
+  return test_result("test_fixedpoint");
+}
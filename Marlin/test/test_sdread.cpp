@@ -0,0 +1,269 @@
+// CardReader::getCommand() against the per-byte loop get_command() used before it, over random
+// G-code files on a simulated card: the same commands at the same file positions, except for
+// the blanks in front of a command, which getCommand() leaves out (so a line of only blanks is no
+// command any more), and for the byte the old loop lost where it cut a command longer than
+// MAX_CMD_SIZE-1.
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include "test.h"
+#include "sdcard_model.h"
+
+#include "../MarlinSerial.cpp"
+#include "../fixedpoint.cpp"
+#include "../temperature.cpp"
+#include "../Sd2Card.cpp"
+#include "../SdVolume.cpp"
+#include "../SdBaseFile.cpp"
+#include "../SdFile.cpp"
+#include "../cardreader.cpp"
+#include "marlin_stubs.h"
+
+CardReader card;
+
+static std::mt19937 rng(49);
+
+static int rnd(int n) { return rng() % n; }
+
+struct Command
+{
+  std::string text;
+  uint32_t pos;  // card.getIndex() after it
+};
+
+// a file of G-code and the [start,end] of each line that is longer than a command may be
+struct GcodeFile
+{
+  std::string text;
+  std::vector<std::pair<uint32_t,uint32_t> > long_lines;
+};
+
+static std::string word()
+{
+  static const char *letters = "GMXYZEFST";
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%c%d.%d", letters[rnd(9)], rnd(300) - 20, rnd(1000));
+  return buf;
+}
+
+static std::string blanks()
+{
+  std::string s;
+  for(int n = rnd(3) ? 0 : rnd(4) + 1; n; n--)
+    s += rnd(3) ? ' ' : '\t';
+  return s;
+}
+
+static GcodeFile make_file(int lines, bool with_long)
+{
+  static const char *ends[] = {"\n", "\r\n", "\r", "\n\n"};
+  GcodeFile f;
+  for(int i = 0; i < lines; i++)
+  {
+    int kind = rnd(20);
+    std::string line;
+    if(kind == 0 && with_long)
+    {
+      // nothing the two loops treat differently at a cut: no blanks, no ';' and no ':'
+      static const char *chars = "GXYZEF0123456789.-";
+      uint32_t start = f.text.size();
+      for(int n = MAX_CMD_SIZE - 1 + rnd(320) - (rnd(4) ? 0 : 1); n; n--)
+        line += chars[rnd(18)];
+      if(rnd(4) == 0 && line.size() >= MAX_CMD_SIZE - 1)
+        line.resize((line.size() + 1) / MAX_CMD_SIZE * MAX_CMD_SIZE - 1);  // a cut right at the end
+      f.text += line + "\n";
+      f.long_lines.push_back(std::make_pair(start, (uint32_t)f.text.size() - 1));
+      continue;
+    }
+    if(kind <= 2)
+      line = blanks();
+    else if(kind <= 4)
+      line = blanks() + "; " + word() + " : " + word();
+    else
+    {
+      line = blanks() + word();
+      for(int n = rnd(5); n; n--)
+        line += (rnd(8) ? " " : "  ") + word();
+      if(rnd(5) == 0)
+        line += ":" + blanks() + word() + (rnd(2) ? ":" : "");
+      if(rnd(4) == 0)
+        line += blanks() + ";" + word() + ":" + word();
+      if(line.size() > 80)
+        line.resize(80);
+    }
+    f.text += line + ends[rnd(4)];
+  }
+  if(rnd(2) && !f.text.empty() && f.text.back() == '\n' && (f.long_lines.empty() || f.long_lines.back().second != f.text.size() - 1))
+    f.text.pop_back();  // no line end after the last line
+  return f;
+}
+
+static void open_for_print(const char *name, long from)
+{
+  char fname[13];
+  strcpy(fname, name);
+  card.openFile(fname, true);
+  card.startFileprint();
+  if(from)
+    card.setIndex(from);
+}
+
+// the SD branch of get_command() before getCommand(), with the queue taken as never full:
+// returning early on an empty line only made the next call go on from there
+static std::vector<Command> old_loop(const char *name, long from, std::string *bytes)
+{
+  std::vector<Command> cmds;
+  char cmdbuffer[MAX_CMD_SIZE];
+  int sd_count = 0;
+  bool sd_comment_mode = false;
+  open_for_print(name, from);
+  while(!card.eof())
+  {
+    int16_t n = card.get();
+    if(n >= 0)
+      *bytes += (char)n;
+    char serial_char = (char)n;
+    if(serial_char == '\n' ||
+       serial_char == '\r' ||
+       (serial_char == ':' && sd_comment_mode == false) ||
+       sd_count >= (MAX_CMD_SIZE - 1) || n == -1)
+    {
+      if(!sd_count)
+      {
+        sd_comment_mode = false;
+        continue;
+      }
+      cmdbuffer[sd_count] = 0;
+      cmds.push_back(Command{cmdbuffer, card.getIndex()});
+      if(rnd(4) == 0)
+        card.readahead();  // the queue was full
+      sd_comment_mode = false;
+      sd_count = 0;
+    }
+    else
+    {
+      if(serial_char == ';') sd_comment_mode = true;
+      if(!sd_comment_mode) cmdbuffer[sd_count++] = serial_char;
+    }
+  }
+  return cmds;
+}
+
+static std::vector<Command> new_loop(const char *name, long from)
+{
+  std::vector<Command> cmds;
+  char cmdbuffer[MAX_CMD_SIZE];
+  open_for_print(name, from);
+  while(!card.eof() && card.getCommand(cmdbuffer))
+  {
+    CHECK(strlen(cmdbuffer) < MAX_CMD_SIZE, "command of %d bytes", (int)strlen(cmdbuffer));
+    cmds.push_back(Command{cmdbuffer, card.getIndex()});
+    if(rnd(4) == 0)
+      card.readahead();
+  }
+  CHECK(card.eof(), "getCommand() gave up at %u", (unsigned)card.getIndex());
+  return cmds;
+}
+
+static int long_line_of(const GcodeFile &f, uint32_t pos)
+{
+  for(size_t i = 0; i < f.long_lines.size(); i++)
+    if(pos >= f.long_lines[i].first && pos <= f.long_lines[i].second)
+      return i;
+  return -1;
+}
+
+static void compare(const GcodeFile &f, const std::vector<Command> &old_cmds, const std::vector<Command> &new_cmds, const char *what)
+{
+  // lines a command fits in: the old commands without their leading blanks and without those
+  // that were only blanks
+  std::vector<Command> a, b;
+  std::vector<std::string> old_long(f.long_lines.size()), new_long(f.long_lines.size());
+  for(const Command &c : old_cmds)
+  {
+    int l = long_line_of(f, c.pos);
+    if(l >= 0)
+    {
+      old_long[l] += c.text;
+      continue;
+    }
+    size_t s = c.text.find_first_not_of(" \t");
+    if(s != std::string::npos)
+      a.push_back(Command{c.text.substr(s), c.pos});
+  }
+  for(size_t i = 0; i < new_cmds.size(); i++)
+  {
+    const Command &c = new_cmds[i];
+    int l = long_line_of(f, c.pos);
+    if(l >= 0)
+    {
+      // pieces of MAX_CMD_SIZE-1, the last one may be shorter
+      bool last = i + 1 == new_cmds.size() || long_line_of(f, new_cmds[i + 1].pos) != l;
+      CHECK(last ? c.text.size() <= MAX_CMD_SIZE - 1 : c.text.size() == MAX_CMD_SIZE - 1,
+            "%s: piece of %d bytes", what, (int)c.text.size());
+      new_long[l] += c.text;
+      continue;
+    }
+    b.push_back(c);
+  }
+  CHECK(a.size() == b.size(), "%s: %d commands before, %d now", what, (int)a.size(), (int)b.size());
+  for(size_t i = 0; i < a.size() && i < b.size(); i++)
+  {
+    CHECK(a[i].text == b[i].text, "%s: command %d \"%s\" before, \"%s\" now", what, (int)i, a[i].text.c_str(), b[i].text.c_str());
+    CHECK(a[i].pos == b[i].pos, "%s: command %d at %u before, %u now", what, (int)i, (unsigned)a[i].pos, (unsigned)b[i].pos);
+  }
+  // long lines: getCommand() keeps every byte, the old loop dropped the one after each cut
+  for(size_t l = 0; l < f.long_lines.size(); l++)
+  {
+    std::string line = f.text.substr(f.long_lines[l].first, f.long_lines[l].second - f.long_lines[l].first);
+    std::string dropped;
+    for(size_t i = 0; i < line.size(); i++)
+      if(i % MAX_CMD_SIZE != MAX_CMD_SIZE - 1)
+        dropped += line[i];
+    CHECK(new_long[l] == line, "%s: long line %d of %d bytes comes as %d", what, (int)l, (int)line.size(), (int)new_long[l].size());
+    CHECK(old_long[l] == dropped, "%s: long line %d of %d bytes came as %d", what, (int)l, (int)line.size(), (int)old_long[l].size());
+  }
+}
+
+static void test_files()
+{
+  SdCardModel sd(16384);
+  host_insert_card(&sd);
+  for(int round = 0; round < 200; round++)
+  {
+    int lines = round < 5 ? round : rnd(4) ? rnd(400) : rnd(6000);
+    GcodeFile f = make_file(lines, round % 3 != 0);
+    std::vector<uint8_t> content(f.text.begin(), f.text.end());
+    sd.format();
+    sd.addFile("PRINT   G  ", content, round % 2, round);
+    card.initsd();
+    CHECK(card.cardOK, "round %d: card not initialised", round);
+    std::string bytes;
+    std::vector<Command> old_cmds = old_loop("print.g", 0, &bytes);
+    CHECK(bytes == f.text, "round %d: get() gave %d bytes of %d", round, (int)bytes.size(), (int)f.text.size());
+    std::vector<Command> new_cmds = new_loop("print.g", 0);
+    CHECK(card.getFileSize() == content.size(), "round %d: file size %u", round, (unsigned)card.getFileSize());
+    char what[32];
+    snprintf(what, sizeof(what), "round %d", round);
+    compare(f, old_cmds, new_cmds, what);
+    // resumed somewhere in the file, as after M26
+    if(f.long_lines.empty() && !content.empty())
+    {
+      long from = rnd(content.size());
+      snprintf(what, sizeof(what), "round %d from %ld", round, from);
+      bytes.clear();
+      compare(f, old_loop("print.g", from, &bytes), new_loop("print.g", from), what);
+      CHECK(bytes == f.text.substr(from), "%s: get() gave %d bytes", what, (int)bytes.size());
+    }
+  }
+  CHECK(sd.cmd_crc_errors == 0 && sd.data_crc_errors == 0 && sd.bad_commands == 0,
+        "card saw %u command CRC errors, %u data CRC errors, %u bad commands",
+        (unsigned)sd.cmd_crc_errors, (unsigned)sd.data_crc_errors, (unsigned)sd.bad_commands);
+  host_insert_card(0);
+}
+
+int main()
+{
+  test_files();
+  return test_result("test_sdread");
+}
@@ -0,0 +1,185 @@
+// The pipelined SPI loops of Sd2Card.cpp on an SPDR that counts a write or read before the last
+// transfer was seen done: spiRead() for every length up to past a block, spiSendBlock(), the CRC
+// table and the CRC7 of the commands against the bit by bit CRCs. Then blocks written and read
+// back through a simulated card with CRC checking on, which the card and the firmware both check.
+#include <stdio.h>
+#include <string.h>
+#include "test.h"
+#include "sdcard_model.h"
+
+// with the table CRC, whatever SdFatConfig.h has
+#include "../SdFatConfig.h"
+#undef USE_SD_CRC
+#define USE_SD_CRC 2
+
+#include "../MarlinSerial.cpp"
+#include "../fixedpoint.cpp"
+#include "../temperature.cpp"
+#include "../Sd2Card.cpp"
+#include "marlin_stubs.h"
+
+static std::mt19937 rng(50);
+
+// a card that answers spiRead() with a known sequence and takes what spiSendBlock() sends
+static uint8_t seq[600];
+static uint8_t sent[600];
+static int transfers;
+static bool idle_out;  // spiRead() sent only 0xFF
+
+static uint8_t echo_transfer(uint8_t mosi)
+{
+  if(transfers < (int)sizeof(sent))
+    sent[transfers] = mosi;
+  if(mosi != 0xFF)
+    idle_out = false;
+  uint8_t miso = transfers < (int)sizeof(seq) ? seq[transfers] : 0;
+  transfers++;
+  return miso;
+}
+
+static void start(uint8_t *buf, int len)
+{
+  for(int i = 0; i < (int)sizeof(seq); i++)
+    seq[i] = rng();
+  memset(buf, 0xA5, len);
+  transfers = 0;
+  idle_out = true;
+  host_spi_collisions = host_spi_early_reads = 0;
+  host_spi_busy = false;
+  host_spi_transfer = echo_transfer;
+}
+
+static void test_crc()
+{
+  for(int i = 0; i < 256; i++)
+    CHECK(pgm_read_word(&crcTable[i]) == sd_crc16(0, i), "crcTable[%d] = %04x, should be %04x",
+          i, pgm_read_word(&crcTable[i]), sd_crc16(0, i));
+  for(int i = 0; i < 100000; i++)
+  {
+    uint16_t crc = rng();
+    uint8_t b = rng();
+    CHECK(spiCrc(crc, b) == sd_crc16(crc, b), "spiCrc(%04x, %02x)", crc, b);
+  }
+  uint8_t cmd0[5] = {0x40, 0, 0, 0, 0}, cmd8[5] = {0x48, 0, 0, 0x01, 0xAA};
+  CHECK(CRC7(cmd0, 5) == 0x95 && sd_crc7(cmd0, 5) == 0x95, "CRC7 of CMD0 %02x", CRC7(cmd0, 5));
+  CHECK(CRC7(cmd8, 5) == 0x87 && sd_crc7(cmd8, 5) == 0x87, "CRC7 of CMD8 %02x", CRC7(cmd8, 5));
+  for(int i = 0; i < 10000; i++)
+  {
+    uint8_t cmd[5] = {(uint8_t)(0x40 | (rng() & 0x3F)), (uint8_t)rng(), (uint8_t)rng(), (uint8_t)rng(), (uint8_t)rng()};
+    CHECK(CRC7(cmd, 5) == sd_crc7(cmd, 5), "CRC7 of %02x %02x %02x %02x %02x", cmd[0], cmd[1], cmd[2], cmd[3], cmd[4]);
+  }
+}
+
+static void test_loops()
+{
+  uint8_t buf[530];
+  for(int n = 0; n <= 520; n++)
+  {
+    start(buf, sizeof(buf));
+    uint16_t crc = spiRead(buf, n);
+    uint16_t want = 0;
+    for(int i = 0; i < n; i++)
+      want = sd_crc16(want, seq[i]);
+    CHECK(memcmp(buf, seq, n) == 0, "spiRead(%d): wrong data", n);
+    CHECK(n == sizeof(buf) || buf[n] == 0xA5, "spiRead(%d) wrote past the end", n);
+    CHECK(transfers == n, "spiRead(%d): %d transfers", n, transfers);
+    CHECK(idle_out, "spiRead(%d) sent other than 0xFF", n);
+    CHECK(crc == want, "spiRead(%d): CRC %04x, should be %04x", n, crc, want);
+    CHECK(host_spi_collisions == 0 && host_spi_early_reads == 0 && !host_spi_busy,
+          "spiRead(%d): %u writes and %u reads before the transfer was done%s", n,
+          (unsigned)host_spi_collisions, (unsigned)host_spi_early_reads, host_spi_busy ? ", returned during one" : "");
+  }
+  for(int round = 0; round < 100; round++)
+  {
+    uint8_t block[512];
+    start(buf, sizeof(buf));
+    for(int i = 0; i < 512; i++)
+      block[i] = rng();
+    uint8_t token = round & 1 ? 0xFC : 0xFE;
+    uint16_t crc = spiSendBlock(token, block);
+    uint16_t want = 0;
+    for(int i = 0; i < 512; i++)
+      want = sd_crc16(want, block[i]);
+    CHECK(transfers == 513, "spiSendBlock(): %d transfers", transfers);
+    CHECK(sent[0] == token && memcmp(sent + 1, block, 512) == 0, "spiSendBlock(): wrong bytes sent");
+    CHECK(crc == want, "spiSendBlock(): CRC %04x, should be %04x", crc, want);
+    CHECK(host_spi_collisions == 0 && host_spi_early_reads == 0 && !host_spi_busy,
+          "spiSendBlock(): %u writes and %u reads before the transfer was done%s",
+          (unsigned)host_spi_collisions, (unsigned)host_spi_early_reads, host_spi_busy ? ", returned during one" : "");
+  }
+  host_spi_transfer = 0;
+}
+
+// single and multiple block reads and writes through the card, with CRC checking on both ends
+static void test_card()
+{
+  SdCardModel sd(4096);
+  for(size_t i = 0; i < sd.image.size(); i++)
+    sd.image[i] = rng();
+  std::vector<uint8_t> want = sd.image;
+  host_insert_card(&sd);
+  host_spi_collisions = host_spi_early_reads = 0;
+  Sd2Card card;
+  CHECK(card.init(SPI_FULL_SPEED, SDSS), "init failed, error %d", card.errorCode());
+  CHECK(sd.crc_on && sd.commands[59] == 1, "CMD59 didn't turn CRC on");
+  CHECK(card.type() == SD_CARD_TYPE_SDHC, "card type %d", card.type());
+  CHECK(card.cardSize() == sd.blocks(), "cardSize() %u", (unsigned)card.cardSize());
+  uint8_t buf[512];
+  for(int round = 0; round < 2000; round++)
+  {
+    uint32_t b = rng() % sd.blocks();
+    int len = rng() % 8 + 1;
+    switch(rng() % 4)
+    {
+      case 0:
+        CHECK(card.readBlock(b, buf), "readBlock(%u) failed, error %d", (unsigned)b, card.errorCode());
+        CHECK(memcmp(buf, &want[b * 512], 512) == 0, "readBlock(%u): wrong data", (unsigned)b);
+        break;
+      case 1:
+        for(int i = 0; i < len && b + i < sd.blocks(); i++)
+        {
+          CHECK(card.readBlockStream(b + i, buf), "readBlockStream(%u) failed, error %d", (unsigned)(b + i), card.errorCode());
+          CHECK(memcmp(buf, &want[(b + i) * 512], 512) == 0, "readBlockStream(%u): wrong data", (unsigned)(b + i));
+        }
+        break;
+      case 2:
+        for(int i = 0; i < 512; i++)
+          buf[i] = want[b * 512 + i] = rng();
+        CHECK(card.writeBlock(b, buf), "writeBlock(%u) failed, error %d", (unsigned)b, card.errorCode());
+        break;
+      case 3:
+        for(int i = 0; i < len && b + i < sd.blocks(); i++)
+        {
+          for(int j = 0; j < 512; j++)
+            buf[j] = want[(b + i) * 512 + j] = rng();
+          CHECK(card.writeBlockStream(b + i, buf, len), "writeBlockStream(%u) failed, error %d", (unsigned)(b + i), card.errorCode());
+        }
+        CHECK(card.writeStreamStop(), "writeStop() failed, error %d", card.errorCode());
+        break;
+    }
+  }
+  CHECK(card.writeStreamStop() && card.readStop(), "stop failed");
+  CHECK(sd.image == want, "the card doesn't hold what was written");
+  CHECK(sd.commands[17] && sd.commands[18] && sd.commands[24] && sd.commands[25], "not every kind of transfer was run");
+  CHECK(sd.cmd_crc_errors == 0 && sd.data_crc_errors == 0 && sd.bad_commands == 0,
+        "card saw %u command CRC errors, %u data CRC errors, %u bad commands",
+        (unsigned)sd.cmd_crc_errors, (unsigned)sd.data_crc_errors, (unsigned)sd.bad_commands);
+  CHECK(host_spi_collisions == 0 && host_spi_early_reads == 0, "%u writes and %u reads before the transfer was done",
+        (unsigned)host_spi_collisions, (unsigned)host_spi_early_reads);
+
+  // a block damaged on the way is caught by its CRC
+  sd.corrupt = true;
+  CHECK(!card.readBlock(7, buf) && card.errorCode() == SD_CARD_ERROR_READ_CRC, "damaged block read, error %d", card.errorCode());
+  sd.corrupt = true;
+  CHECK(!card.readBlockStream(9, buf) && card.errorCode() == SD_CARD_ERROR_READ_CRC, "damaged stream block read, error %d", card.errorCode());
+  CHECK(card.readBlock(7, buf) && memcmp(buf, &want[7 * 512], 512) == 0, "no read after the CRC error");
+  host_insert_card(0);
+}
+
+int main()
+{
+  test_crc();
+  test_loops();
+  test_card();
+  return test_result("test_spi");
+}
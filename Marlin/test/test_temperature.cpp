@@ -0,0 +1,551 @@
+// The thermistor lookup and the fixed point PID of temperature.cpp against the float code they
+// replaced, over every table in thermistortables.h and over random gains and inputs. Then the whole
+// heater control, from the timer 0 tick with its ADC sampling and soft PWM to manage_heater(), on
+// a simulated hotend and bed: settling against the float PID on the same plant, the M303
+// autotune running to the end and giving gains that hold the temperature, and the bed PID with
+// those gains against the bed switched on and off every BED_CHECK_INTERVAL.
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <deque>
+#include <random>
+#include "test.h"
+
+// the bed PID is off in Configuration.h until it is tuned for the printer, here it is compared
+// with the switching it replaces
+#define PIDTEMPBED
+
+#include "../MarlinSerial.cpp"
+#include "../fixedpoint.cpp"
+#include "../temperature.cpp"
+#include "marlin_stubs.h"
+
+// every table of thermistortables.h, not only the configured ones: the header again with other
+// sensor numbers, in namespaces so the names don't clash (55 reuses the name temptable_52)
+#undef THERMISTORHEATER_0
+#undef THERMISTORHEATER_1
+#undef THERMISTORHEATER_2
+#undef THERMISTORBED
+#define THERMISTORHEATER_0 1
+#define THERMISTORHEATER_1 2
+#define THERMISTORHEATER_2 3
+#define THERMISTORBED 4
+namespace tables_a {
+  #undef THERMISTORTABLES_H_
+  #include "../thermistortables.h"
+}
+#undef THERMISTORHEATER_0
+#undef THERMISTORHEATER_1
+#undef THERMISTORHEATER_2
+#undef THERMISTORBED
+#define THERMISTORHEATER_0 5
+#define THERMISTORHEATER_1 6
+#define THERMISTORHEATER_2 7
+#define THERMISTORBED 51
+namespace tables_b {
+  #undef THERMISTORTABLES_H_
+  #include "../thermistortables.h"
+}
+#undef THERMISTORHEATER_0
+#undef THERMISTORHEATER_1
+#undef THERMISTORHEATER_2
+#undef THERMISTORBED
+#define THERMISTORHEATER_0 52
+#define THERMISTORHEATER_1 52
+#define THERMISTORHEATER_2 52
+#define THERMISTORBED 52
+namespace tables_c {
+  #undef THERMISTORTABLES_H_
+  #include "../thermistortables.h"
+}
+#undef THERMISTORHEATER_0
+#undef THERMISTORHEATER_1
+#undef THERMISTORHEATER_2
+#undef THERMISTORBED
+#define THERMISTORHEATER_0 55
+#define THERMISTORHEATER_1 55
+#define THERMISTORHEATER_2 55
+#define THERMISTORBED 55
+namespace tables_d {
+  #undef THERMISTORTABLES_H_
+  #include "../thermistortables.h"
+}
+
+#define TABLE(n, t) { n, t, sizeof(t) / sizeof(*t) }
+static const struct {
+  int number;
+  const short (*tt)[2];
+  int len;
+} tables[] = {
+  TABLE(1, tables_a::temptable_1), TABLE(2, tables_a::temptable_2), TABLE(3, tables_a::temptable_3),
+  TABLE(4, tables_a::temptable_4), TABLE(5, tables_b::temptable_5), TABLE(6, tables_b::temptable_6),
+  TABLE(7, tables_b::temptable_7), TABLE(51, tables_b::temptable_51), TABLE(52, tables_c::temptable_52),
+  TABLE(55, tables_d::temptable_52),
+};
+
+//===========================================================================
+// the float code before the fixed point versions
+//===========================================================================
+
+// analog2temp() with its linear search
+static float float_raw2temp(const short (*tt)[2], int len, int raw)
+{
+  float celsius = 0;
+  int i;
+  raw = (1023 * OVERSAMPLENR) - raw;
+  for (i=1; i<len; i++)
+  {
+    if (tt[i][0] > raw)
+    {
+      celsius = tt[i-1][1] +
+        (raw - tt[i-1][0]) *
+        (float)(tt[i][1] - tt[i-1][1]) /
+        (float)(tt[i][0] - tt[i-1][0]);
+      break;
+    }
+  }
+  if (i == len) celsius = tt[i-1][1];
+  return celsius;
+}
+
+// temp2analog()
+static int float_temp2raw(const short (*tt)[2], int len, int celsius)
+{
+  int raw = 0;
+  int i;
+  for (i=1; i<len; i++)
+  {
+    if (tt[i][1] < celsius)
+    {
+      raw = tt[i-1][0] +
+        (celsius - tt[i-1][1]) *
+        (tt[i][0] - tt[i-1][0]) /
+        (tt[i][1] - tt[i-1][1]);
+      break;
+    }
+  }
+  if (i == len) raw = tt[i-1][0];
+  return (1023 * OVERSAMPLENR) - raw;
+}
+
+// the PID of manage_heater(), in degC
+struct float_pid {
+  double Kp, Ki, Kd, K2;
+  double iState_max;
+  double dInput_max;                  // the float code had none, see test_pid_step()
+  double iState, dState, dTerm;
+  bool reset;
+
+  void init(double p, double i, double d, double drive_max)
+  {
+    Kp = p; Ki = i; Kd = d; K2 = 1.0 - K1;
+    iState_max = drive_max / Ki;
+    dInput_max = 1e9;
+    iState = dState = dTerm = 0;
+    reset = false;
+  }
+
+  double step(double setpoint, double input, double max_output)
+  {
+    double error = setpoint - input;
+    if(error > 10) {
+      reset = true;
+      return max_output;
+    }
+    if(error < -10) {
+      reset = true;
+      return 0;
+    }
+    if(reset) {
+      iState = 0;
+      reset = false;
+    }
+    double pTerm = Kp * error;
+    iState = constrain(iState + error, 0, iState_max);
+    double iTerm = Ki * iState;
+    dTerm = (Kd * constrain(input - dState, -dInput_max, dInput_max)) * K2 + ((1.0 - K2) * dTerm);
+    dState = input;
+    return constrain(pTerm + iTerm - dTerm, 0, max_output);
+  }
+};
+
+//===========================================================================
+// lookups
+//===========================================================================
+
+static void test_lookup()
+{
+  for(unsigned t = 0; t < sizeof(tables) / sizeof(tables[0]); t++) {
+    const short (*tt)[2] = tables[t].tt;
+    byte len = tables[t].len;
+    float worst = 0;
+    // every reading the ISR can hand over, 16383 - sum of 16 conversions
+    for(int raw = 15; raw <= 16383; raw++) {
+      float ref = float_raw2temp(tt, len, raw);
+      float fx = tt_raw2temp(tt, len, raw) / 256.0f;
+      worst = max(worst, fabsf(fx - ref));
+      CHECK(fabsf(fx - ref) < 1.0f/256 + 1e-3f, "table %d raw %d: tt_raw2temp %f, float %f", tables[t].number, raw, fx, ref);
+    }
+    // the bisection finds the segment the linear search found
+    for(int raw = 0; raw <= 1023 * OVERSAMPLENR; raw++) {
+      int i;
+      for(i = 1; i < len && tt[i][0] <= raw; i++) ;
+      CHECK(tt_find_raw(tt, len, raw) == i, "table %d raw %d: segment %d, linear search %d", tables[t].number, raw, tt_find_raw(tt, len, raw), i);
+    }
+    for(int celsius = -50; celsius <= 600; celsius++) {
+      int ref = float_temp2raw(tt, len, celsius);
+      int fx = tt_temp2raw(tt, len, celsius);
+      CHECK(fx == ref, "table %d %dC: tt_temp2raw %d, temp2analog %d", tables[t].number, celsius, fx, ref);
+    }
+    printf("  table %d: %d rows, largest difference to the float lookup %.5fC\n", tables[t].number, len, worst);
+  }
+}
+
+//===========================================================================
+// pid_step() against the float PID
+//===========================================================================
+
+static void test_pid_step()
+{
+  std::mt19937 rng(4);
+  std::uniform_real_distribution<double> unit(0, 1);
+  double worst = 0;
+  long steps = 0;
+  for(int n = 0; n < 2000; n++) {
+    // M301 units, stored like Configuration.h does it
+    double kp = 1 + unit(rng) * 80;
+    double ki = (0.01 + unit(rng) * 5) * PID_dT;
+    double kd = unit(rng) * 400 / PID_dT;
+    int max_output = (n & 1) ? 255 : 100 + rng() % 156;
+    pid_gains_t g;
+    pid_scale(g, kp, ki, kd, PID_INTEGRAL_DRIVE_MAX);
+    // rounded to the nearest step, the gains come in as floats
+    CHECK(fabs(g.Kp / 16.0 - kp) <= 0.5 / 16 + kp * 1e-6 && fabs(g.Ki / 32768.0 - ki) <= 0.5 / 32768 + ki * 1e-6 &&
+          fabs(g.Kd / 16.0 - kd) <= 0.5 / 16 + kd * 1e-6,
+          "pid_scale(%f, %f, %f) rounds to %ld %ld %ld", kp, ki, kd, g.Kp, g.Ki, g.Kd);
+    CHECK(fabs(g.iState_max / 256.0 - PID_INTEGRAL_DRIVE_MAX / (g.Ki / 32768.0)) <= 1.0 / 256,
+          "iState_max %ld for Ki %ld", g.iState_max, g.Ki);
+
+    // the float PID with the rounded gains, so only the arithmetic differs. It gets the limit on the
+    // input step of the D term too: the first step back in the functional range sees the input of
+    // the last time in it, pid_step() keeps that kick to PID_D_LIMIT where the float code didn't.
+    float_pid ref;
+    ref.init(g.Kp / 16.0, g.Ki / 32768.0, g.Kd / 16.0, PID_INTEGRAL_DRIVE_MAX);
+    ref.K2 = K2_FX / 256.0;
+    ref.iState_max = g.iState_max / 256.0;
+    ref.dInput_max = g.dInput_max / 256.0;
+    pid_state_t st = {};
+
+    // a wandering temperature, slower than the Kd limit, that also leaves the functional range
+    long setpoint = (150 + rng() % 100) << 8;
+    long input = setpoint - (rng() % 6000);
+    double swing = unit(rng) * 15 * 256;
+    double period = 50 + unit(rng) * 2000;
+    long max_step = max(1L, g.dInput_max * 8 / 10);
+    for(int i = 0; i < 3000; i++) {
+      long want = setpoint + (long)(swing * sin(i * 2 * M_PI / period)) + (long)(rng() % 64) - 32;
+      input += constrain(want - input, -max_step, max_step);
+      int fx = pid_step(st, g, setpoint, input, max_output, 0);
+      double out = ref.step(setpoint / 256.0, input / 256.0, max_output);
+      worst = max(worst, fabs(fx - out));
+      steps++;
+      CHECK(fabs(fx - out) < 1.01, "gains %ld/%ld/%ld step %d input %ld: pid_step %d, float %f",
+            g.Kp, g.Ki, g.Kd, i, input, fx, out);
+    }
+  }
+  printf("  %ld steps, largest difference to the float PID %.3f of 255\n", steps, worst);
+}
+
+// With a feed-forward the integral only winds up to what the feed-forward leaves of the drive.
+static void test_pid_feedforward()
+{
+  std::mt19937 rng(5);
+  for(int n = 0; n < 500; n++) {
+    pid_gains_t g;
+    pid_scale(g, 5 + rng() % 50, (0.05 + (rng() % 100) / 20.0) * PID_dT, (rng() % 300) / PID_dT, PID_INTEGRAL_DRIVE_MAX);
+    pid_state_t st = {};
+    long ff = (long)(rng() % 300) << PID_SHIFT;
+    long setpoint = 200L << 8;
+    long input = setpoint - 3 * 256; // below the target for good, the integral winds up to its limit
+    for(int i = 0; i < 200000 && st.iState < g.iState_max; i++)
+      pid_step(st, g, setpoint, input, PID_MAX, ff);
+    long iTerm = (g.Ki * st.iState) >> 11;
+    long drive = (long)PID_INTEGRAL_DRIVE_MAX << PID_SHIFT;
+    CHECK(iTerm + min(ff, (long)PID_MAX << PID_SHIFT) <= drive + (1L << PID_SHIFT) || iTerm <= 1L << PID_SHIFT,
+          "Ki %ld ff %ld: integral %ld over the drive left by the feed-forward", g.Ki, ff >> PID_SHIFT, iTerm >> PID_SHIFT);
+    CHECK(pid_step(st, g, setpoint, input, PID_MAX, ff) == PID_MAX, "output not at the limit below the target");
+    if(ff == 0)
+      CHECK(labs(iTerm - drive) < (2L << PID_SHIFT), "Ki %ld without a feed-forward winds up to %ld, not the drive max", g.Ki, iTerm >> PID_SHIFT);
+  }
+}
+
+//===========================================================================
+// the heater control on a simulated printer
+//===========================================================================
+
+#define TICK (64.0 * 256.0 / F_CPU) // timer 0 compare B period
+
+// First order heater with a dead time between the power and the sensor
+struct heater_model {
+  double watts, loss, capacity, ambient, temp;
+  std::deque<double> delay;
+  const short (*tt)[2];
+  int len;
+
+  void init(double w, double max_temp, double tau, double dead_time, const short (*table)[2], int table_len)
+  {
+    watts = w;
+    ambient = 25;
+    temp = ambient;
+    loss = watts / (max_temp - ambient);
+    capacity = tau * loss;
+    delay.assign((size_t)(dead_time / TICK), 0.0);
+    tt = table;
+    len = table_len;
+  }
+
+  void tick(bool on, double load)
+  {
+    delay.push_back(on ? watts : 0);
+    double power = delay.front() - load;
+    delay.pop_front();
+    double steady = ambient + power / loss;
+    temp = steady + (temp - steady) * exp(-TICK * loss / capacity);
+  }
+
+  // one ADC conversion of the sensor, the table raw column is OVERSAMPLENR conversions
+  int adc(std::mt19937 &rng)
+  {
+    double raw = tt[len-1][0];
+    for(int i = 1; i < len; i++)
+      if(tt[i][1] < temp) {
+        raw = tt[i-1][0] + (temp - tt[i-1][1]) * (tt[i][0] - tt[i-1][0]) / (double)(tt[i][1] - tt[i-1][1]);
+        break;
+      }
+    double v = raw / OVERSAMPLENR + (rng() % 1000) / 1000.0 - 0.5;
+    return constrain((int)floor(v + 0.5), 0, 1023);
+  }
+};
+
+static heater_model hotend, bed;
+static std::mt19937 adc_noise(6);
+
+#define _HOST_OUTPUT(IO) ((DIO ## IO ## _WPORT & MASK(DIO ## IO ## _PIN)) != 0)
+#define HOST_OUTPUT(IO) _HOST_OUTPUT(IO)
+
+// the old heater control for the reference runs: float lookup and float PID on the same readings
+static bool use_float_pid = false;
+static float_pid ref_hotend;
+// and the bed without PIDTEMPBED: on or off every BED_CHECK_INTERVAL
+static bool use_bang_bang = false;
+static bool bang_on;
+static unsigned long bang_millis;
+
+struct run_result {
+  double settle;      // last time outside +-1C, from the start
+  double overshoot;
+  double ripple;      // peak to peak over the last quarter before the load
+  double drop;        // deepest drop under the load
+};
+
+static double sim_time = 0; // host_millis follows it
+
+// Runs the printer for the given time, target in Celsius, the readings are the firmware's. From
+// load_from on the hotend loses load watts to extrusion at e_speed mm/s.
+static run_result run(double seconds, heater_model &h, double target, double load_from = 1e9, double load = 0, float e_speed = 0)
+{
+  run_result r = { 0, -1e9, 0, 0 };
+  sim_time = max(sim_time, host_millis / 1000.0); // tp_init() delay()s
+  double start = sim_time;
+  double lo = 1e9, hi = -1e9;
+  for(double t = 0; t < seconds; t = sim_time - start) {
+    unsigned char pin = (ADCSRB & (1<<MUX5) ? 8 : 0) | (ADMUX & 7);
+    ADC = pin == TEMP_0_PIN ? hotend.adc(adc_noise) : pin == TEMP_BED_PIN ? bed.adc(adc_noise) : 0;
+    host_timer0_compb();
+    host_e_speed = t >= load_from ? e_speed : 0;
+    hotend.tick(HOST_OUTPUT(HEATER_0_PIN), t >= load_from ? load : 0);
+    bed.tick(HOST_OUTPUT(HEATER_BED_PIN), 0);
+    sim_time += TICK;
+    host_millis = (unsigned long)(sim_time * 1000);
+    if(temp_meas_ready) {
+      manage_heater();
+      if(use_float_pid)
+        soft_pwm[0] = (int)ref_hotend.step(target, float_raw2temp(temptable_1, sizeof(temptable_1) / sizeof(*temptable_1), current_raw[0]), PID_MAX) >> 1;
+      if(use_bang_bang) {
+        if(millis() - bang_millis >= BED_CHECK_INTERVAL) {
+          bang_millis = millis();
+          bang_on = current_raw_bed > bed_minttemp && current_raw_bed < bed_maxttemp && current_raw_bed < target_raw_bed;
+        }
+        soft_pwm_bed = bang_on ? 128 : 0; // the soft PWM never switches it off
+      }
+    }
+    if(t < load_from) {
+      if(fabs(h.temp - target) > 1)
+        r.settle = t;
+      r.overshoot = max(r.overshoot, h.temp - target);
+      if(t > min(seconds, load_from) * 0.75) {
+        lo = min(lo, h.temp);
+        hi = max(hi, h.temp);
+      }
+    }
+    else
+      r.drop = max(r.drop, target - h.temp);
+  }
+  r.ripple = hi - lo;
+  return r;
+}
+
+static void reset_printer()
+{
+  hotend.init(40, 450, 200, 1.5, temptable_1, sizeof(temptable_1) / sizeof(*temptable_1));
+  bed.init(200, 130, 400, 10, temptable_1, sizeof(temptable_1) / sizeof(*temptable_1));
+  Kp = DEFAULT_Kp;
+  Ki = DEFAULT_Ki * PID_dT;
+  Kd = DEFAULT_Kd / PID_dT;
+  Kc = 0;
+  bedKp = DEFAULT_bedKp;
+  bedKi = DEFAULT_bedKi * PID_dT;
+  bedKd = DEFAULT_bedKd / PID_dT;
+  pid_state[0] = pid_state_t();
+  bang_on = false;
+  bang_millis = 0;
+  ref_hotend.init(Kp, Ki, Kd, PID_INTEGRAL_DRIVE_MAX);
+  bed_pid_state = pid_state_t();
+  host_e_speed = 0;
+  host_stopped = false;
+  UDR0.tx_len = 0;
+  tp_init();
+  setTargetHotend(0, 0);
+  setTargetBed(0);
+}
+
+// The ADC schedule: every input is converted in each step, done after exactly ADC_STEP_TICKS ticks, which
+// the #error against TEMP_SAMPLE_TICKS relies on, and a step cut short leaves nothing in the next one
+static void test_adc_schedule()
+{
+  reset_printer();
+  temp_meas_ready = false;
+  int ticks = 0, done_at = -1, steps = 0;
+  for(int i = 0; i < TEMP_SAMPLE_TICKS * 40; i++) {
+    unsigned char pin = (ADCSRB & (1<<MUX5) ? 8 : 0) | (ADMUX & 7);
+    ADC = pin == TEMP_0_PIN ? 300 : pin == TEMP_BED_PIN ? 700 : 0;
+    if(steps > 0 && steps % 4 == 3 && ticks == TEMP_SAMPLE_TICKS - 1) {
+      adc_ch = ADC_CHANNELS - 1; // as if the last input weren't done at the handout
+      adc_count = 5;
+      adc_sum = 12345;
+    }
+    host_timer0_compb();
+    ticks++;
+    if(adc_ch >= ADC_CHANNELS && done_at < 0)
+      done_at = ticks;
+    if(!temp_meas_ready)
+      continue;
+    temp_meas_ready = false;
+    if(steps++ > 0 && steps % 4 != 0) {
+      CHECK(ticks == TEMP_SAMPLE_TICKS, "step %d took %d ticks", steps, ticks);
+      CHECK(done_at == ADC_STEP_TICKS, "step %d: the inputs were done after %d ticks, ADC_STEP_TICKS is %d", steps, done_at, ADC_STEP_TICKS);
+      CHECK(current_raw[0] == 16383 - 300 * OVERSAMPLENR, "step %d: hotend raw %d", steps, current_raw[0]);
+      CHECK(current_raw_bed == 16383 - 700 * OVERSAMPLENR, "step %d: bed raw %d", steps, current_raw_bed);
+    }
+    ticks = 0;
+    done_at = -1;
+  }
+  CHECK(steps >= 39, "%d steps in %d ticks", steps, TEMP_SAMPLE_TICKS * 40);
+  host_stopped = false;
+}
+
+static void test_closed_loop()
+{
+  // the firmware's heater control
+  reset_printer();
+  setTargetHotend(200, 0);
+  run_result fx = run(600, hotend, 200);
+  // the float PID on the same printer
+  reset_printer();
+  use_float_pid = true;
+  setTargetHotend(200, 0);
+  run_result ref = run(600, hotend, 200);
+  use_float_pid = false;
+  printf("  hotend 200C: settled after %.1fs (float PID %.1fs), overshoot %.2fC (%.2fC), ripple %.2fC (%.2fC)\n",
+         fx.settle, ref.settle, fx.overshoot, ref.overshoot, fx.ripple, ref.ripple);
+  CHECK(!host_stopped, "the heater control stopped the printer");
+  CHECK(fx.settle < 400 && fx.settle < ref.settle * 1.1 + 5, "hotend settles after %.1fs, the float PID after %.1fs", fx.settle, ref.settle);
+  CHECK(fx.overshoot < ref.overshoot + 0.5, "hotend overshoot %.2fC, float PID %.2fC", fx.overshoot, ref.overshoot);
+  CHECK(fx.ripple < 1, "hotend ripple %.2fC", fx.ripple);
+
+  // extrusion from 300s on takes 5W at 2mm/s, the feed-forward puts that in ahead of the error
+  reset_printer();
+  setTargetHotend(200, 0);
+  run_result plain = run(600, hotend, 200, 300, 5, 2.0);
+  reset_printer();
+  Kc = 5 * 255 / 40.0 / 2.0;
+  setTargetHotend(200, 0);
+  run_result ff = run(600, hotend, 200, 300, 5, 2.0);
+  printf("  5W extrusion load: %.2fC deepest drop, %.2fC with Kc %.1f\n", plain.drop, ff.drop, (double)Kc);
+  CHECK(ff.drop < plain.drop * 0.75, "the feed-forward doesn't help: %.2fC drop, %.2fC without", ff.drop, plain.drop);
+  CHECK(!host_stopped, "the feed-forward stopped the printer");
+}
+
+// M303 on a heater until it is done, then the gains it stored on a fresh heat-up
+static run_result run_autotune(int extruder, heater_model &h, double target, double hold_time)
+{
+  const char *name = extruder < 0 ? "bed" : "hotend";
+  reset_printer();
+  PID_autotune(target, extruder, 8, true);
+  double t = 0;
+  while(autotune.active && t < 3600) {
+    run(1, h, target);
+    t += 1;
+  }
+  CHECK(!autotune.active, "M303 on the %s still running after an hour", name);
+  CHECK(strstr(UDR0.tx, "PID Autotune finished") != NULL, "M303 on the %s didn't finish: %s", name, UDR0.tx);
+  float p = extruder < 0 ? bedKp : Kp, i = extruder < 0 ? bedKi : Ki, d = extruder < 0 ? bedKd : Kd;
+  CHECK(p > 0 && i > 0 && d > 0, "M303 on the %s gave Kp %f Ki %f Kd %f", name, p, i / PID_dT, d * PID_dT);
+  printf("  M303 on the %s: %.0fs, Kp %.2f Ki %.3f Kd %.2f\n", name, t, p, i / PID_dT, d * PID_dT);
+
+  reset_printer();
+  if(extruder < 0) {
+    bedKp = p; bedKi = i; bedKd = d;
+    setTargetBed(target);
+  }
+  else {
+    Kp = p; Ki = i; Kd = d;
+    setTargetHotend(target, extruder);
+  }
+  updatePID();
+  run_result r = run(hold_time, h, target);
+  printf("  tuned %s %.0fC: settled after %.1fs, overshoot %.2fC, ripple %.2fC\n", name, target, r.settle, r.overshoot, r.ripple);
+  CHECK(!host_stopped, "the tuned gains stopped the printer");
+  CHECK(r.settle < hold_time * 0.8 && r.overshoot < 10 && r.ripple < 1, "tuned %s gains: settle %.1fs overshoot %.2fC ripple %.2fC",
+        name, r.settle, r.overshoot, r.ripple);
+  return r;
+}
+
+static void test_autotune()
+{
+  run_autotune(0, hotend, 200, 600);
+  run_result pid = run_autotune(-1, bed, 60, 1800);
+
+  // the same bed switched on and off every BED_CHECK_INTERVAL, as without PIDTEMPBED
+  reset_printer();
+  use_bang_bang = true;
+  setTargetBed(60);
+  run_result bang = run(1800, bed, 60);
+  use_bang_bang = false;
+  printf("  bed 60C switched every %dms: settled after %.1fs, overshoot %.2fC, ripple %.2fC\n",
+         BED_CHECK_INTERVAL, bang.settle, bang.overshoot, bang.ripple);
+  CHECK(pid.settle < bang.settle * 0.5, "bed PID settles after %.1fs, switched after %.1fs", pid.settle, bang.settle);
+  CHECK(pid.ripple < bang.ripple * 0.25, "bed PID ripple %.2fC, switched %.2fC", pid.ripple, bang.ripple);
+  CHECK(pid.overshoot <= bang.overshoot, "bed PID overshoot %.2fC, switched %.2fC", pid.overshoot, bang.overshoot);
+}
+
+int main()
+{
+  test_lookup();
+  test_pid_step();
+  test_pid_feedforward();
+  test_adc_schedule();
+  test_closed_loop();
+  test_autotune();
+  return test_result("test_temperature");
+}
@@ -0,0 +1,231 @@
+#!/usr/bin/python
+#
+# Runs the heater control of temperature.cpp against a simulated hotend or bed
+"""Thermal plant simulator for the heater control
+
+Steps the firmware's fixed point PID (pid_scale/pid_step in temperature.cpp), the thermistor
+lookup (tt_raw2temp) and the soft PWM against a first order plus dead time model of a heater,
+at the firmware's sampling period. The lookup and the PID are temperature.cpp itself, built for
+the host as test/pidstep (needs make and g++), so this always runs the current code. The gains,
+the thermistor table and the sampling period are read from Configuration.h,
+Configuration_adv.h and thermistortables.h, so a change there can be tried here before it goes
+on a printer.
+
+Usage: python thermalSimulator.py [options]
+
+Options:
+  -h, --help        show this help
+  --bed             simulate the bed instead of hotend 0
+  --target=...      setpoint in Celsius (default: 200 for the hotend, 60 for the bed)
+  --time=...        simulated seconds (default: 600 for the hotend, 1800 for the bed)
+  --ambient=...     ambient temperature in Celsius (default: 25)
+  --watts=...       heater power (default: 40 for the hotend, 200 for the bed)
+  --max-temp=...    temperature the heater settles at on full power (default: 450 / 130)
+  --tau=...         time constant of the heater block in seconds (default: 200 / 400)
+  --dead-time=...   seconds before heater power shows at the sensor (default: 1.5 / 10)
+  --thermistor=...  table number from thermistortables.h (default: TEMP_SENSOR_0 / TEMP_SENSOR_BED)
+  --kp=... --ki=... --kd=...  gains in M301/M304 units (default: from Configuration.h)
+  --load=...        extra heat loss in watts from half time on, e.g. a fan or extrusion (default: 0)
+  --ff=...          feed-forward in PID output units during the load, like Kc*e_speed (default: 0)
+  --band=...        +-Celsius the temperature has to stay in to count as settled (default: 1)
+  --csv=...         write time, temperature and heater power of every sample to this file
+
+Reports the settle time, the overshoot, the steady state ripple and the host CPU time per
+control step. The host time only compares versions of the loop with each other; the AVR
+cost has to be measured on the printer.
+"""
+
+from __future__ import print_function
+import getopt
+import os
+import re
+import subprocess
+import sys
+
+F_CPU = 16000000
+PID_SHIFT = 12
+
+here = os.path.dirname(os.path.abspath(__file__))
+
+def read_defines(name):
+    "Active #defines of a header as name -> text, the first one wins"
+    defines = {}
+    for line in open(os.path.join(here, name)):
+        m = re.match(r'\s*#define\s+(\w+)\s*(.*?)\s*(//.*)?$', line)
+        if m and m.group(1) not in defines:
+            defines[m.group(1)] = m.group(2)
+    return defines
+
+def number(text):
+    return float(re.match(r'\(?\s*([-+0-9.eE]+)', text).group(1))
+
+def read_table(n):
+    "temptable_<n> of thermistortables.h as [raw, celsius] rows, raw in the OVERSAMPLENR scale"
+    text = open(os.path.join(here, "thermistortables.h")).read()
+    m = re.search(r'temptable_%d\s*\[\]\[2\][^{]*\{(.*?)\};' % n, text, re.S)
+    if not m:
+        raise SystemExit("no temptable_%d in thermistortables.h" % n)
+    rows = []
+    for raw, celsius in re.findall(r'\{\s*([^,}]+?)\s*,\s*([^}]+?)\s*\}', m.group(1)):
+        rows.append([int(eval(raw.replace("OVERSAMPLENR", "16"))), int(celsius)])
+    return rows
+
+def temp2adc(table, celsius):
+    "What the ADC sums for a real temperature (float, linear between the table rows)"
+    for i in range(1, len(table)):
+        if table[i][1] < celsius:
+            r0, t0 = table[i-1]
+            return r0 + (celsius - t0) * (table[i][0] - r0) / float(table[i][1] - t0)
+    return table[-1][0]
+
+class Firmware:
+    "tt_raw2temp() and pid_step() of temperature.cpp, run through test/pidstep"
+    def __init__(self, table, kp, ki, kd, drive_max, max_output):
+        test = os.path.join(here, "test")
+        if subprocess.call(["make", "-s", "-C", test, "build/pidstep"]) != 0:
+            raise SystemExit("building test/pidstep failed")
+        args = [os.path.join(test, "build", "pidstep")] + ["%.9g" % k for k in (kp, ki, kd)]
+        self.proc = subprocess.Popen(args + [str(drive_max), str(max_output)],
+                                     stdin=subprocess.PIPE, stdout=subprocess.PIPE, universal_newlines=True)
+        self.proc.stdin.write("table %d\n" % len(table))
+        for raw, celsius in table:
+            self.proc.stdin.write("%d %d\n" % (raw, celsius))
+
+    def step(self, current_raw, setpoint, ff):
+        "One reading through the lookup and the PID: input in 1/256 degC, heater power"
+        self.proc.stdin.write("%d %d %d\n" % (current_raw, setpoint, ff))
+        self.proc.stdin.flush()
+        input, output = self.proc.stdout.readline().split()
+        return int(input), int(output)
+
+    def close(self):
+        "Ends the run, returns the host time per pid_step() in seconds"
+        self.proc.stdin.close()
+        line = self.proc.stdout.readline().split()
+        self.proc.wait()
+        return int(line[1]) * 1e-9
+
+class Heater:
+    "First order heater with a dead time between the power and the sensor"
+    def __init__(self, watts, max_temp, tau, dead_time, ambient, dt):
+        self.watts = watts
+        self.loss = watts / float(max_temp - ambient)   # W/K
+        self.capacity = tau * self.loss                 # J/K
+        self.ambient = ambient
+        self.temp = ambient
+        self.delay = [0.0] * max(1, int(round(dead_time / dt)))
+        self.dt = dt
+
+    def step(self, duty, load):
+        self.delay.append(duty)
+        power = self.watts * self.delay.pop(0) - load
+        # exact solution over one sample, stable for any dt
+        steady = self.ambient + power / self.loss
+        k = 2.718281828459045 ** (-self.dt * self.loss / self.capacity)
+        self.temp = steady + (self.temp - steady) * k
+        return self.temp
+
+def main(argv):
+    conf = read_defines("Configuration.h")
+    adv = read_defines("Configuration_adv.h")
+
+    bed = False
+    opts_given = {}
+    try:
+        opts, args = getopt.getopt(argv, "h", ["help", "bed", "target=", "time=", "ambient=", "watts=",
+            "max-temp=", "tau=", "dead-time=", "thermistor=", "kp=", "ki=", "kd=", "load=", "ff=",
+            "band=", "csv="])
+    except getopt.GetoptError:
+        usage()
+        sys.exit(2)
+    for opt, arg in opts:
+        if opt in ("-h", "--help"):
+            usage()
+            sys.exit()
+        elif opt == "--bed":
+            bed = True
+        else:
+            opts_given[opt[2:]] = arg
+
+    def opt(name, hotend, bed_value):
+        if name in opts_given:
+            return float(opts_given[name])
+        return bed_value if bed else hotend
+
+    pid_dT = number(adv["TEMP_SAMPLE_TICKS"]) / (F_CPU / 64.0 / 256.0)
+    if bed:
+        if "PIDTEMPBED" not in conf:
+            print("PIDTEMPBED is off in Configuration.h, these are the gains it would use")
+        gains = [number(conf["DEFAULT_bedKp"]), number(conf["DEFAULT_bedKi"]), number(conf["DEFAULT_bedKd"])]
+        max_output = drive_max = int(number(conf["MAX_BED_POWER"]))
+        sensor = int(number(conf["TEMP_SENSOR_BED"]))
+    else:
+        gains = [number(conf["DEFAULT_Kp"]), number(conf["DEFAULT_Ki"]), number(conf["DEFAULT_Kd"])]
+        max_output = int(number(conf["PID_MAX"]))
+        drive_max = int(number(conf["PID_INTEGRAL_DRIVE_MAX"]))
+        sensor = int(number(conf["TEMP_SENSOR_0"]))
+    gains = [opt("kp", gains[0], gains[0]), opt("ki", gains[1], gains[1]), opt("kd", gains[2], gains[2])]
+    sensor = int(opt("thermistor", sensor, sensor))
+
+    target = opt("target", 200, 60)
+    duration = opt("time", 600, 1800)
+    ambient = opt("ambient", 25, 25)
+    load = opt("load", 0, 0)
+    ff = int(opt("ff", 0, 0) * (1 << PID_SHIFT))
+    band = opt("band", 1, 1)
+
+    table = read_table(sensor)
+    # M301/M304 units to the stored ones, like the firmware does with DEFAULT_Ki*PID_dT
+    firmware = Firmware(table, gains[0], gains[1] * pid_dT, gains[2] / pid_dT, drive_max, max_output)
+    heater = Heater(opt("watts", 40, 200), opt("max-temp", 450, 130), opt("tau", 200, 400),
+                    opt("dead-time", 1.5, 10), ambient, pid_dT)
+    setpoint = int(target * 256)
+
+    csv = open(opts_given["csv"], "w") if "csv" in opts_given else None
+    steps = int(duration / pid_dT)
+    temps = []
+    temp = ambient
+    for n in range(steps):
+        t = n * pid_dT
+        loaded = t >= duration / 2
+        # the ADC sums, the ISR stores 16383 - sum (current_raw), manage_heater converts it
+        current_raw = 16383 - int(round(temp2adc(table, temp)))
+        input, output = firmware.step(current_raw, setpoint, ff if loaded else 0)
+        # soft_pwm = output >> 1 out of the 128 step PWM period
+        duty = (output >> 1) / 128.0
+        temp = heater.step(duty, load if loaded else 0)
+        temps.append(temp)
+        if csv:
+            csv.write("%.3f,%.3f,%d\n" % (t, temp, output))
+    pid_time = firmware.close()
+    if csv:
+        csv.close()
+
+    # settled: the last time the temperature left the band, looked at before the load step
+    settle = None
+    end = int(steps / 2) if load else steps
+    for n in range(end - 1, -1, -1):
+        if abs(temps[n] - target) > band:
+            settle = (n + 1) * pid_dT if n + 1 < end else None
+            break
+    else:
+        settle = 0.0
+    overshoot = max(temps[:end]) - target
+    tail = temps[int(end * 0.75):end]
+
+    print("%s, thermistor %d, Kp %.2f Ki %.3f Kd %.2f, PID_dT %.4fs" %
+          ("bed" if bed else "hotend", sensor, gains[0], gains[1], gains[2], pid_dT))
+    print("settle time:      %s" % ("%.1fs (+-%.1fC)" % (settle, band) if settle is not None else "not settled"))
+    print("overshoot:        %.2fC" % max(overshoot, 0))
+    print("ripple:           %.2fC peak to peak over the last quarter" % (max(tail) - min(tail)))
+    if load:
+        after = temps[end:]
+        print("load step:        %.2fC deepest drop, %.2fC ripple at the end" %
+              (target - min(after), max(after[int(len(after) * 0.75):]) - min(after[int(len(after) * 0.75):])))
+    print("host time/step:   %.3fus" % (pid_time * 1e6))
+
+def usage():
+    print(__doc__)
+
+if __name__ == "__main__":
+    main(sys.argv[1:])
@@ -6,6 +6,7 @@
 #include "language.h"
 #include "temperature.h"
 #include "EEPROMwrite.h"
+#include "fixedpoint.h"
 //ELEFU: We changed the LCD from the defauly library to be TWI compatible. Huzzah. Some minor changed below relate to this as well.
 #include "LiquidCrystal_I2C.h"
 //===========================================================================
@@ -1308,6 +1309,7 @@ void MainMenu::showControlTemp()
           else
           {
             Kp= encoderpos;
+            updatePID();
             encoderpos=activeline*lcdslow;
               
           }
@@ -1343,6 +1345,7 @@ void MainMenu::showControlTemp()
           else
           {
             Ki= encoderpos/10.*PID_dT;
+            updatePID();
             encoderpos=activeline*lcdslow;
               
           }
@@ -1379,6 +1382,7 @@ void MainMenu::showControlTemp()
           else
           {
             Kd= encoderpos;
+            updatePID();
             encoderpos=activeline*lcdslow;
               
           }
@@ -2533,21 +2537,14 @@ void MainMenu::update()
 //  convert float to string with +123.4 format
 char *ftostr3(const float &x)
 {
-  //sprintf(conv,"%5.1f",x);
-  int xx=x;
-  conv[0]=(xx/100)%10+'0';
-  conv[1]=(xx/10)%10+'0';
-  conv[2]=(xx)%10+'0';
+  fixp_digits(conv, labs(fixp_from_float(x, 0)), 3, 0);
   conv[3]=0;
   return conv;
 }
 
 char *itostr2(const uint8_t &x)
 {
-  //sprintf(conv,"%5.1f",x);
-  int xx=x;
-  conv[0]=(xx/10)%10+'0';
-  conv[1]=(xx)%10+'0';
+  fixp_digits(conv, x, 2, 0);
   conv[2]=0;
   return conv;
 }
@@ -2555,58 +2552,41 @@ char *itostr2(const uint8_t &x)
 //  convert float to string with +123.4 format
 char *ftostr31(const float &x)
 {
-  int xx=x*10;
+  long xx=fixp_from_float(x, 1);
   conv[0]=(xx>=0)?'+':'-';
-  xx=abs(xx);
-  conv[1]=(xx/1000)%10+'0';
-  conv[2]=(xx/100)%10+'0';
-  conv[3]=(xx/10)%10+'0';
-  conv[4]='.';
-  conv[5]=(xx)%10+'0';
+  fixp_digits(conv+1, labs(xx), 4, 1);
   conv[6]=0;
   return conv;
 }
 
+//  convert float to string with +1.23 format
 char *ftostr32(const float &x)
 {
-  int xx=x*100;
+  long xx=fixp_from_float(x, 2);
   conv[0]=(xx>=0)?'+':'-';
-  xx=abs(xx);
-  conv[1]=(xx/100)%10+'0';
-  conv[2]='.';
-  conv[3]=(xx/10)%10+'0';
-  conv[4]=(xx)%10+'0';
-  conv[6]=0;
+  fixp_digits(conv+1, labs(xx), 3, 2);
+  conv[5]=0;
   return conv;
 }
 
 char *itostr31(const int &xx)
 {
   conv[0]=(xx>=0)?'+':'-';
-  conv[1]=(xx/1000)%10+'0';
-  conv[2]=(xx/100)%10+'0';
-  conv[3]=(xx/10)%10+'0';
-  conv[4]='.';
-  conv[5]=(xx)%10+'0';
+  fixp_digits(conv+1, abs(xx), 4, 1);
   conv[6]=0;
   return conv;
 }
 
 char *itostr3(const int &xx)
 {
-  conv[0]=(xx/100)%10+'0';
-  conv[1]=(xx/10)%10+'0';
-  conv[2]=(xx)%10+'0';
+  fixp_digits(conv, abs(xx), 3, 0);
   conv[3]=0;
   return conv;
 }
 
 char *itostr4(const int &xx)
 {
-  conv[0]=(xx/1000)%10+'0';
-  conv[1]=(xx/100)%10+'0';
-  conv[2]=(xx/10)%10+'0';
-  conv[3]=(xx)%10+'0';
+  fixp_digits(conv, abs(xx), 4, 0);
   conv[4]=0;
   return conv;
 }
@@ -2614,15 +2594,9 @@ char *itostr4(const int &xx)
 //  convert float to string with +1234.5 format
 char *ftostr51(const float &x)
 {
-  int xx=x*10;
+  long xx=fixp_from_float(x, 1);
   conv[0]=(xx>=0)?'+':'-';
-  xx=abs(xx);
-  conv[1]=(xx/10000)%10+'0';
-  conv[2]=(xx/1000)%10+'0';
-  conv[3]=(xx/100)%10+'0';
-  conv[4]=(xx/10)%10+'0';
-  conv[5]='.';
-  conv[6]=(xx)%10+'0';
+  fixp_digits(conv+1, labs(xx), 5, 1);
   conv[7]=0;
   return conv;
 }
@@ -2630,15 +2604,9 @@ char *ftostr51(const float &x)
 //  convert float to string with +123.45 format
 char *ftostr52(const float &x)
 {
-  int xx=x*100;
+  long xx=fixp_from_float(x, 2);
   conv[0]=(xx>=0)?'+':'-';
-  xx=abs(xx);
-  conv[1]=(xx/10000)%10+'0';
-  conv[2]=(xx/1000)%10+'0';
-  conv[3]=(xx/100)%10+'0';
-  conv[4]='.';
-  conv[5]=(xx/10)%10+'0';
-  conv[6]=(xx)%10+'0';
+  fixp_digits(conv+1, labs(xx), 5, 2);
   conv[7]=0;
   return conv;
 }